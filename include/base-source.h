@@ -23,22 +23,16 @@
 #endif
 
 #include "configuration.h"
+#include "sample-block.h"
+#include "frame-ring.h"
+#include "frame-pool.h"
 
 #include <armadillo>
 #include <QtCore>
 
-namespace datasource {
-	
-/*! Type alias for a single frame of data.
- * This is declared inside its own namespace because the
- * Q_DECLARE_METATYPE macro must have the fully-qualified
- * name, but that macro itself must appear in the global
- * namespace.
- */
-using Samples = arma::Mat<qint16>;
-};
-
-Q_DECLARE_METATYPE(datasource::Samples);
+#include <algorithm> // std::remove_if
+#include <memory> // std::shared_ptr
+#include <vector>
 
 namespace datasource {
 
@@ -64,6 +58,11 @@ class LIBDATA_SOURCE_VISIBILITY BaseSource : public QObject {
 
 	public:
 
+		/*! Maximum number of blocks held by consumers in unthrottled mode,
+		 * for sources which support it. See emitUnthrottled().
+		 */
+		static constexpr int MaxBlocksInFlight = 8;
+
 		/*! Construct a BaseSource object.
 		 * \param sourceType The type of source represented, i.e., "file" or "device".
 		 * \param deviceType The type of the MEA device, e.g., "hidens" or "mcs".
@@ -97,6 +96,7 @@ class LIBDATA_SOURCE_VISIBILITY BaseSource : public QObject {
 			m_analogOutput({})
 		{ 
 			qRegisterMetaType<datasource::Samples>();
+			qRegisterMetaType<datasource::SampleBlock>();
 			m_gettableParameters = {
 						"start-time",
 						"state",
@@ -122,6 +122,32 @@ class LIBDATA_SOURCE_VISIBILITY BaseSource : public QObject {
 		/*! Return the interval in milliseconds between reads from the source. */
 		int readInterval() const { return m_readInterval; }
 
+		/*! Attach a new ring buffer to the source, from which data can be
+		 * pulled without going through the event loop.
+		 *
+		 * \param capacity The number of frames the ring can hold.
+		 * \return The consumer's handle to the ring.
+		 *
+		 * Every frame emitted in the dataAvailable() signal is also copied,
+		 * by publish() in the source's thread, into each attached ring. The
+		 * source sizes the ring's slots for its frames when it publishes the
+		 * first frame after the ring is attached, and filling the ring
+		 * performs no allocation from then on. The ring is detached from
+		 * the source when the consumer destroys the returned handle.
+		 *
+		 * Unlike other methods, this may safely be called from any thread.
+		 * It touches none of the source's state other than its list of
+		 * rings, which is guarded by a lock.
+		 */
+		std::shared_ptr<FrameRing> attachRing(int capacity)
+		{
+			auto ring = std::make_shared<FrameRing>(capacity);
+			QMutexLocker lock(&m_ringLock);
+			m_newRings.push_back(ring);
+			m_nrings.storeRelease(static_cast<int>(m_rings.size() + m_newRings.size()));
+			return ring;
+		}
+
 	public:
 		/*! Return a string representing the type of this source, e.g., "file" or "device". */
 		const QString& sourceType() const { return m_sourceType; }
@@ -321,12 +347,15 @@ class LIBDATA_SOURCE_VISIBILITY BaseSource : public QObject {
 		void status(QVariantMap status);
 
 		/*! Emitted when new data is available from the source.
-		 * \param samples An Armadillo matrix containing the new data. This is shaped as
-		 * (nchannels, nsamples). Because Armadillo uses column-major ordering, the raw
-		 * data is laid out with all samples from a single channel, followed by the next
-		 * channel, etc.
+		 * \param samples A reference-counted block containing the new data. This is
+		 * shaped as (nsamples, nchannels). Because Armadillo uses column-major ordering,
+		 * the raw data is laid out with all samples from a single channel, followed by
+		 * the next channel, etc.
+		 *
+		 * The block is immutable, and copying it (e.g., when the signal is delivered
+		 * to receivers in other threads) does not copy the underlying data.
 		 */
-		void dataAvailable(datasource::Samples samples);
+		void dataAvailable(datasource::SampleBlock samples);
 
 		/*! Emitted when an error occurs on the source.
 		 *
@@ -339,6 +368,74 @@ class LIBDATA_SOURCE_VISIBILITY BaseSource : public QObject {
 
 	protected:
 
+		/*! Publish a new frame of data to all consumers.
+		 *
+		 * Subclasses should call this, rather than emitting dataAvailable()
+		 * directly, so that the frame is also delivered to any rings
+		 * attached with attachRing().
+		 */
+		void publish(const SampleBlock& block)
+		{
+			if (m_nrings.loadAcquire()) {
+				QMutexLocker lock(&m_ringLock);
+
+				/* Size newly-attached rings for this source's frames. */
+				for (auto& ring : m_newRings) {
+					ring->reserve(block.nsamples(), block.nchannels());
+					m_rings.push_back(std::move(ring));
+				}
+				m_newRings.clear();
+				for (auto it = m_rings.begin(); it != m_rings.end(); ) {
+					if (it->use_count() == 1) {
+						/* The consumer released its handle. */
+						it = m_rings.erase(it);
+					} else {
+						(*it)->push(block.samples());
+						++it;
+					}
+				}
+				m_nrings.storeRelease(static_cast<int>(m_rings.size()));
+			}
+			emit dataAvailable(block);
+		}
+
+		/*! Emit chunks as fast as consumers release them, for sources which
+		 * support unthrottled streaming.
+		 *
+		 * \param emitNext Function emitting the next chunk with publish(),
+		 * 	and returning its frame, or a null frame if none is ready.
+		 * \return True if any chunk was emitted.
+		 *
+		 * Chunks are emitted until MaxBlocksInFlight of the blocks emitted
+		 * this way are held by consumers. A block is released once only its
+		 * frame pool and the reference kept here refer to its frame, so the
+		 * frame must come from a FramePool, and emitNext must not keep any
+		 * other reference to it. Subclasses should poll again at once if
+		 * this returns true, and back off otherwise, and call
+		 * releaseInFlight() when the stream stops.
+		 */
+		template <typename EmitFunction>
+		bool emitUnthrottled(EmitFunction emitNext)
+		{
+			m_inFlight.erase(std::remove_if(m_inFlight.begin(), m_inFlight.end(),
+						[](const std::shared_ptr<Samples>& frame) {
+							return !FramePool::isHeldOutside(frame, 1);
+						}), m_inFlight.end());
+			bool emitted = false;
+			while (m_inFlight.size() < static_cast<size_t>(MaxBlocksInFlight)) {
+				auto frame = emitNext();
+				if (!frame) {
+					break;
+				}
+				m_inFlight.push_back(std::move(frame));
+				emitted = true;
+			}
+			return emitted;
+		}
+
+		/*! Forget the blocks emitted by emitUnthrottled(). */
+		void releaseInFlight() { m_inFlight.clear(); }
+
 		/*! Pack all parameters indicating the status of the source into a map. */
 		virtual QVariantMap packStatus() {
 			return {
@@ -454,6 +551,40 @@ class LIBDATA_SOURCE_VISIBILITY BaseSource : public QObject {
 		 * used to identify the location, such as a filename or a remote hostname.
 		 */
 		QString m_sourceLocation;
+
+		/*! Pool of preallocated frames. Subclasses should acquire each
+		 * new frame from this pool, fill it, and publish() it, so that
+		 * reading and publishing a frame performs no allocation in the
+		 * steady state. Delivering it may still allocate: Qt allocates an
+		 * event for each receiver connected to dataAvailable() through a
+		 * queued connection. Consumers which must avoid this should connect
+		 * directly, or pull frames from a ring with attachRing().
+		 */
+		FramePool m_framePool;
+
+	private:
+
+		/* Rings attached by consumers with attachRing(), and those attached
+		 * since the last frame was published, whose slots are not yet sized.
+		 */
+		std::vector<std::shared_ptr<FrameRing>> m_rings;
+		std::vector<std::shared_ptr<FrameRing>> m_newRings;
+
+		/* Guards the list of rings, which may be modified from any thread.
+		 * This is only taken by the producer if rings are attached, and is
+		 * never contended except while a ring is being attached.
+		 */
+		QMutex m_ringLock;
+
+		/* Number of attached rings, checked by the producer before
+		 * taking the lock.
+		 */
+		QAtomicInt m_nrings;
+
+		/* Blocks emitted by emitUnthrottled(), which may still be held
+		 * by consumers.
+		 */
+		std::vector<std::shared_ptr<Samples>> m_inFlight;
 };
 
 }; // end datasource namespace
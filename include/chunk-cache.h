@@ -0,0 +1,143 @@
+/*! \file chunk-cache.h
+ *
+ * Process-wide cache of decoded chunks of recordings.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef CHUNK_CACHE_H_
+#define CHUNK_CACHE_H_
+
+#include "base-source.h"
+
+#include <QtCore>
+
+#include <list>
+
+namespace datasource {
+
+/*! \class ChunkCache
+ *
+ * The ChunkCache class keeps decoded chunks of recordings in memory, so that
+ * any number of readers of the same recording, e.g., several FileSources
+ * opened by different clients, decode each chunk only once. Chunks are
+ * identified by the recording's canonical path, its size and modification
+ * time when the reader opened it, the dataset within it, and the index of the
+ * chunk in the dataset. A recording rewritten in place is therefore decoded
+ * afresh, and its stale chunks are eventually evicted.
+ *
+ * The cache holds at most capacity() bytes of chunks, evicting the least
+ * recently used chunks beyond that. Chunks are implicitly-shared byte arrays,
+ * so a chunk found in the cache is never copied, and remains valid for as
+ * long as the caller holds it, even if it is evicted.
+ *
+ * All methods are thread-safe. Readers usually share the instance() for
+ * the whole process, though separate caches may also be constructed.
+ */
+class LIBDATA_SOURCE_VISIBILITY ChunkCache {
+
+	public:
+
+		/*! Default capacity of the cache, in bytes. */
+		static constexpr quint64 DefaultCapacity = 256 * 1024 * 1024;
+
+		/*! Identifies a chunk of a dataset in a version of a recording,
+		 * given by its size and modification time in milliseconds since
+		 * the epoch.
+		 */
+		struct Key {
+			QString file;
+			QString dataset;
+			quint64 index;
+			qint64 size;
+			qint64 modified;
+
+			bool operator==(const Key& other) const
+			{
+				return (index == other.index) && (size == other.size) &&
+						(modified == other.modified) && (file == other.file) &&
+						(dataset == other.dataset);
+			}
+		};
+
+		/*! Construct an empty cache with the given capacity, in bytes. */
+		explicit ChunkCache(quint64 capacity = DefaultCapacity);
+
+		ChunkCache(const ChunkCache&) = delete;
+		ChunkCache& operator=(const ChunkCache&) = delete;
+
+		/*! Return the cache shared by all readers in the process. */
+		static ChunkCache& instance();
+
+		/*! Return the chunk with the given key, or a null array if it is
+		 * not cached. Every call counts as a hit or a miss.
+		 */
+		QByteArray find(const Key& key);
+
+		/*! Insert a chunk, replacing any with the same key, and evict the
+		 * least recently used chunks beyond the capacity. Chunks larger than
+		 * the whole capacity are not cached.
+		 */
+		void insert(const Key& key, const QByteArray& data);
+
+		/*! Remove every chunk. */
+		void clear();
+
+		/*! Return the maximum number of bytes of chunks held. */
+		quint64 capacity() const;
+
+		/*! Set the maximum number of bytes of chunks held, evicting chunks
+		 * as needed. A capacity of zero disables the cache.
+		 */
+		void setCapacity(quint64 bytes);
+
+		/*! Return the number of bytes of chunks held. */
+		quint64 size() const;
+
+		/*! Return the number of chunks held. */
+		int count() const;
+
+		/*! Return the number of calls to find() which returned a chunk. */
+		quint64 hits() const;
+
+		/*! Return the number of calls to find() which found no chunk. */
+		quint64 misses() const;
+
+		/*! Return the fraction of calls to find() which returned a chunk,
+		 * or zero if there have been none.
+		 */
+		float hitRate() const;
+
+	private:
+
+		/* Evict the least recently used chunks beyond the capacity.
+		 * The lock must be held.
+		 */
+		void evict();
+
+		/* A cached chunk, and its position in the order of use. */
+		struct Entry {
+			QByteArray data;
+			std::list<Key>::iterator use;
+		};
+
+		/* Protects all members below. */
+		mutable QMutex m_lock;
+
+		/* Cached chunks, and their keys from least to most recently used. */
+		QHash<Key, Entry> m_entries;
+		std::list<Key> m_lru;
+
+		quint64 m_capacity;
+		quint64 m_size;
+		quint64 m_hits;
+		quint64 m_misses;
+};
+
+/*! Hash a chunk's key, for use in a QHash. */
+LIBDATA_SOURCE_VISIBILITY uint qHash(const ChunkCache::Key& key, uint seed = 0);
+
+}; // end datasource namespace
+
+#endif
+
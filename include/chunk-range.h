@@ -0,0 +1,172 @@
+/*! \file chunk-range.h
+ *
+ * Class for reading a range of a recording synchronously, chunk by chunk.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef CHUNK_RANGE_H_
+#define CHUNK_RANGE_H_
+
+#include "base-source.h"
+#include "recording-file.h"
+
+#include <QtCore>
+
+#include <iterator> // std::input_iterator_tag
+#include <memory> // std::unique_ptr
+#include <vector>
+
+namespace datasource {
+
+/*! \class ChunkRange
+ *
+ * The ChunkRange class reads samples [start, stop) of selected channels of
+ * a recording, in chunks of a fixed number of samples, without any timers,
+ * signals or event loop. It is intended for offline analysis, e.g.:
+ *
+ * \code
+ * for (const auto& chunk : source.chunks(0, 200000, 20000, "0-15")) {
+ * 	process(chunk);
+ * }
+ * \endcode
+ *
+ * Each range opens the recording itself, and reads it only from the thread
+ * iterating over it. Ranges of the same file are therefore independent, and
+ * separate threads, e.g., tasks run with QtConcurrent, may each iterate over
+ * their own range, processing their chunks in parallel. A single range must
+ * not be used by more than one thread at a time.
+ *
+ * How much of the reading itself runs in parallel depends on the format.
+ * Raw binary files are read without any lock. Every call into the HDF5
+ * library holds the process-wide hdf5Mutex(), so reads of uncompressed HDF5
+ * files are serialized, however many ranges read them. Only the storage of
+ * compressed chunks is read under the lock, and chunks are decompressed in
+ * parallel on the global thread pool. A range decompresses only the chunks
+ * each read needs, and none ahead of it, so that many ranges reading at once
+ * do not flood the pool. A single range keeps many threads busy when its
+ * chunk size spans several chunks of the file.
+ *
+ * The range is an input range: the chunk to which an iterator refers is
+ * read into a buffer owned by the range, and is overwritten when any
+ * iterator over the range is incremented. Chunks which must outlive the
+ * next increment should be copied. Every chunk has chunkSize() samples,
+ * except the last, which holds the remainder of the range.
+ */
+class LIBDATA_SOURCE_VISIBILITY ChunkRange {
+
+	public:
+
+		/*! \class iterator
+		 *
+		 * Iterator over the chunks of a ChunkRange.
+		 */
+		class LIBDATA_SOURCE_VISIBILITY iterator {
+			public:
+				using iterator_category = std::input_iterator_tag;
+				using value_type = Samples;
+				using difference_type = qint64;
+				using pointer = const Samples*;
+				using reference = const Samples&;
+
+				iterator() : m_range(nullptr), m_index(0) { }
+
+				reference operator*() const { return m_range->m_chunk; }
+				pointer operator->() const { return &m_range->m_chunk; }
+
+				/*! Read the next chunk. */
+				iterator& operator++();
+
+				bool operator==(const iterator& other) const
+				{ return (m_range == other.m_range) && (m_index == other.m_index); }
+				bool operator!=(const iterator& other) const
+				{ return !(*this == other); }
+
+				/*! Return the sample of the file at which the chunk begins. */
+				quint64 start() const;
+
+			private:
+				friend class ChunkRange;
+				iterator(ChunkRange* range, quint64 index) :
+					m_range(range), m_index(index) { }
+
+				ChunkRange* m_range;
+				quint64 m_index;
+		};
+
+		/*! Construct a range over a recording.
+		 *
+		 * \param filename The recording to read.
+		 * \param start The first sample read.
+		 * \param stop One past the last sample read. This is clipped to the
+		 * 	length of the file.
+		 * \param chunkSize The number of samples in each chunk.
+		 * \param channels The channels read into each chunk's columns, in
+		 * 	order. An empty list selects every channel.
+		 *
+		 * This throws an std::invalid_argument if the file cannot be read,
+		 * the chunk size is zero, or any channel is not in the file.
+		 */
+		ChunkRange(const QString& filename, quint64 start, quint64 stop,
+				quint64 chunkSize, const std::vector<int>& channels = {});
+
+		ChunkRange(ChunkRange&&) = default;
+		ChunkRange& operator=(ChunkRange&&) = default;
+		ChunkRange(const ChunkRange&) = delete;
+		ChunkRange& operator=(const ChunkRange&) = delete;
+
+		/*! Return an iterator at the first chunk, which is read. */
+		iterator begin();
+
+		/*! Return an iterator one past the last chunk. */
+		iterator end();
+
+		/*! Return the first sample of the range. */
+		quint64 start() const;
+
+		/*! Return one past the last sample of the range. */
+		quint64 stop() const;
+
+		/*! Return the number of samples in each chunk. */
+		quint64 chunkSize() const;
+
+		/*! Return the number of chunks in the range. */
+		quint64 size() const;
+
+		/*! Return the number of channels in each chunk. */
+		int nchannels() const;
+
+		/*! Return the sample rate of the recording, in Hz. */
+		float sampleRate() const;
+
+		/*! Read the chunk with the given index into \p out, in any order.
+		 * This does not affect the chunk to which iterators refer, and
+		 * throws an std::out_of_range if the index is not less than size().
+		 */
+		void read(quint64 index, Samples& out);
+
+	private:
+
+		/* Read the chunk with the given index into the range's buffer. */
+		void load(quint64 index);
+
+		/* The recording, opened for this range alone, without read-ahead. */
+		std::unique_ptr<RecordingFile> m_file;
+
+		/* Range of samples [start, stop) read, in chunks of chunkSize. */
+		quint64 m_start;
+		quint64 m_stop;
+		quint64 m_chunkSize;
+
+		/* Channels read into each chunk, and their runs in the file. */
+		int m_nchannels;
+		RecordingFile::ChannelRuns m_runs;
+
+		/* The chunk to which iterators refer. */
+		Samples m_chunk;
+};
+
+}; // end datasource namespace
+
+#endif
+
@@ -10,8 +10,23 @@
 
 #include "base-source.h"
 #include "file-source.h"
+#include "chunk-range.h"
+#include "recording-file.h"
+#include "raw-recording-file.h"
+#include "chunk-cache.h"
+#include "hdf5-chunk-reader.h"
 #include "mcs-source.h"
 #include "hidens-source.h"
+#include "kernel-isa.h"
+#include "hidens-convert.h"
+#include "synthetic-source.h"
+#include "recording-sink.h"
+#include "source-stage.h"
+#include "history-buffer.h"
+#include "preview-stage.h"
+#include "spike-detector.h"
+#include "filter-stage.h"
+#include "electrode-table.h"
 
 #include <QtCore>
 
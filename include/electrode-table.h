@@ -0,0 +1,62 @@
+/*! \file electrode-table.h
+ *
+ * Compile-time table of the positions of all electrodes on a HiDens chip.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef ELECTRODE_TABLE_H_
+#define ELECTRODE_TABLE_H_
+
+#include "base-source.h"
+#include "configuration.h"
+
+#include <QtCore>
+
+namespace datasource {
+
+/*! The position of a single electrode on a HiDens chip.
+ *
+ * The table of these records is generated at build time from the file
+ * `resources/electrode-list.txt`, in which the line number of each
+ * electrode is its index.
+ */
+struct ElectrodeRecord {
+	/*! The x-position on the chip, in microns. */
+	quint32 xpos;
+
+	/*! The y-position on the chip, in microns. */
+	quint32 ypos;
+
+	/*! The x-index on the chip. */
+	qint16 x;
+
+	/*! The y-index on the chip. Some electrodes are in row -1. */
+	qint16 y;
+
+	/*! The character label used by the internal wiring of the chip. */
+	char label;
+};
+
+/*! Return the number of electrodes on a HiDens chip. */
+LIBDATA_SOURCE_VISIBILITY int electrodeCount();
+
+/*! Return the record for the electrode with the given index, or
+ * nullptr if there is no such electrode.
+ */
+LIBDATA_SOURCE_VISIBILITY const ElectrodeRecord* electrodeRecord(int index);
+
+/*! Return the index of the electrode at the given (x, y) indices on
+ * the chip, or -1 if there is no electrode there.
+ */
+LIBDATA_SOURCE_VISIBILITY int electrodeIndex(int x, int y);
+
+/*! Return the Electrode with the given index, or an empty (all zeros)
+ * electrode if there is no such electrode.
+ */
+LIBDATA_SOURCE_VISIBILITY Electrode electrodeAt(int index);
+
+}; // end datasource namespace
+
+#endif
+
@@ -0,0 +1,200 @@
+/*! \file file-prefetcher.h
+ *
+ * Class for reading upcoming chunks of a data file in a background thread.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef FILE_PREFETCHER_H_
+#define FILE_PREFETCHER_H_
+
+#include "base-source.h"
+#include "recording-file.h"
+
+#include <QtCore>
+
+#include <memory> // std::shared_ptr
+#include <vector>
+
+namespace datasource {
+
+/*! \class FilePrefetcher
+ *
+ * The FilePrefetcher class reads chunks of a data file in a background
+ * thread, ahead of the position at which they are played back. Up to
+ * depth() chunks are kept decoded and ready, in order. When the end of
+ * the loop range is reached, reading wraps around to its start, so that
+ * playback may loop without a pause. By default the loop range is the
+ * whole file.
+ *
+ * The consumer calls take() to retrieve the next chunk. This never blocks
+ * on the file: if the next chunk has not yet been read, nullptr is returned
+ * and the miss is counted. Chunks are allocated from a FramePool owned by
+ * the prefetcher, and are recycled once every consumer has released them.
+ *
+ * Only the channels selected with setChannels() are read.
+ *
+ * If reading the file fails, the prefetcher discards its ready chunks,
+ * stops reading, and emits readFailed().
+ *
+ * Changing the position with seek() discards all chunks read ahead of the
+ * old position, including any being read at the time. Because chunks are
+ * read in the background, seeking anywhere in a file is as fast as reading
+ * the first chunk at the new position.
+ */
+class LIBDATA_SOURCE_VISIBILITY FilePrefetcher : public QThread {
+	Q_OBJECT
+
+	public:
+
+		/*! Default number of chunks kept ready. */
+		static constexpr int DefaultDepth = 4;
+
+		/*! Maximum number of chunks kept ready. */
+		static constexpr int MaxDepth = 64;
+
+		/*! Construct a prefetcher reading from the given file, which
+		 * must outlive it.
+		 */
+		explicit FilePrefetcher(RecordingFile* file, QObject* parent = nullptr);
+
+		/*! Stop reading and destroy the prefetcher. */
+		~FilePrefetcher();
+
+		FilePrefetcher(const FilePrefetcher&) = delete;
+		FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+		/*! Set the number of samples in each chunk. This must be called
+		 * while the prefetcher is stopped.
+		 */
+		void setChunkSize(quint64 nsamples);
+
+		/*! Set the channels of the file read into each chunk, in the order
+		 * of the chunk's columns. An empty list selects every channel. This
+		 * must be called while the prefetcher is stopped.
+		 *
+		 * Each run of consecutive channels is read from the file with a single
+		 * request, so that only the selected channels are read and decoded.
+		 */
+		void setChannels(const std::vector<int>& channels);
+
+		/*! Set the number of chunks kept ready. */
+		void setDepth(int depth);
+
+		/*! Return the number of chunks kept ready. */
+		int depth() const;
+
+		/*! Return the total number of samples in the file. */
+		quint64 nsamples() const;
+
+		/*! Start reading chunks from the given sample. */
+		void startReading(quint64 position);
+
+		/*! Stop reading, discarding all ready chunks. */
+		void stopReading();
+
+		/*! Discard all ready chunks, and continue reading from the given sample. */
+		void seek(quint64 position);
+
+		/*! Set the range of samples [start, end) within which reading loops.
+		 * Chunks already read are kept, so callers which need the new range
+		 * to take effect immediately should also seek().
+		 */
+		void setLoopRange(quint64 start, quint64 end);
+
+		/*! Return the first sample of the loop range. */
+		quint64 loopStart() const;
+
+		/*! Return the sample one past the end of the loop range. */
+		quint64 loopEnd() const;
+
+		/*! Return the next chunk, or nullptr if it is not yet ready.
+		 * If \p start is given, it receives the sample of the file at
+		 * which the chunk begins.
+		 */
+		std::shared_ptr<Samples> take(quint64* start = nullptr);
+
+		/*! Return the number of calls to take() which returned a chunk. */
+		quint64 hits() const;
+
+		/*! Return the number of calls to take() which found no chunk ready. */
+		quint64 misses() const;
+
+	signals:
+
+		/*! Emitted from the prefetch thread when reading the file fails,
+		 * after which no more chunks are read until startReading().
+		 *
+		 * \param msg An error message explaining the failure.
+		 */
+		void readFailed(QString msg);
+
+	protected:
+
+		/* Read chunks until stopped. */
+		virtual void run() Q_DECL_OVERRIDE;
+
+	private:
+
+		/* The file from which data is read. */
+		RecordingFile* m_file;
+
+		/* Total number of samples in the file. */
+		quint64 m_nsamples;
+
+		/* Total number of channels in the file. */
+		int m_fileChannels;
+
+		/* Shape of each chunk. */
+		quint64 m_chunkSize;
+		int m_nchannels;
+
+		/* Runs of consecutive channels read into each chunk. */
+		RecordingFile::ChannelRuns m_runs;
+
+		/* Pool of chunks, from which only the prefetch thread acquires. */
+		FramePool m_pool;
+
+		/* Protects all members below. */
+		mutable QMutex m_lock;
+
+		/* Signalled when a chunk is taken, the position changes, or the
+		 * prefetcher is stopped.
+		 */
+		QWaitCondition m_wake;
+
+		/* A chunk which has been read, and the sample at which it begins. */
+		struct Chunk {
+			quint64 start;
+			std::shared_ptr<Samples> data;
+		};
+
+		/* Chunks read and ready to be taken, in order. */
+		QQueue<Chunk> m_ready;
+
+		/* Maximum number of ready chunks. */
+		int m_depth;
+
+		/* Sample at which the next chunk is read. */
+		quint64 m_position;
+
+		/* Range of samples [start, end) within which reading loops. */
+		quint64 m_loopStart;
+		quint64 m_loopEnd;
+
+		/* Incremented by each seek, so that a chunk read from an old
+		 * position is discarded rather than queued.
+		 */
+		quint64 m_generation;
+
+		/* True when the thread should exit. */
+		bool m_stop;
+
+		quint64 m_hits;
+		quint64 m_misses;
+};
+
+}; // end datasource namespace
+
+#endif
+
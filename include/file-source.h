@@ -9,12 +9,16 @@
 #define FILE_SOURCE_H_
 
 #include "base-source.h"
-
-#include "libdatafile/include/datafile.h"
+#include "chunk-cache.h"
+#include "chunk-range.h"
+#include "file-prefetcher.h"
+#include "recording-file.h"
+#include "sample-clock.h"
 
 #include <QtCore>
 
 #include <memory> // std::unique_ptr
+#include <vector>
 
 namespace datasource {
 
@@ -24,12 +28,58 @@ namespace datasource {
  * It presents almost identically to the original source from which the
  * data was recorded, making it useful for testing, debugging, and just
  * visualizating old data.
+ *
+ * Recordings may be HDF5 files, as written by the lab's recording software,
+ * or raw binary files described by a JSON sidecar. The format is detected
+ * from the file's header. See RecordingFile and RawRecordingFile.
+ *
+ * Data is read from the file by a FilePrefetcher in a background thread,
+ * which keeps the next "prefetch-depth" chunks ready. Each tick of the
+ * read timer only hands over a chunk which has already been read, so that
+ * slow reads of the file do not delay playback. The number of ticks at
+ * which a chunk was, or was not, ready are reported in the source's status
+ * as "prefetch-hits" and "prefetch-misses".
+ *
+ * By default, data is played back in real time. Playback is paced by a
+ * SampleClock, so that the number of samples emitted tracks the file's
+ * sample rate exactly over any length of time, to within one chunk. The
+ * "playback-rate" parameter scales the speed of playback, e.g., 0.5 plays
+ * back at half speed. Setting "unthrottled" to true instead emits chunks as
+ * fast as they can be read and consumed. In that mode, at most
+ * BaseSource::MaxBlocksInFlight blocks may be held by consumers at any
+ * time. Further chunks are emitted only as earlier ones are released.
+ *
+ * The "position" parameter gives the sample at which playback continues,
+ * and may be set at any time, as a sample index (an integer) or a time in
+ * seconds (a floating-point number). Setting it while streaming takes effect
+ * at the next chunk, without restarting the stream. Playback loops over the
+ * "loop-range", a pair [start, end) of samples or seconds, which is the
+ * whole file by default. Setting an empty range restores the default.
+ *
+ * The "channels" parameter selects the channels played back, as a list of
+ * channels or a string of channels and inclusive ranges, e.g., "0-3,7".
+ * Only the selected channels are read from the file, so the cost of reading
+ * scales with the number of channels selected. The selection may only be
+ * changed while the stream is stopped, and an empty selection restores all
+ * channels.
+ *
+ * Chunks of compressed recordings are decoded once, and shared with every
+ * other FileSource reading the same file, through the process-wide
+ * ChunkCache. Its "chunk-cache-hit-rate" and "chunk-cache-size", in bytes,
+ * are reported in the status. Its "chunk-cache-capacity", in bytes, may be
+ * set from any source, and applies to all of them.
+ *
+ * For offline analysis, chunks() reads any range of the file synchronously,
+ * independent of playback.
  */
 class LIBDATA_SOURCE_VISIBILITY FileSource : public BaseSource {
 	Q_OBJECT
 
 	public:
 
+		/*! Maximum playback rate, as a multiple of real time. */
+		static constexpr float MaxPlaybackRate = 1000.;
+
 		/*! Construct a FileSource.
 		 *
 		 * \param filename The name of the file from which to play data.
@@ -46,6 +96,25 @@ class LIBDATA_SOURCE_VISIBILITY FileSource : public BaseSource {
 		FileSource(FileSource&&) = delete;
 		FileSource& operator=(const FileSource&) = delete;
 
+		/*! Return a range over samples [start, stop) of the file, read in
+		 * chunks of \p chunkSize samples, without timers or signals.
+		 *
+		 * \param start The first sample read.
+		 * \param stop One past the last sample read, clipped to the file.
+		 * \param chunkSize The number of samples in each chunk.
+		 * \param channels The channels read, in the same forms accepted by
+		 * 	the "channels" parameter. By default, all channels are read.
+		 *
+		 * The range opens the file itself, and does not depend on the state
+		 * of the source or of its playback. This may be called from any
+		 * thread, and each thread may iterate over its own range in parallel,
+		 * though reads of uncompressed HDF5 files are serialized. See
+		 * ChunkRange. This throws an std::invalid_argument if the chunk size
+		 * is zero or the channels are invalid.
+		 */
+		ChunkRange chunks(quint64 start, quint64 stop, quint64 chunkSize,
+				const QVariant& channels = QVariant()) const;
+
 	public slots:
 
 		/*! Handle a request to set a named parameter.
@@ -53,12 +122,19 @@ class LIBDATA_SOURCE_VISIBILITY FileSource : public BaseSource {
 		 * \param param The name of the parameter to set.
 		 * \param data The value to set the parameter to.
 		 *
-		 * This override of the method always fails, as it doesn't make
-		 * sense to set the parameters of a device that doesn't currently
-		 * exist.
+		 * Most parameters describe the device from which the data was
+		 * recorded, and can't be set. Only those controlling playback
+		 * of the file are settable.
 		 */
 		virtual void set(QString param, QVariant data) Q_DECL_OVERRIDE;
 
+		/*! Handle a request to get a named parameter.
+		 *
+		 * This handles the playback parameters, and defers to
+		 * BaseSource::get() for all others.
+		 */
+		virtual void get(QString param) Q_DECL_OVERRIDE;
+
 		/*! Handle a request to initialize the data source. */
 		virtual void initialize() Q_DECL_OVERRIDE;
 
@@ -77,20 +153,79 @@ class LIBDATA_SOURCE_VISIBILITY FileSource : public BaseSource {
 		/* Read information about the data source from the file. */
 		void getSourceInfo();
 
+		/* Emit the next chunk of data, if it is ready, and return it. */
+		std::shared_ptr<Samples> emitNextChunk();
+
+		/* Convert a sample index (integer) or time in seconds (floating
+		 * point) to a sample index. Return false if the value is neither,
+		 * or is negative.
+		 */
+		bool toSample(const QVariant& value, quint64* sample) const;
+
+		/* Continue playback from the given sample. */
+		void seekTo(quint64 position);
+
+		/* Return the loop range as a list [start, end). */
+		QVariantList loopRange() const;
+
+		/* Parse a selection of channels of a file with the given number of
+		 * channels. Return false if the selection is invalid.
+		 */
+		static bool parseChannels(const QVariant& value, int nchannels,
+				std::vector<int>* channels);
+
+		/* Play back only the given channels, or all if the list is empty. */
+		void selectChannels(const std::vector<int>& channels);
+
+		/* Return the selected channels as a list. */
+		QVariantList channelList() const;
+
 		/* Pack the device's status and parameters into a map. */
 		virtual QVariantMap packStatus() Q_DECL_OVERRIDE;
 
+		/* Subclass override of the handleError() function, which stops
+		 * playback and reading ahead.
+		 */
+		virtual void handleError(const QString& msg) Q_DECL_OVERRIDE;
+
 		/* Name of the file from which the data is retrieved. */
 		QString m_filename;
 
-		/* Pointer to the actual DataFile object. */
-		std::unique_ptr<datafile::DataFile> m_datafile;
+		/* The file being played back, read by the backend for its format. */
+		std::unique_ptr<RecordingFile> m_datafile;
 
-		/* Timer used to read new data from the file. */
+		/* Single-shot timer used to emit new data, re-armed for the time
+		 * at which the next chunk is due.
+		 */
 		QTimer *m_readTimer;
 
-		/* Pointer to the current position in the file. */
+		/* Total number of channels in the file. */
+		int m_fileChannels;
+
+		/* Channels played back, or empty for all channels. */
+		std::vector<int> m_channels;
+
+		/* Configuration of all channels in the file, of which the
+		 * source's configuration is the selected subset.
+		 */
+		QConfiguration m_fileConfiguration;
+
+		/* Sample of the file at which the next chunk begins. */
 		quint64 m_currentSample;
+
+		/* Reads chunks of the file ahead of playback. */
+		std::unique_ptr<FilePrefetcher> m_prefetcher;
+
+		/* Speed of playback, as a multiple of real time. */
+		float m_playbackRate;
+
+		/* Clock pacing playback at the file's sample rate, scaled by
+		 * the playback rate.
+		 */
+		SampleClock m_clock;
+
+		/* If true, emit chunks as fast as consumers release them. */
+		bool m_unthrottled;
 };
 
 }; // end datasource namespace
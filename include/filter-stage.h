@@ -0,0 +1,206 @@
+/*! \file filter-stage.h
+ *
+ * Classes applying an IIR filter to the data emitted by a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef FILTER_STAGE_H_
+#define FILTER_STAGE_H_
+
+#include "source-stage.h"
+#include "frame-pool.h"
+#include "kernel-isa.h"
+
+#include <QtCore>
+
+#include <vector>
+
+namespace datasource {
+
+/*! \struct Biquad
+ *
+ * The coefficients of a second-order IIR section, normalized so that the
+ * leading denominator coefficient is 1:
+ *
+ * 	y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+ */
+struct Biquad {
+	float b0, b1, b2;
+	float a1, a2;
+};
+
+/*! \class BiquadFilter
+ *
+ * The BiquadFilter class applies a cascade of biquad sections to every
+ * channel of a sequence of blocks, in place. The state of each section of
+ * each channel is carried from one block to the next, so that filtering a
+ * stream block by block gives the same result as filtering it at once, and
+ * block boundaries introduce no discontinuities.
+ *
+ * Samples are filtered in single precision, in the transposed direct form
+ * II, and the result is rounded and saturated to a qint16. The recursion
+ * runs across channels in parallel: groups of 16 channels are loaded side by
+ * side into a small tile, a few dozen samples at a time, and each sample of
+ * the group is filtered with one or a few vector operations per term.
+ * Every instruction set performs the same operations in the same order,
+ * without fused multiply-adds, so all give exactly the same result.
+ */
+class LIBDATA_SOURCE_VISIBILITY BiquadFilter {
+
+	public:
+
+		/*! Construct a filter from the given sections, applied in order. */
+		explicit BiquadFilter(const std::vector<Biquad>& sections = {});
+
+		/*! Return a Butterworth high-pass filter of order 2 * nsections. */
+		static BiquadFilter highpass(double cutoff, double sampleRate, int nsections = 2);
+
+		/*! Return a Butterworth low-pass filter of order 2 * nsections. */
+		static BiquadFilter lowpass(double cutoff, double sampleRate, int nsections = 2);
+
+		/*! Return a band-pass filter, cascading a Butterworth high-pass and
+		 * low-pass filter, each of order 2 * nsections. The low-pass filter
+		 * is omitted if its cutoff is not below the Nyquist frequency.
+		 */
+		static BiquadFilter bandpass(double low, double high, double sampleRate,
+				int nsections = 2);
+
+		/*! Return the sections of the filter. */
+		const std::vector<Biquad>& sections() const;
+
+		/*! Filter the samples of every channel in place, continuing from
+		 * the end of the last block filtered. A block with a different
+		 * number of channels resets the filter first.
+		 */
+		void apply(Samples& samples, KernelIsa isa = KernelIsa::Best);
+
+		/*! Reset the state of the filter, as if no samples had been seen. */
+		void reset();
+
+	private:
+
+		/* Sections of the filter. */
+		std::vector<Biquad> m_sections;
+
+		/* Number of channels whose state is kept. */
+		arma::uword m_nchannels;
+
+		/* State of each section of each channel, in groups of channels
+		 * laid out as [group][section][delay][channel of the group].
+		 */
+		std::vector<float> m_state;
+
+		/* Tile of samples of a group of channels, laid out as
+		 * [sample][channel of the group].
+		 */
+		std::vector<float> m_tile;
+};
+
+/*! \class FilterStage
+ *
+ * The FilterStage class band-pass filters the data emitted by a source,
+ * so that consumers need not each filter the raw data themselves. Each block
+ * is copied into a frame from the stage's pool, filtered in place with a
+ * BiquadFilter in the source's thread, and emitted in dataAvailable(). The
+ * blocks emitted by the source itself are left untouched, and can still be
+ * recorded as they were acquired.
+ *
+ * The filter is a fourth-order Butterworth high-pass filter followed by a
+ * fourth-order Butterworth low-pass filter, designed for the sample rate
+ * reported by the source when the first block arrives. The low-pass filter
+ * is omitted if the upper cutoff is not below the Nyquist frequency, and
+ * blocks are zeroed if the lower cutoff is not.
+ *
+ * By default every channel is filtered. Channels which don't carry neural
+ * data, such as the photodiode emitted as the last channel of a HiDens
+ * source, should be excluded with setChannels(), so that they are passed
+ * through unchanged.
+ */
+class LIBDATA_SOURCE_VISIBILITY FilterStage : public SourceStage {
+	Q_OBJECT
+
+	public:
+
+		/*! Default lower cutoff frequency, in Hz. */
+		static constexpr double DefaultLowCutoff = 300.;
+
+		/*! Default upper cutoff frequency, in Hz. */
+		static constexpr double DefaultHighCutoff = 5000.;
+
+		/*! Construct a stage passing the given band of frequencies, in Hz.
+		 * This throws an std::invalid_argument if the band is empty or
+		 * the lower cutoff is not positive.
+		 */
+		explicit FilterStage(double low = DefaultLowCutoff,
+				double high = DefaultHighCutoff, QObject* parent = nullptr);
+
+		/*! Detach from any source. */
+		~FilterStage();
+
+		FilterStage(const FilterStage&) = delete;
+		FilterStage& operator=(const FilterStage&) = delete;
+
+		/*! Return the lower cutoff frequency. */
+		double lowCutoff() const;
+
+		/*! Return the upper cutoff frequency. */
+		double highCutoff() const;
+
+		/*! Set the instruction set used by the filter. This must be called
+		 * before attach().
+		 */
+		void setKernelIsa(KernelIsa isa);
+
+		/*! Set the channels which are filtered, copying all others through
+		 * unchanged. An empty list, the default, filters every channel.
+		 * Channels beyond those of the source are ignored. This must be
+		 * called before attach(), and throws an std::invalid_argument if
+		 * a channel is negative or repeated.
+		 */
+		void setChannels(const std::vector<int>& channels);
+
+		/*! Return the channels which are filtered, or an empty list if
+		 * every channel is.
+		 */
+		std::vector<int> channels() const;
+
+	signals:
+
+		/*! Emitted with each block of the source, once filtered. */
+		void dataAvailable(SampleBlock block);
+
+	private:
+
+		/* Reset the state of the filter. */
+		void reset() Q_DECL_OVERRIDE;
+
+		/* Filter a block, from the source's thread. */
+		void process(const SampleBlock& block) Q_DECL_OVERRIDE;
+
+		/* Cutoff frequencies, and instruction set used. */
+		double m_low;
+		double m_high;
+		KernelIsa m_isa;
+
+		/* Channels filtered, or empty for all channels. */
+		std::vector<int> m_channels;
+
+		/* The filter, designed when the first block arrives, and the pool
+		 * of frames into which blocks are filtered. Used only by the
+		 * source's thread.
+		 */
+		BiquadFilter m_filter;
+		bool m_designed;
+		FramePool m_pool;
+
+		/* The selected channels of a block, gathered to be filtered
+		 * when not every channel is. Used only by the source's thread.
+		 */
+		Samples m_selected;
+};
+
+}; // end datasource namespace
+
+#endif
+
@@ -0,0 +1,157 @@
+/*! \file frame-pool.h
+ *
+ * Description of a pool of preallocated frames, which allows sources
+ * to stream data without allocating memory for each new frame.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef FRAME_POOL_H_
+#define FRAME_POOL_H_
+
+#include "sample-block.h"
+
+#include <QtCore>
+
+#include <atomic>
+#include <memory> // std::shared_ptr
+#include <vector>
+
+namespace datasource {
+
+/*! \class FramePool
+ *
+ * The FramePool class manages a set of fixed-size slabs, each holding
+ * one frame of data. A source acquires a slab, fills it, and publishes it
+ * wrapped in a SampleBlock. The slab is recycled automatically once the
+ * source and every consumer have released their references to it, so that
+ * in the steady state the pool allocates no memory.
+ *
+ * If every slab is in use, e.g., because a consumer holds on to blocks,
+ * a new slab is allocated and added to the pool. A slab is also reallocated
+ * when a frame of a different size is acquired in it, e.g., for the short
+ * final chunk of a file. Allocations are counted, and may be retrieved with
+ * allocations().
+ *
+ * Frames must only be acquired from a single thread, normally the thread
+ * in which the owning source lives. They may be released from any thread.
+ */
+class FramePool {
+
+	public:
+
+		/*! Default number of slabs reserved by the pool. */
+		static constexpr int DefaultCapacity = 16;
+
+		/*! Number of references the pool itself holds to each of its slabs. */
+		static constexpr long PoolReferences = 1;
+
+		/*! Construct an empty pool, which will reserve the given
+		 * number of slabs when reserve() is called.
+		 */
+		explicit FramePool(int capacity = DefaultCapacity) :
+			m_capacity(capacity),
+			m_next(0),
+			m_allocations(0)
+		{ }
+
+		FramePool(const FramePool&) = delete;
+		FramePool& operator=(const FramePool&) = delete;
+
+		/*! Allocate the pool's slabs to hold frames of the given shape. */
+		void reserve(arma::uword nsamples, arma::uword nchannels)
+		{
+			while (m_slabs.size() < static_cast<size_t>(m_capacity)) {
+				m_slabs.push_back(std::make_shared<Samples>(nsamples, nchannels));
+				m_allocations++;
+			}
+			for (auto& slab : m_slabs) {
+				if (!isHeldOutside(slab)) {
+					resize(*slab, nsamples, nchannels);
+				}
+			}
+		}
+
+		/*! Acquire a free slab of the given shape.
+		 *
+		 * The contents of the returned frame are undefined. The frame
+		 * returns to the pool when the last reference to it is dropped.
+		 */
+		std::shared_ptr<Samples> acquire(arma::uword nsamples, arma::uword nchannels)
+		{
+			for (size_t i = 0; i < m_slabs.size(); i++) {
+				auto& slab = m_slabs[(m_next + i) % m_slabs.size()];
+				if (!isHeldOutside(slab)) {
+
+					/* Make sure the previous owners' reads of the slab
+					 * happen before we start writing into it.
+					 */
+					std::atomic_thread_fence(std::memory_order_acquire);
+					m_next = (m_next + i + 1) % m_slabs.size();
+					resize(*slab, nsamples, nchannels);
+					return slab;
+				}
+			}
+			m_slabs.push_back(std::make_shared<Samples>(nsamples, nchannels));
+			m_allocations++;
+			return m_slabs.back();
+		}
+
+		/*! Return the number of slabs owned by the pool. */
+		int size() const { return static_cast<int>(m_slabs.size()); }
+
+		/*! Return the number of slabs currently referenced outside the pool. */
+		int inUse() const
+		{
+			int n = 0;
+			for (auto& slab : m_slabs) {
+				n += isHeldOutside(slab);
+			}
+			return n;
+		}
+
+		/*! Return the total number of allocations made by the pool. */
+		quint64 allocations() const { return m_allocations; }
+
+		/*! Return true if a frame acquired from a pool is referenced by
+		 * anything other than the pool and the given number of references
+		 * held by the caller, e.g., by a consumer of a block wrapping it.
+		 */
+		static bool isHeldOutside(const std::shared_ptr<Samples>& frame,
+				long callerReferences = 0)
+		{
+			return frame.use_count() > PoolReferences + callerReferences;
+		}
+
+	private:
+
+		/* Change the shape of a slab, counting any reallocation. */
+		void resize(Samples& slab, arma::uword nsamples, arma::uword nchannels)
+		{
+			if ((slab.n_rows != nsamples) || (slab.n_cols != nchannels)) {
+				if (slab.n_elem != nsamples * nchannels) {
+					m_allocations++;
+				}
+				slab.set_size(nsamples, nchannels);
+			}
+		}
+
+		/* Number of slabs reserved by reserve(). */
+		int m_capacity;
+
+		/* Index at which to start looking for the next free slab. */
+		size_t m_next;
+
+		/* Total number of slabs allocated or reallocated. */
+		quint64 m_allocations;
+
+		/* The slabs themselves. A slab is free when the pool holds
+		 * the only reference to it.
+		 */
+		std::vector<std::shared_ptr<Samples>> m_slabs;
+};
+
+}; // end datasource namespace
+
+#endif
+
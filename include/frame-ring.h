@@ -0,0 +1,183 @@
+/*! \file frame-ring.h
+ *
+ * Description of a lock-free, single-producer/single-consumer ring of
+ * preallocated frames, used to pull data from a source without going
+ * through Qt's event loop.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef FRAME_RING_H_
+#define FRAME_RING_H_
+
+#include "sample-block.h"
+
+#include <QtCore>
+
+#include <algorithm> // std::max
+#include <atomic>
+#include <cstring> // std::memcpy
+#include <vector>
+
+namespace datasource {
+
+/*! \class FrameRing
+ *
+ * The FrameRing class is a bounded, lock-free queue of frames, with
+ * exactly one producer and one consumer. The producer is a data source,
+ * which copies each new frame into the next free slot. The consumer, which
+ * may live in any thread, polls the ring with front() and pop(), or blocks
+ * in wait() until a frame is available.
+ *
+ * All slots are allocated up front, so that pushing a frame of the same
+ * shape as the previous one performs no allocation. If the consumer falls
+ * behind and the ring is full, new frames are dropped and counted in
+ * overruns(), rather than blocking the source.
+ *
+ * Rings are created with BaseSource::attachRing(), and detached by
+ * simply destroying the last reference to them.
+ */
+class FrameRing {
+
+	public:
+
+		/*! Construct a ring able to hold the given number of frames. */
+		explicit FrameRing(int capacity) :
+			m_slots(std::max(capacity, 1)),
+			m_head(0),
+			m_tail(0),
+			m_overruns(0)
+		{ }
+
+		FrameRing(const FrameRing&) = delete;
+		FrameRing& operator=(const FrameRing&) = delete;
+
+		/*! Return the maximum number of frames the ring can hold. */
+		int capacity() const { return static_cast<int>(m_slots.size()); }
+
+		/*! Return the number of frames currently queued. */
+		int size() const
+		{
+			return static_cast<int>(m_head.load(std::memory_order_acquire) -
+					m_tail.load(std::memory_order_acquire));
+		}
+
+		/*! Return the number of frames dropped because the ring was full. */
+		quint64 overruns() const
+		{
+			return m_overruns.load(std::memory_order_relaxed);
+		}
+
+		/*! Preallocate every slot to hold frames of the given shape.
+		 * Called only by the producer, before it pushes any frame.
+		 */
+		void reserve(arma::uword nsamples, arma::uword nchannels)
+		{
+			for (auto& slot : m_slots) {
+				slot.set_size(nsamples, nchannels);
+			}
+		}
+
+		/*! Copy a frame into the ring. Called only by the producer.
+		 *
+		 * Returns false, and drops the frame, if the ring is full.
+		 */
+		bool push(const Samples& frame)
+		{
+			auto head = m_head.load(std::memory_order_relaxed);
+			auto tail = m_tail.load(std::memory_order_acquire);
+			if (head - tail >= m_slots.size()) {
+				m_overruns.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			auto& slot = m_slots[head % m_slots.size()];
+			slot.set_size(frame.n_rows, frame.n_cols);
+			if (frame.n_elem) {
+				std::memcpy(slot.memptr(), frame.memptr(), frame.n_elem * sizeof(qint16));
+			}
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/*! Return the oldest queued frame, or nullptr if the ring is empty.
+		 * Called only by the consumer. The frame remains valid until the
+		 * next call to pop().
+		 */
+		const Samples* front() const
+		{
+			auto tail = m_tail.load(std::memory_order_relaxed);
+			if (tail == m_head.load(std::memory_order_acquire)) {
+				return nullptr;
+			}
+			return &m_slots[tail % m_slots.size()];
+		}
+
+		/*! Release the oldest queued frame back to the producer.
+		 * Called only by the consumer, after front() returned a frame.
+		 */
+		void pop()
+		{
+			auto tail = m_tail.load(std::memory_order_relaxed);
+			if (tail != m_head.load(std::memory_order_acquire)) {
+				m_tail.store(tail + 1, std::memory_order_release);
+			}
+		}
+
+		/*! Wait up to the given number of milliseconds for a frame to
+		 * become available. Called only by the consumer.
+		 *
+		 * This first spins briefly, and then sleeps in short increments,
+		 * so that the producer never needs to take a lock or signal the
+		 * consumer. Returns true if a frame is available.
+		 */
+		bool wait(int msecs)
+		{
+			QElapsedTimer timer;
+			timer.start();
+			int spins = 0;
+			while (!front()) {
+				if (timer.elapsed() >= msecs) {
+					return false;
+				}
+				if (spins++ < SpinCount) {
+					QThread::yieldCurrentThread();
+				} else {
+					QThread::usleep(SleepInterval);
+				}
+			}
+			return true;
+		}
+
+	private:
+
+		/* Number of times wait() yields before it begins sleeping. */
+		static constexpr int SpinCount = 64;
+
+		/* Time in microseconds wait() sleeps between checks. */
+		static constexpr unsigned long SleepInterval = 50;
+
+		/* Size of a cache line, in bytes. */
+		static constexpr int CacheLineSize = 64;
+
+		/* Preallocated frames. */
+		std::vector<Samples> m_slots;
+
+		/* Total number of frames pushed. Written only by the producer. */
+		std::atomic<quint64> m_head;
+
+		/* Padding keeping the producer's and consumer's counters on
+		 * separate cache lines.
+		 */
+		char m_pad[CacheLineSize];
+
+		/* Total number of frames popped. Written only by the consumer. */
+		std::atomic<quint64> m_tail;
+
+		/* Number of frames dropped because the ring was full. */
+		std::atomic<quint64> m_overruns;
+};
+
+}; // end datasource namespace
+
+#endif
+
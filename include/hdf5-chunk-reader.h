@@ -0,0 +1,131 @@
+/*! \file hdf5-chunk-reader.h
+ *
+ * Class for reading compressed HDF5 recordings, decompressing chunks
+ * of the file in parallel.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef HDF5_CHUNK_READER_H_
+#define HDF5_CHUNK_READER_H_
+
+#include "base-source.h"
+
+#include <QtCore>
+#include <QtConcurrent>
+
+#include <hdf5.h>
+
+#include <vector>
+
+namespace datasource {
+
+/*! \class Hdf5ChunkReader
+ *
+ * The Hdf5ChunkReader class reads the "data" dataset of a recording stored
+ * in HDF5, bypassing the library's single-threaded filter pipeline. Each
+ * chunk of the dataset is read in its stored, compressed form with
+ * H5Dread_chunk(), and then inflated and unshuffled on the global thread
+ * pool, so that many chunks are decompressed at once.
+ *
+ * Chunks are decompressed ahead of the samples requested: every read also
+ * starts decompressing the next readAhead() columns of chunks along the
+ * sample axis, so that sequential reads rarely wait for decompression.
+ * Decompressed chunks are shared with every other reader of the same file
+ * in the process through the ChunkCache::instance(), so that each chunk is
+ * decompressed once however many sources read it. Each reader also holds
+ * the chunks it is using, or reading ahead, in a small LRU list of its own.
+ *
+ * Only datasets of 16-bit integers, shaped (channels, samples), stored in
+ * chunks compressed with deflate, and filtered by nothing other than shuffle
+ * and deflate, are supported. For any other, including chunked datasets which
+ * are not compressed, isValid() returns false, and the file should be read
+ * with libdatafile instead.
+ *
+ * read() may be called from one thread at a time. All calls into the HDF5
+ * library hold the hdf5Mutex().
+ */
+class LIBDATA_SOURCE_VISIBILITY Hdf5ChunkReader {
+
+	public:
+
+		/*! Open the dataset of the given file. */
+		explicit Hdf5ChunkReader(const QString& filename);
+
+		/*! Wait for all decompression to finish, and close the file. */
+		~Hdf5ChunkReader();
+
+		Hdf5ChunkReader(const Hdf5ChunkReader&) = delete;
+		Hdf5ChunkReader& operator=(const Hdf5ChunkReader&) = delete;
+
+		/*! Return true if the dataset can be read by this reader. */
+		bool isValid() const;
+
+		/*! Return the number of columns of chunks decompressed ahead of
+		 * those requested.
+		 */
+		int readAhead() const;
+
+		/*! Set the number of columns of chunks decompressed ahead of those
+		 * requested. The default is the number of cores.
+		 */
+		void setReadAhead(int columns);
+
+		/*! Read samples [start, end) of channels [firstChannel, lastChannel)
+		 * into the given matrix. Return false if any chunk could not be read
+		 * or decompressed.
+		 */
+		bool read(int firstChannel, int lastChannel,
+				quint64 start, quint64 end, Samples& out);
+
+	private:
+
+		/* Return the decompressed chunk at the given column (along samples)
+		 * and row (along channels) of chunks, starting to decompress it if
+		 * it is not already.
+		 */
+		QFuture<QByteArray> chunk(quint64 column, quint64 row);
+
+		/* Read and decompress a chunk, returning an empty array on failure. */
+		QByteArray decode(quint64 column, quint64 row) const;
+
+		/* Forget the least-recently used chunks, beyond the capacity. */
+		void evict();
+
+		/* Canonical path, size and modification time of the file when it
+		 * was opened, identifying its chunks in the cache.
+		 */
+		QString m_path;
+		qint64 m_size;
+		qint64 m_modified;
+
+		/* Handles to the file and dataset, negative if not open. */
+		hid_t m_file;
+		hid_t m_dataset;
+
+		/* Shape of the dataset, and of each chunk. */
+		quint64 m_nchannels;
+		quint64 m_nsamples;
+		quint64 m_chunkChannels;
+		quint64 m_chunkSamples;
+
+		/* Number of rows of chunks, along channels. */
+		quint64 m_rows;
+
+		/* Filters applied to each chunk when written, in order. */
+		std::vector<H5Z_filter_t> m_filters;
+
+		/* Columns of chunks decompressed ahead of those requested. */
+		int m_readAhead;
+
+		/* Chunks decompressed or being decompressed, keyed by their linear
+		 * index, and the order in which they were last used.
+		 */
+		QHash<quint64, QFuture<QByteArray>> m_chunks;
+		QList<quint64> m_lru;
+};
+
+}; // end datasource namespace
+
+#endif
+
@@ -0,0 +1,79 @@
+/*! \file hidens-convert.h
+ *
+ * Kernels for converting raw frames received from the HiDens system
+ * into the sample layout emitted by the HidensSource.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef HIDENS_CONVERT_H_
+#define HIDENS_CONVERT_H_
+
+#include "base-source.h"
+#include "kernel-isa.h"
+
+#include <QtCore>
+
+namespace datasource {
+
+/*! Number of bytes in a single frame received from the HiDens system. */
+constexpr int HidensFrameBytes = 131;
+
+/*! Number of data channels in each HiDens frame, channels 0-125. */
+constexpr int HidensDataChannels = 126;
+
+/*! Byte of each HiDens frame containing the digital inputs. */
+constexpr int HidensPhotodiodeByte = HidensFrameBytes - 1;
+
+/*! Bit of the digital input byte carrying the photodiode signal. */
+constexpr uchar HidensPhotodiodeMask = 0x08;
+
+/*! Number of channels in each converted frame: all data channels,
+ * followed by the photodiode.
+ */
+constexpr int HidensEmittedChannels = HidensDataChannels + 1;
+
+/*! Convert raw HiDens frames into emitted samples in a single pass.
+ *
+ * \param in Raw data received from the server, consisting of `nframes`
+ * 	consecutive frames of HidensFrameBytes bytes each.
+ * \param nframes The number of frames to convert.
+ * \param out Column-major output, shaped as (nframes, HidensEmittedChannels).
+ * \param isa The instruction set to use. By default, the best one supported
+ * 	by the running CPU is chosen at runtime.
+ *
+ * The kernel transposes the frames into channel-major order, widens each
+ * value from uint8 to int16 and inverts it. The photodiode bit of the
+ * digital input byte is extracted into the last column, as -255 if the bit
+ * is set and 0 otherwise. The data is processed in cache-sized blocks of
+ * frames, so that the input is read exactly once.
+ *
+ * Requesting an instruction set which is not supported falls back to
+ * the scalar implementation.
+ */
+LIBDATA_SOURCE_VISIBILITY void convertHidensFrames(const uchar* in,
+		arma::uword nframes, qint16* out, KernelIsa isa = KernelIsa::Best);
+
+/*! Convert raw HiDens frames, gathering a subset of the data channels.
+ *
+ * \param in Raw data received from the server, as above.
+ * \param nframes The number of frames to convert.
+ * \param columns For each of the HidensDataChannels data channels, the
+ * 	column of the output into which it is converted, or -1 if the channel
+ * 	is to be dropped.
+ * \param ncolumns The number of columns in the output. The photodiode
+ * 	is always converted into the last column.
+ * \param out Column-major output, shaped as (nframes, ncolumns).
+ * \param isa The instruction set to use.
+ *
+ * Only the mapped channels are written, so the cost of storing the output
+ * is proportional to the number of columns.
+ */
+LIBDATA_SOURCE_VISIBILITY void convertHidensFrames(const uchar* in,
+		arma::uword nframes, const int* columns, int ncolumns, 
+		qint16* out, KernelIsa isa = KernelIsa::Best);
+
+}; // end datasource namespace
+
+#endif
+
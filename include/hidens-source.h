@@ -14,6 +14,9 @@
 #include <QtNetwork>
 #include <QtConcurrent>
 
+#include <functional> // std::function
+#include <vector>
+
 namespace datasource {
 
 /*! \class HidensSource
@@ -23,13 +26,23 @@ namespace datasource {
  * class, this subclass allows getting and setting the Hidens electrode
  * configuration in several ways.
  *
- * Note that the current implementation is *blocking*. Despite the fact
- * that the server program with which this class communicates is over the
- * network, writing a non-blocking implementation of this isn't trivial
- * because of a lot of variability in the replies from that server. So 
- * this class imposes a blocking request/reply pattern on the communication
- * protocol. So this BaseSource subclass *really should* be in a background
- * thread.
+ * By default, every frame contains all 126 data channels followed by the
+ * photodiode. Setting the "emit-mode" parameter to "connected" emits only
+ * those channels routed to an electrode, followed by the photodiode, and the
+ * "configuration" parameter then lists exactly the emitted channels.
+ *
+ * Communication with the server is non-blocking. Each command is placed
+ * in a queue, along with a function that decides when its reply is complete
+ * and a callback run with that reply. Queued commands are written to the
+ * server without waiting for earlier replies, which the server answers in
+ * order, and the replies are matched to their commands as they arrive,
+ * driven by the socket's readyRead signal. In particular, the whole
+ * initialization handshake is sent in a single write, so that it costs
+ * roughly one round trip.
+ *
+ * A command whose reply does not arrive within RequestWaitTime is failed,
+ * which is treated as an error of the source. Because nothing waits on the
+ * socket, several HiDens sources may share a single thread.
  */
 class LIBDATA_SOURCE_VISIBILITY HidensSource : public BaseSource {
 	Q_OBJECT
@@ -57,10 +70,30 @@ class LIBDATA_SOURCE_VISIBILITY HidensSource : public BaseSource {
 	/*! The sample rate of the device. */
 	static constexpr float SampleRate { 20000. };
 
+	/*! Default number of data requests kept in flight while streaming. */
+	static constexpr int DefaultPipelineDepth { 1 };
+
+	/*! Maximum number of data requests kept in flight while streaming. */
+	static constexpr int MaxPipelineDepth { 16 };
+
+	/* Function returning true when a reply to a command is complete. */
+	using ReplyParser = std::function<bool(const QList<QByteArray>&)>;
+
+	/* Function called with a command's result and the lines of its reply. */
+	using ReplyCallback = std::function<void(bool, const QList<QByteArray>&)>;
+
+	/* A command queued to be sent to the HiDens data server. */
+	struct Command {
+		QByteArray request;
+		ReplyParser complete;
+		ReplyCallback callback;
+	};
+
 	public:
 		/*! Construct a HiDens data source.
 		 * \param addr The IP address or hostname at which the HiDens ThreadedServer
-		 * application is running.
+		 * application is running. This may be followed by a port number, as
+		 * "host:port", to connect to a server not listening on the default port.
 		 * \param readInterval The interval at which data is retrieved from the source.
 		 * \param parent Parent for this object.
 		 */
@@ -82,6 +115,14 @@ class LIBDATA_SOURCE_VISIBILITY HidensSource : public BaseSource {
 		 */
 		virtual void set(QString param, QVariant value) Q_DECL_OVERRIDE;
 
+		/*! Method implementing requests to get a named parameter for
+		 * the Hidens data source.
+		 *
+		 * This handles the HiDens-specific parameters, and defers to
+		 * BaseSource::get() for all others.
+		 */
+		virtual void get(QString param) Q_DECL_OVERRIDE;
+
 		/*! Method implementing requests to initialize the Hidens data source.
 		 *
 		 * See BaseSource::initialize() for details.
@@ -107,25 +148,83 @@ class LIBDATA_SOURCE_VISIBILITY HidensSource : public BaseSource {
 		/* Handle an unexpected disconnection from HiDens data server. */
 		void handleDisconnect();
 
-		/* Send a full request to the HiDens data server. */
+		/* Send a full request to the HiDens data server, as is. */
 		void askHidens(const QByteArray& request);
 
-		/* Receive a full reply from the HiDens data server. 
-		 * Warning: This function will block for a short period of time.
+		/* Queue a command to be sent to the HiDens data server.
+		 *
+		 * The callback is run with the reply once `complete` accepts it,
+		 * or with `false` and an empty reply if the command times out.
+		 */
+		void sendCommand(const QByteArray& request, 
+				ReplyParser complete, ReplyCallback callback);
+
+		/* Queue a command whose reply consists of a single line. */
+		void sendCommand(const QByteArray& request, ReplyCallback callback);
+
+		/* Return a parser accepting replies of the given number of lines,
+		 * or a shorter reply starting with an error.
+		 */
+		static ReplyParser expectLines(int nlines);
+
+		/* Write all queued commands which have not yet been sent to the
+		 * server, in a single request.
+		 *
+		 * A command written while no other command is outstanding is sent
+		 * bare, as the server has always received it. Commands written
+		 * together, or while terminated commands are outstanding, are
+		 * pipelined, and each is terminated with a newline so that the
+		 * server can separate them. Nothing is written while a bare
+		 * command is outstanding, since the server could not tell where
+		 * it ends.
 		 */
-		QByteArray getHidensReply();
+		void sendCommands();
+
+		/* Consume lines of reply to the current command as they arrive. */
+		void handleCommandReply();
+
+		/* Discard stale stream data received after stopping the stream,
+		 * and resume sending commands once all of it has arrived.
+		 */
+		void flushStream();
+
+		/* Handle a command whose reply did not arrive in time. */
+		void handleCommandTimeout();
+
+		/* Drop all queued commands and any partial reply. */
+		void clearCommands();
+
+		/* Abandon initialization, disconnecting from the server. */
+		void failInitialization(const QString& msg);
 
 		/* Request a frame of data from the server */
 		void requestData(const QByteArray& method = "stream");
 
+		/* Issue "stream" requests until m_pipelineDepth are in flight. */
+		void fillPipeline();
+
 		/* Receive a frame of data from the HiDens server */
 		void recvDataFrame();
 
 		/* Verify that a reply is non-null or not an error. */
 		bool verifyReply(const QByteArray& reply);
 
-		/* Get the actual configuration from the HiDens server */
-		void getConfigurationFromServer();
+		/* Get the actual configuration from the HiDens server.
+		 * If given, `done` is called once the configuration is parsed,
+		 * with true on success.
+		 */
+		void getConfigurationFromServer(std::function<void(bool)> done = nullptr);
+
+		/* Parse the reply to a "ch" command into the configuration. */
+		void parseConfiguration(const QList<QByteArray>& reply);
+
+		/* Map the data channels to the columns of emitted frames, for the
+		 * current emit mode and electrode indices.
+		 */
+		void updateChannelMap();
+
+		/* Build the configuration reported for the emitted channels. */
+		void buildConfiguration();
 
 		/* Function run in the background to send a configuration to 
 		 * the FPGA. Sending a configuration seems to require actually
@@ -157,6 +256,13 @@ class LIBDATA_SOURCE_VISIBILITY HidensSource : public BaseSource {
 		 */
 		void handleConfigSendResponse();
 
+		/* Split a location of the form "host[:port]" into its parts,
+		 * using the given port if none is specified. Returns false if
+		 * the location is invalid.
+		 */
+		static bool parseLocation(const QString& location, 
+				quint16 defaultPort, QString& addr, quint16& port);
+
 		/* Subclass override of the handleError() function. */
 		virtual void handleError(const QString& msg) Q_DECL_OVERRIDE;
 
@@ -169,6 +275,14 @@ class LIBDATA_SOURCE_VISIBILITY HidensSource : public BaseSource {
 		/* Port number for the HiDens data server. */
 		quint16 m_port;
 
+		/* IP address or hostname of the FPGA, to which configurations
+		 * are sent.
+		 */
+		QString m_fpgaAddr;
+
+		/* Port number to which configurations are sent. */
+		quint16 m_fpgaPort;
+
 		/* Number of total data channels in the HiDens system.
 		 * This is the actual number of possible valid channels containing data.
 		 */
@@ -194,22 +308,71 @@ class LIBDATA_SOURCE_VISIBILITY HidensSource : public BaseSource {
 		/* Buffer into which raw data from the HiDens device is placed. */
 		arma::Mat<uchar> m_acqBuffer;
 
-		/* Buffer into which the valid data from each frame is placed.
-		 *
-		 * "Valid" data means that from the first 126 channels (0-125) and
-		 * the transformed photodiode value. This last is placed into channel
-		 * 127 of this array, and is derived from one bit in channel 131 of
-		 * the m_acqBuffer array.
-		 */
-		datasource::Samples m_emitBuffer;
-
 		/* Indices of connected electrodes (-1 if not connected). */
 		arma::Col<int> m_electrodeIndices;
 
+		/* Channels emitted in each frame. In "full" mode, all data channels
+		 * are emitted. In "connected" mode, only those channels routed to an
+		 * electrode are emitted. The photodiode is always emitted last.
+		 */
+		QString m_emitMode;
+
+		/* Column of each emitted frame into which each data channel is
+		 * converted, or -1 if the channel is not emitted.
+		 */
+		std::vector<int> m_channelColumns;
+
 		/* Gain of the ADC converters on board the chip. This is the output
 		 * of the "gain 0" command.
 		 */
 		float m_deviceGain;
+
+		/* Number of data requests kept in flight while streaming.
+		 *
+		 * With a depth of 1, each chunk pays a full round trip to the
+		 * server before the next is requested. Larger depths hide that
+		 * latency, allowing shorter read intervals without gaps.
+		 */
+		int m_pipelineDepth;
+
+		/* Number of data requests sent but not yet fully answered. */
+		int m_outstandingRequests;
+
+		/* Commands waiting to be answered, in the order they are sent. */
+		QQueue<Command> m_commands;
+
+		/* Number of commands at the head of the queue which have been
+		 * sent to the server.
+		 */
+		int m_commandsSent;
+
+		/* True while the only command sent is unterminated. */
+		bool m_bareCommandSent;
+
+		/* True while stale stream data is flushed after stopping. No
+		 * commands are sent until the flush is done.
+		 */
+		bool m_flushing;
+
+		/* Number of bytes of stale stream data yet to be discarded. */
+		qint64 m_flushBytes;
+
+		/* Timer ending a flush if the stale data never arrives. */
+		QTimer m_flushTimer;
+
+		/* Lines of the reply to the current command received so far. */
+		QList<QByteArray> m_replyLines;
+
+		/* Timer failing the current command if no reply arrives. */
+		QTimer m_commandTimer;
+
+		/* Timer measuring the time from initialize() until the source
+		 * is initialized.
+		 */
+		QElapsedTimer m_initializationTimer;
+
+		/* Time taken by the last successful initialization, in ms. */
+		float m_initializationTime;
 };
 
 }; // end datasource namespace 
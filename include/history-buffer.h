@@ -0,0 +1,147 @@
+/*! \file history-buffer.h
+ *
+ * Class retaining the most recent data emitted by a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef HISTORY_BUFFER_H_
+#define HISTORY_BUFFER_H_
+
+#include "source-stage.h"
+
+#include <QtCore>
+#include <QtConcurrent>
+
+#include <atomic>
+
+namespace datasource {
+
+/*! \class HistoryBuffer
+ *
+ * The HistoryBuffer class retains the last seconds() of data emitted by a
+ * source, so that the data before an event, e.g., a photodiode flash or an
+ * operator's keypress, may be retrieved after the event.
+ *
+ * Samples are numbered from the first sample emitted after attach(), and
+ * the buffer holds samples [begin(), end()). All of its memory is allocated
+ * when the first block arrives, and each block is then copied into it, in
+ * the source's thread, without allocating. The buffer never holds on to the
+ * source's blocks, so it does not hold back sources which wait for their
+ * blocks to be released. Attaching the buffer to a source discards the data
+ * retained from the last one, so it must not be done while views of the
+ * buffer are in use or dumps are being written.
+ *
+ * snapshot() returns a view of any range of the retained samples, without
+ * copying them. Each channel is stored twice over, back to back, so that
+ * every range is contiguous within each channel, even where it wraps around
+ * the end of the buffer. The buffer therefore uses twice the memory of the
+ * samples it retains.
+ *
+ * Views refer to memory which the source's thread overwrites as blocks
+ * arrive, so they may only be read while the source is stopped or the buffer
+ * is detached. While data is acquired, copy() copies a range instead, and the
+ * next block waits until the copy is done. requestDump() copies a range in
+ * the same way, and writes it to an HDF5 file in the background, in the
+ * format of RecordingSink.
+ */
+class LIBDATA_SOURCE_VISIBILITY HistoryBuffer : public SourceStage {
+	Q_OBJECT
+
+	public:
+
+		/*! Construct a buffer retaining the given number of seconds of data. */
+		explicit HistoryBuffer(double seconds, QObject* parent = nullptr);
+
+		/*! Detach from any source, and wait for any dumps to finish. */
+		~HistoryBuffer();
+
+		HistoryBuffer(const HistoryBuffer&) = delete;
+		HistoryBuffer& operator=(const HistoryBuffer&) = delete;
+
+		/*! Return the number of seconds of data retained. */
+		double seconds() const;
+
+		/*! Return the number of samples of each channel retained, which
+		 * is known once the first block arrives, and zero until then.
+		 */
+		quint64 capacity() const;
+
+		/*! Return the number of channels retained. */
+		int nchannels() const;
+
+		/*! Return the first sample retained. */
+		quint64 begin() const;
+
+		/*! Return one past the last sample retained. */
+		quint64 end() const;
+
+		/*! Return a view of samples [from, to) of every channel, shaped
+		 * (to - from, nchannels()), without copying them. The view may
+		 * only be read while the source is stopped or the buffer is
+		 * detached. This throws an std::out_of_range if the range is not
+		 * retained.
+		 */
+		const arma::subview<qint16> snapshot(quint64 from, quint64 to) const;
+
+		/*! Return a copy of samples [from, to) of every channel, shaped
+		 * (to - from, nchannels()). This may be called from any thread,
+		 * including while data is acquired, and throws an std::out_of_range
+		 * if the range is not retained.
+		 */
+		Samples copy(quint64 from, quint64 to) const;
+
+		/*! Return true if samples from \p from onwards have not been
+		 * overwritten.
+		 */
+		bool isIntact(quint64 from) const;
+
+	public slots:
+
+		/*! Handle a request to write samples [from, to) to an HDF5 file.
+		 *
+		 * The range is copied from the buffer and written in a background
+		 * thread. The dumpFinished() signal is emitted when it is done.
+		 */
+		void requestDump(quint64 from, quint64 to, QString filename);
+
+	signals:
+
+		/*! Emitted when a dump has been written, or has failed. */
+		void dumpFinished(QString filename, bool success, QString msg = QString());
+
+	private:
+
+		/* Discard the retained data. */
+		void reset() Q_DECL_OVERRIDE;
+
+		/* Copy a block into the buffer, from the source's thread. */
+		void process(const SampleBlock& block) Q_DECL_OVERRIDE;
+
+		/* Write samples [from, to) to the given file. */
+		void dump(quint64 from, quint64 to, const QString& filename);
+
+		/* Seconds of data retained. */
+		double m_seconds;
+
+		/* The retained samples, shaped (2 * capacity, nchannels). Sample s
+		 * is stored at rows (s % capacity) and (s % capacity + capacity).
+		 */
+		Samples m_storage;
+		quint64 m_capacity;
+
+		/* One past the last sample written, and one past the last sample
+		 * which has been, or is being, overwritten.
+		 */
+		std::atomic<quint64> m_end;
+		std::atomic<quint64> m_writing;
+
+		/* Dumps being written, and the lock protecting them. */
+		QMutex m_lock;
+		QList<QFuture<void>> m_dumps;
+};
+
+}; // end datasource namespace
+
+#endif
+
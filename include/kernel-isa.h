@@ -0,0 +1,35 @@
+/*! \file kernel-isa.h
+ *
+ * Selection of the instruction set used by the library's vectorized kernels.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef KERNEL_ISA_H_
+#define KERNEL_ISA_H_
+
+#include "base-source.h"
+
+namespace datasource {
+
+/*! Instruction sets for which kernels are implemented. */
+enum class KernelIsa {
+	Best,	/*!< The best instruction set supported by the running CPU. */
+	Scalar,	/*!< Portable C++, available everywhere. */
+	Sse2,	/*!< 128-bit SSE2 vectors. */
+	Avx2	/*!< 256-bit AVX2 vectors. */
+};
+
+/*! Return true if the running CPU supports the given instruction set. */
+LIBDATA_SOURCE_VISIBILITY bool kernelSupported(KernelIsa isa);
+
+/*! Return the instruction set a kernel should use when the given one is
+ * requested: the best one supported if KernelIsa::Best is requested, and
+ * KernelIsa::Scalar if the requested one is not supported.
+ */
+LIBDATA_SOURCE_VISIBILITY KernelIsa resolveKernelIsa(KernelIsa isa);
+
+}; // end datasource namespace
+
+#endif
+
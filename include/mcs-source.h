@@ -228,9 +228,6 @@ class LIBDATA_SOURCE_VISIBILITY McsSource : public BaseSource {
 		 */
 		TaskHandle m_outputTask;
 
-		/* A buffer into which new data is acquired. */
-		Samples m_acqBuffer;
-
 		/* Array storing the analog output for the current recording. */
 		QVector<double> m_analogOutput;
 
@@ -0,0 +1,142 @@
+/*! \file preview-stage.h
+ *
+ * Class computing a decimated min/max envelope of the data emitted by a
+ * source, for display.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef PREVIEW_STAGE_H_
+#define PREVIEW_STAGE_H_
+
+#include "source-stage.h"
+#include "kernel-isa.h"
+
+#include <QtCore>
+
+#include <vector>
+
+namespace datasource {
+
+/*! Compute the minimum and maximum of consecutive bins of one channel.
+ *
+ * \param in The samples of one channel.
+ * \param edges The nbins + 1 edges of the bins. Bin b covers samples
+ * 	[edges[b], edges[b + 1]) of the input.
+ * \param nbins The number of bins.
+ * \param minima Output minimum of each bin.
+ * \param maxima Output maximum of each bin.
+ * \param isa The instruction set to use.
+ *
+ * The minimum and maximum of an empty bin are the largest and smallest
+ * values of a qint16 respectively, so that the envelope of a bin split
+ * across several calls is the minimum and maximum of its parts.
+ */
+LIBDATA_SOURCE_VISIBILITY void minMaxEnvelope(const qint16* in,
+		const arma::uword* edges, arma::uword nbins,
+		qint16* minima, qint16* maxima, KernelIsa isa = KernelIsa::Best);
+
+/*! \class PreviewStage
+ *
+ * The PreviewStage class reduces the data emitted by a source to a min/max
+ * envelope at a much lower rate, enough to draw each channel a few hundred
+ * pixels wide. Viewers connect to previewAvailable() instead of the source's
+ * dataAvailable() signal, so that each of them neither receives nor decimates
+ * the full-rate data.
+ *
+ * The samples of each channel are divided into consecutive bins, and the
+ * minimum and maximum of each bin are computed as each block arrives, in the
+ * source's thread. Bins span the blocks emitted by the source, and each bin
+ * is emitted once it is complete. Bins are numbered from the first sample
+ * emitted after attach(), and bin k begins at sample
+ * floor(k * sampleRate() / rate()), i.e., at time k / rate() rounded down to
+ * a whole sample. Bins are therefore sampleRate() / rate() samples long on
+ * average, and their lengths may differ by one sample. Any partial bin is
+ * discarded when the stage is detached.
+ */
+class LIBDATA_SOURCE_VISIBILITY PreviewStage : public SourceStage {
+	Q_OBJECT
+
+	public:
+
+		/*! Default number of bins of the envelope per second. */
+		static constexpr float DefaultRate = 500.;
+
+		/*! Construct a stage emitting the given number of bins per second.
+		 * This throws an std::invalid_argument if the rate is not positive.
+		 */
+		explicit PreviewStage(float rate = DefaultRate, QObject* parent = nullptr);
+
+		/*! Detach from any source. */
+		~PreviewStage();
+
+		PreviewStage(const PreviewStage&) = delete;
+		PreviewStage& operator=(const PreviewStage&) = delete;
+
+		/*! Return the number of bins of the envelope per second. */
+		float rate() const;
+
+		/*! Set the number of bins of the envelope per second, which must
+		 * be positive. This must be called before attach(). A rate above
+		 * the source's sample rate gives one bin per sample.
+		 */
+		void setRate(float rate);
+
+		/*! Set the instruction set used to compute the envelope. This must
+		 * be called before attach().
+		 */
+		void setKernelIsa(KernelIsa isa);
+
+	signals:
+
+		/*! Emitted with the envelope of each group of bins completed by a
+		 * block of the source.
+		 *
+		 * \param bin The index of the first of the bins.
+		 * \param minima The minimum of each bin, shaped (nbins, nchannels).
+		 * \param maxima The maximum of each bin, shaped (nbins, nchannels).
+		 */
+		void previewAvailable(quint64 bin, SampleBlock minima, SampleBlock maxima);
+
+	private:
+
+		/* Discard any partial bin. */
+		void reset() Q_DECL_OVERRIDE;
+
+		/* Add a block to the envelope, from the source's thread. */
+		void process(const SampleBlock& block) Q_DECL_OVERRIDE;
+
+		/* Return the first sample of the given bin. */
+		quint64 binStart(quint64 bin) const;
+
+		/* Number of bins per second, and instruction set used. */
+		float m_rate;
+		KernelIsa m_isa;
+
+		/* Number of samples in each bin, zero until the first block
+		 * arrives. Used only by the source's thread.
+		 */
+		double m_binSamples;
+
+		/* Index of the next sample to arrive, and of the bin it falls in.
+		 * Used only by the source's thread.
+		 */
+		quint64 m_position;
+		quint64 m_bin;
+
+		/* Minimum and maximum of each channel over the partial bin. Used
+		 * only by the source's thread.
+		 */
+		Samples m_partialMin;
+		Samples m_partialMax;
+
+		/* Edges of the bins within the current block. Used only by the
+		 * source's thread.
+		 */
+		std::vector<arma::uword> m_edges;
+};
+
+}; // end datasource namespace
+
+#endif
+
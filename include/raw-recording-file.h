@@ -0,0 +1,109 @@
+/*! \file raw-recording-file.h
+ *
+ * Class for reading recordings stored as raw binary samples.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef RAW_RECORDING_FILE_H_
+#define RAW_RECORDING_FILE_H_
+
+#include "recording-file.h"
+
+#include <QtCore>
+
+namespace datasource {
+
+/*! \class RawRecordingFile
+ *
+ * The RawRecordingFile class reads recordings stored as flat, little-endian
+ * 16-bit samples, described by a small JSON sidecar file whose name is that
+ * of the recording with ".json" appended. The sidecar is an object with the
+ * following keys:
+ *
+ * 	- "sample-rate" (required) The sample rate, in Hz.
+ * 	- "nchannels" (required) The number of channels.
+ * 	- "layout" Either "interleaved" (the default), in which all channels of
+ * 	  each sample are stored together, or "channel-major", in which all
+ * 	  samples of each channel are stored together.
+ * 	- "header-bytes" The number of bytes preceding the data, which must be
+ * 	  even. Default 0.
+ * 	- "device-type" The array from which the data was recorded. Default "raw".
+ * 	- "gain" The gain of the recording amplifier. Default 1.
+ * 	- "offset" The offset, or ADC range, of the recording. Default 0.
+ *
+ * The file is memory-mapped, so that reading from the page cache requires
+ * no system calls. Each chunk is copied straight out of the mapping into
+ * the caller's matrix, transposing interleaved data on the way. The kernel
+ * is advised that the mapping is read sequentially, and is asked to read
+ * ahead ReadAheadBytes of the file whenever a read leaves the window last
+ * read ahead, so that playback rarely waits on the disk.
+ */
+class LIBDATA_SOURCE_VISIBILITY RawRecordingFile : public RecordingFile {
+
+	public:
+
+		/*! Number of bytes of the file which the kernel is asked to read
+		 * ahead of the current position.
+		 */
+		static constexpr qint64 ReadAheadBytes = 32 * 1024 * 1024;
+
+		/*! Open the given recording, described by its sidecar file. This
+		 * throws an std::invalid_argument if the sidecar is missing or
+		 * invalid, or the recording cannot be mapped.
+		 */
+		explicit RawRecordingFile(const QString& filename);
+		~RawRecordingFile();
+
+		RawRecordingFile(const RawRecordingFile&) = delete;
+		RawRecordingFile& operator=(const RawRecordingFile&) = delete;
+
+		/*! Return the name of the sidecar file describing a recording. */
+		static QString sidecarName(const QString& filename);
+
+		virtual QString array() const Q_DECL_OVERRIDE;
+		virtual quint64 nsamples() const Q_DECL_OVERRIDE;
+		virtual int nchannels() const Q_DECL_OVERRIDE;
+		virtual float sampleRate() const Q_DECL_OVERRIDE;
+		virtual float gain() const Q_DECL_OVERRIDE;
+		virtual float offset() const Q_DECL_OVERRIDE;
+		virtual void data(int firstChannel, int lastChannel,
+				quint64 start, quint64 end, Samples& out) Q_DECL_OVERRIDE;
+		using RecordingFile::data;
+
+	private:
+
+		/* Ask the kernel to read ahead from the given sample, if it is
+		 * outside the window last read ahead.
+		 */
+		void readAhead(quint64 start, quint64 end);
+
+		/* Advise the kernel about the given range of the mapping. */
+		void advise(const uchar* begin, qint64 length, int advice);
+
+		/* The recording, and its mapping into memory. */
+		QFile m_file;
+		uchar* m_map;
+		qint64 m_mapSize;
+
+		/* First sample of the data, within the mapping. */
+		const qint16* m_data;
+
+		/* Metadata, read from the sidecar. */
+		QString m_array;
+		quint64 m_nsamples;
+		int m_nchannels;
+		bool m_interleaved;
+		float m_sampleRate;
+		float m_gain;
+		float m_offset;
+
+		/* Range of samples [start, end) last read ahead. */
+		quint64 m_readAheadStart;
+		quint64 m_readAheadEnd;
+};
+
+}; // end datasource namespace
+
+#endif
+
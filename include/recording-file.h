@@ -0,0 +1,174 @@
+/*! \file recording-file.h
+ *
+ * Interface for reading previously-recorded data, independent of the
+ * format in which it is stored.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef RECORDING_FILE_H_
+#define RECORDING_FILE_H_
+
+#include "base-source.h"
+#include "configuration.h"
+
+#include "libdatafile/include/datafile.h"
+
+#include <QtCore>
+
+#include <memory> // std::unique_ptr
+#include <utility> // std::pair
+#include <vector>
+
+namespace datasource {
+
+class Hdf5ChunkReader;
+
+/*! Return the mutex serializing all access to the HDF5 library.
+ *
+ * The HDF5 library is not thread-safe, so every call into it, from any
+ * file source or prefetch thread in the process, must hold this mutex.
+ */
+LIBDATA_SOURCE_VISIBILITY QMutex* hdf5Mutex();
+
+/*! \class RecordingFile
+ *
+ * The RecordingFile class is the interface through which a FileSource reads
+ * a recording. Subclasses implement it for each format in which recordings
+ * are stored, and open() picks the right one for a given file.
+ *
+ * The metadata methods may be called from any thread. data() may be called
+ * from one thread at a time, which need not be the thread that created the
+ * file.
+ */
+class LIBDATA_SOURCE_VISIBILITY RecordingFile {
+
+	public:
+
+		virtual ~RecordingFile() = default;
+
+		/*! Open the given recording, choosing the backend from its header.
+		 *
+		 * HDF5 files are read with libdatafile. Any other file is read as
+		 * raw binary data, if it has a JSON sidecar describing it (see
+		 * RawRecordingFile). This throws an std::invalid_argument if the
+		 * file is in neither format, or cannot be read.
+		 */
+		static std::unique_ptr<RecordingFile> open(const QString& filename);
+
+		/*! Return the type of array from which the data was recorded. */
+		virtual QString array() const = 0;
+
+		/*! Return the number of samples of each channel. */
+		virtual quint64 nsamples() const = 0;
+
+		/*! Return the number of channels. */
+		virtual int nchannels() const = 0;
+
+		/*! Return the sample rate, in Hz. */
+		virtual float sampleRate() const = 0;
+
+		/*! Return the gain of the recording amplifier. */
+		virtual float gain() const = 0;
+
+		/*! Return the offset, or ADC range, of the recording. */
+		virtual float offset() const = 0;
+
+		/*! Return any analog output presented during the recording. */
+		virtual QVector<double> analogOutput() const { return {}; }
+
+		/*! Return the configuration of the electrodes, for arrays which
+		 * have one.
+		 */
+		virtual QConfiguration configuration() const { return {}; }
+
+		/*! Read samples [start, end) of channels [firstChannel, lastChannel)
+		 * into the given matrix, which is resized as needed.
+		 */
+		virtual void data(int firstChannel, int lastChannel,
+				quint64 start, quint64 end, Samples& out) = 0;
+
+		/*! Set the number of chunks of the file decoded ahead of each read,
+		 * for formats which decode chunks in the background. Others ignore
+		 * this.
+		 */
+		virtual void setReadAhead(int chunks) { Q_UNUSED(chunks); }
+
+		/*! Runs of consecutive channels, as the first and one past the
+		 * last channel of each run.
+		 */
+		using ChannelRuns = std::vector<std::pair<int, int>>;
+
+		/*! Return the runs of consecutive channels in the given list of
+		 * channels, in order. An empty list selects all of a file's
+		 * \p nchannels channels.
+		 */
+		static ChannelRuns channelRuns(const std::vector<int>& channels, int nchannels);
+
+		/*! Read samples [start, end) of the given runs of channels into
+		 * consecutive columns of \p out, which must already have the
+		 * right shape.
+		 *
+		 * Each run is read with a single call to data(), so that only the
+		 * selected channels are read and decoded. Since columns are
+		 * contiguous, each run is read directly into its columns of \p out,
+		 * through a matrix sharing their memory, and nothing is copied.
+		 */
+		void data(const ChannelRuns& runs, quint64 start, quint64 end, Samples& out);
+};
+
+/*! \class Hdf5RecordingFile
+ *
+ * The Hdf5RecordingFile class reads recordings stored in HDF5 files by the
+ * lab's recording software, through libdatafile. Every method holds the
+ * hdf5Mutex() while it calls into the library.
+ *
+ * When the data is stored compressed in chunks, data() instead reads it
+ * through an Hdf5ChunkReader, which decompresses chunks on many threads,
+ * and falls back to libdatafile for any read it cannot complete.
+ */
+class LIBDATA_SOURCE_VISIBILITY Hdf5RecordingFile : public RecordingFile {
+
+	public:
+
+		/*! Open the given HDF5 file. This throws an std::invalid_argument
+		 * if the file cannot be read.
+		 */
+		explicit Hdf5RecordingFile(const QString& filename);
+		~Hdf5RecordingFile();
+
+		/*! Return true if data is read by decompressing chunks in parallel. */
+		bool isReadingChunks() const;
+
+		/*! Set the number of columns of chunks decompressed ahead of each
+		 * read. See Hdf5ChunkReader::setReadAhead().
+		 */
+		virtual void setReadAhead(int chunks) Q_DECL_OVERRIDE;
+
+		virtual QString array() const Q_DECL_OVERRIDE;
+		virtual quint64 nsamples() const Q_DECL_OVERRIDE;
+		virtual int nchannels() const Q_DECL_OVERRIDE;
+		virtual float sampleRate() const Q_DECL_OVERRIDE;
+		virtual float gain() const Q_DECL_OVERRIDE;
+		virtual float offset() const Q_DECL_OVERRIDE;
+		virtual QVector<double> analogOutput() const Q_DECL_OVERRIDE;
+		virtual QConfiguration configuration() const Q_DECL_OVERRIDE;
+		virtual void data(int firstChannel, int lastChannel,
+				quint64 start, quint64 end, Samples& out) Q_DECL_OVERRIDE;
+		using RecordingFile::data;
+
+	private:
+
+		/* The underlying file, a hidensfile::HidensFile for HiDens recordings. */
+		std::unique_ptr<datafile::DataFile> m_file;
+
+		/* Reader decompressing chunks in parallel, or null if the file
+		 * is not stored in a form it supports.
+		 */
+		std::unique_ptr<Hdf5ChunkReader> m_chunkReader;
+};
+
+}; // end datasource namespace
+
+#endif
+
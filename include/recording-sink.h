@@ -0,0 +1,222 @@
+/*! \file recording-sink.h
+ *
+ * Class for recording the data from any source to an HDF5 file.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef RECORDING_SINK_H_
+#define RECORDING_SINK_H_
+
+#include "base-source.h"
+#include "configuration.h"
+
+#include <QtCore>
+
+#include <hdf5.h>
+
+namespace datasource {
+
+/*! \class RecordingSink
+ *
+ * The RecordingSink class writes the data emitted by a source to an HDF5
+ * file, in the format read back by the FileSource. The samples are written
+ * to the "data" dataset, shaped (channels, samples), whose attributes give
+ * the sample rate, gain, offset (ADC range), array, and the date and time at
+ * which recording began. Any analog output or electrode configuration which
+ * the source reports in its status is written to the "analog-output" and
+ * "configuration" datasets.
+ *
+ * The sink is attached to a source with attach(). Each block the source
+ * emits is added to a bounded queue, from the source's thread, without
+ * copying the samples or waiting for the disk. A dedicated thread writes
+ * the queued blocks to the file, so that a slow disk never stalls the
+ * source or its other consumers. If the queue is full, e.g., because the
+ * disk cannot keep up, blocks are dropped and counted, and error() is
+ * emitted for the first of them.
+ *
+ * The dataset is stored in chunks of chunkSamples() samples of every
+ * channel. Samples are collected until a whole chunk is ready, and each
+ * chunk is written with a single write aligned to the chunk layout, so that
+ * the library never reads back or rewrites a partial chunk. The final,
+ * partial, chunk is written by detach(), which also finishes the file.
+ *
+ * The depth of the queue, the number of samples written and dropped, and
+ * the sustained write throughput, in bytes per second spent writing, are
+ * reported in the sink's status.
+ */
+class LIBDATA_SOURCE_VISIBILITY RecordingSink : public QThread {
+	Q_OBJECT
+
+	public:
+
+		/*! Default maximum number of blocks waiting to be written. */
+		static constexpr int DefaultQueueCapacity = 256;
+
+		/*! Default number of samples in each chunk of the dataset. */
+		static constexpr quint64 DefaultChunkSamples = 10000;
+
+		/*! Construct a sink writing to the given file, which is created
+		 * when the first block arrives and replaces any existing file.
+		 * This throws an std::invalid_argument if the file's directory
+		 * does not exist.
+		 */
+		explicit RecordingSink(const QString& filename, QObject* parent = nullptr);
+
+		/*! Detach from any source, finishing the file. */
+		~RecordingSink();
+
+		RecordingSink(const RecordingSink&) = delete;
+		RecordingSink& operator=(const RecordingSink&) = delete;
+
+		/*! Start recording the data emitted by the given source, which
+		 * must outlive the sink or be detached first. The source may live
+		 * in any thread. A sink records at most one source, once. Blocks
+		 * emitted while the sink is being detached may not be recorded.
+		 */
+		void attach(BaseSource* source);
+
+		/*! Stop recording, write any data still queued, and close the file. */
+		void detach();
+
+		/*! Queue a block to be written, as if it were emitted by an attached
+		 * source. This may be called from any thread, once the writer thread
+		 * has been started by attach() or start(). It never blocks on the
+		 * disk, and drops the block if the queue is full.
+		 */
+		void record(const SampleBlock& block);
+
+		/*! Set the metadata written to the file from a source's status, as
+		 * is done automatically for an attached source. This may be called
+		 * from any thread.
+		 */
+		void setMetadata(const QVariantMap& status);
+
+		/*! Set the maximum number of blocks waiting to be written. This
+		 * must be called before attach().
+		 */
+		void setQueueCapacity(int blocks);
+
+		/*! Set the number of samples in each chunk of the dataset. This
+		 * must be called before attach().
+		 */
+		void setChunkSamples(quint64 nsamples);
+
+		/*! Set the level of deflate compression, from 0 (none, the default)
+		 * to 9. Compressed chunks are also shuffled. This must be called
+		 * before attach().
+		 */
+		void setCompression(int level);
+
+		/*! Return the name of the file being written. */
+		QString filename() const;
+
+		/*! Return the number of blocks waiting to be written. */
+		int queueDepth() const;
+
+		/*! Return the number of samples written to the file. */
+		quint64 samplesWritten() const;
+
+		/*! Return the number of blocks dropped because the queue was full. */
+		quint64 blocksDropped() const;
+
+		/*! Return the sustained write throughput, in bytes per second
+		 * spent writing.
+		 */
+		double writeThroughput() const;
+
+	public slots:
+
+		/*! Handle a request for the status of the sink. */
+		void requestStatus();
+
+	signals:
+
+		/*! Emitted in response to a request for the status of the sink. */
+		void status(QVariantMap status);
+
+		/*! Emitted when data cannot be recorded. */
+		void error(QString msg = QString());
+
+	protected:
+
+		/* Write queued blocks until detached. */
+		virtual void run() Q_DECL_OVERRIDE;
+
+	private:
+
+		/* Add a block to the chunk being collected, writing each chunk
+		 * when it is complete. Return false on failure.
+		 */
+		bool append(const SampleBlock& block);
+
+		/* Create the file, with a dataset for the given number of channels. */
+		bool create(int nchannels);
+
+		/* Write the first nsamples of the chunk being collected. */
+		bool writeChunk(quint64 nsamples);
+
+		/* Write the metadata to the file, replacing any already written. */
+		void writeMetadata();
+
+		/* Close the file. */
+		void close();
+
+		/* Name of the file written. */
+		QString m_filename;
+
+		/* Connections to the attached source. */
+		QList<QMetaObject::Connection> m_connections;
+
+		/* Shape and compression of each chunk of the dataset. */
+		quint64 m_chunkSamples;
+		int m_compression;
+
+		/* Handles to the file and dataset, negative if not open. Used
+		 * only by the writer thread, while it runs.
+		 */
+		hid_t m_file;
+		hid_t m_dataset;
+
+		/* The chunk being collected, and the number of samples in it.
+		 * Used only by the writer thread.
+		 */
+		Samples m_chunk;
+		quint64 m_collected;
+
+		/* Time at which recording began. */
+		QDateTime m_startTime;
+
+		/* Protects all members below. */
+		mutable QMutex m_lock;
+
+		/* Signalled when a block is queued or the sink is detached. */
+		QWaitCondition m_wake;
+
+		/* Blocks waiting to be written, and the maximum number of them. */
+		QQueue<SampleBlock> m_queue;
+		int m_queueCapacity;
+
+		/* Metadata reported by the source. */
+		float m_sampleRate;
+		float m_gain;
+		float m_offset;
+		QString m_array;
+		QVector<double> m_analogOutput;
+		QConfiguration m_configuration;
+
+		/* Counters for the status. */
+		quint64 m_written;
+		quint64 m_dropped;
+		quint64 m_bytesWritten;
+		qint64 m_writeNanoseconds;
+
+		/* True once attached, and once detached. */
+		bool m_attached;
+		bool m_stop;
+};
+
+}; // end datasource namespace
+
+#endif
+
@@ -0,0 +1,124 @@
+/*! \file sample-block.h
+ *
+ * Description of the immutable, reference-counted block of samples
+ * emitted by all data sources.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef SAMPLE_BLOCK_H_
+#define SAMPLE_BLOCK_H_
+
+#include <armadillo>
+#include <QtCore>
+
+#include <memory> // std::shared_ptr
+
+namespace datasource {
+
+/*! Type alias for a single frame of data.
+ * This is declared inside its own namespace because the
+ * Q_DECLARE_METATYPE macro must have the fully-qualified
+ * name, but that macro itself must appear in the global
+ * namespace.
+ */
+using Samples = arma::Mat<qint16>;
+
+/*! \class SampleBlock
+ *
+ * The SampleBlock class is an immutable, reference-counted handle to
+ * a frame of data. Copying a block, including the copies Qt makes when
+ * delivering a queued signal to a receiver in another thread, only
+ * increments a reference count. The underlying samples are never copied,
+ * and are released when the last block referring to them is destroyed.
+ *
+ * The samples are shaped as (nsamples, nchannels). Because Armadillo
+ * uses column-major ordering, all samples from a single channel are
+ * contiguous in memory, followed by those from the next channel, etc.
+ */
+class SampleBlock {
+
+	public:
+
+		/*! Construct an empty block. */
+		SampleBlock() { }
+
+		/*! Construct a block by taking ownership of the given samples. */
+		explicit SampleBlock(Samples&& samples) :
+			m_samples(std::make_shared<const Samples>(std::move(samples)))
+		{ }
+
+		/*! Construct a block by copying the given samples. This is the
+		 * only place at which a copy of the data is made.
+		 */
+		explicit SampleBlock(const Samples& samples) :
+			m_samples(std::make_shared<const Samples>(samples))
+		{ }
+
+		/*! Construct a block sharing ownership of existing samples. */
+		explicit SampleBlock(std::shared_ptr<const Samples> samples) :
+			m_samples(std::move(samples))
+		{ }
+
+		/*! Return a read-only reference to the underlying samples. */
+		const Samples& samples() const
+		{
+			return m_samples ? *m_samples : empty();
+		}
+
+		/*! Implicitly convert to the underlying samples. This allows
+		 * existing slots accepting a `const datasource::Samples&` to
+		 * be connected directly to the BaseSource::dataAvailable() signal.
+		 */
+		operator const Samples&() const { return samples(); }
+
+		/*! Return a read-only view of the data from a single channel. */
+		const arma::subview_col<qint16> channel(arma::uword index) const
+		{
+			return samples().col(index);
+		}
+
+		/*! Return a read-only view of a range of samples from all channels.
+		 * \param first The first sample in the range.
+		 * \param last The last sample in the range, inclusive.
+		 */
+		const arma::subview<qint16> range(arma::uword first, arma::uword last) const
+		{
+			return samples().rows(first, last);
+		}
+
+		/*! Return a pointer to the raw, channel-major data. */
+		const qint16* memptr() const { return samples().memptr(); }
+
+		/*! Return the number of samples from each channel in the block. */
+		arma::uword nsamples() const { return samples().n_rows; }
+
+		/*! Return the number of channels in the block. */
+		arma::uword nchannels() const { return samples().n_cols; }
+
+		/*! Return true if the block contains no data. */
+		bool isEmpty() const { return samples().is_empty(); }
+
+		/*! Return the number of blocks sharing the underlying samples. */
+		long useCount() const { return m_samples.use_count(); }
+
+	private:
+
+		/* Shared empty matrix returned for default-constructed blocks. */
+		static const Samples& empty()
+		{
+			static const Samples e;
+			return e;
+		}
+
+		/* The actual shared samples. */
+		std::shared_ptr<const Samples> m_samples;
+};
+
+}; // end datasource namespace
+
+Q_DECLARE_METATYPE(datasource::Samples);
+Q_DECLARE_METATYPE(datasource::SampleBlock);
+
+#endif
+
@@ -0,0 +1,164 @@
+/*! \file sample-clock.h
+ *
+ * Description of a clock which paces the emission of samples against
+ * a monotonic clock.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef SAMPLE_CLOCK_H_
+#define SAMPLE_CLOCK_H_
+
+#include <QtCore>
+
+#include <cmath> // std::floor, std::ceil
+
+namespace datasource {
+
+/*! \class SampleClock
+ *
+ * The SampleClock class computes how many samples should have been emitted
+ * by a source, given the time elapsed on a monotonic clock since the source
+ * started. The number of samples due is computed from the total elapsed time,
+ * rather than accumulated from timer intervals, and the fractional part of
+ * a sample is carried across changes of rate. Emission paced by this clock
+ * therefore never drifts from the true sample rate, however coarse or
+ * jittery the timers driving it are.
+ *
+ * The source reports each block it emits with advance(), and uses pending()
+ * to decide whether another block is due and msecsUntil() to schedule the
+ * next check.
+ *
+ * Time is read from a QElapsedTimer by now(), which subclasses may override,
+ * e.g., to drive the clock by hand in tests.
+ */
+class SampleClock {
+
+	public:
+
+		/*! Construct a clock for the given sample rate, played back at the
+		 * given multiple of real time.
+		 */
+		explicit SampleClock(double sampleRate = 0., double rate = 1.) :
+			m_sampleRate(sampleRate),
+			m_rate(rate),
+			m_base(0.),
+			m_emitted(0),
+			m_rebased(0)
+		{ }
+
+		virtual ~SampleClock() { }
+
+		/*! Start the clock, with no samples emitted. */
+		void start()
+		{
+			m_timer.start();
+			m_base = 0.;
+			m_emitted = 0;
+			m_rebased = now();
+		}
+
+		/*! Return true if the clock has been started. */
+		bool isValid() const { return m_timer.isValid(); }
+
+		/*! Set the sample rate of the source, in Hz. */
+		void setSampleRate(double sampleRate)
+		{
+			rebase();
+			m_sampleRate = sampleRate;
+		}
+
+		/*! Set the playback rate, as a multiple of real time. Samples
+		 * due until now are kept, and later samples become due at the
+		 * new rate.
+		 */
+		void setRate(double rate)
+		{
+			rebase();
+			m_rate = rate;
+		}
+
+		/*! Return the exact, fractional number of samples due since start. */
+		double exactDue() const
+		{
+			if (!m_timer.isValid()) {
+				return 0.;
+			}
+			return m_base + (now() - m_rebased) * 1e-9 * m_sampleRate * m_rate;
+		}
+
+		/*! Return the number of whole samples due since start. */
+		quint64 due() const
+		{
+			return static_cast<quint64>(std::floor(exactDue()));
+		}
+
+		/*! Return the number of samples emitted since start. */
+		quint64 emitted() const { return m_emitted; }
+
+		/*! Return the number of samples due but not yet emitted. */
+		quint64 pending() const
+		{
+			auto d = due();
+			return (d > m_emitted) ? (d - m_emitted) : 0;
+		}
+
+		/*! Record that the given number of samples have been emitted. */
+		void advance(quint64 nsamples) { m_emitted += nsamples; }
+
+		/*! Return the number of milliseconds until the given number
+		 * of samples beyond those emitted are due, rounded up.
+		 */
+		int msecsUntil(quint64 nsamples) const
+		{
+			const auto rate = m_sampleRate * m_rate;
+			if (!(rate > 0.)) {
+				return 0;
+			}
+			auto remaining = (m_emitted + nsamples) - exactDue();
+			if (remaining <= 0.) {
+				return 0;
+			}
+			return static_cast<int>(std::ceil(remaining / rate * 1000.));
+		}
+
+	protected:
+
+		/*! Return the current time in nanoseconds, on any monotonic clock. */
+		virtual qint64 now() const { return m_timer.nsecsElapsed(); }
+
+	private:
+
+		/* Fold the samples due so far into the base, as of now. */
+		void rebase()
+		{
+			if (m_timer.isValid()) {
+				auto time = now();
+				m_base += (time - m_rebased) * 1e-9 * m_sampleRate * m_rate;
+				m_rebased = time;
+			}
+		}
+
+		/* Sample rate of the source, in Hz. */
+		double m_sampleRate;
+
+		/* Playback rate, as a multiple of real time. */
+		double m_rate;
+
+		/* Exact number of samples due when the clock was last rebased. */
+		double m_base;
+
+		/* Number of samples emitted since start. */
+		quint64 m_emitted;
+
+		/* Time at which the clock was last rebased. */
+		qint64 m_rebased;
+
+		/* Monotonic timer measuring time since start. */
+		QElapsedTimer m_timer;
+};
+
+}; // end datasource namespace
+
+#endif
+
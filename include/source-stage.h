@@ -0,0 +1,116 @@
+/*! \file source-stage.h
+ *
+ * Base class for stages processing the data emitted by a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef SOURCE_STAGE_H_
+#define SOURCE_STAGE_H_
+
+#include "base-source.h"
+
+#include <QtCore>
+
+#include <memory>
+
+namespace datasource {
+
+/*! \class SourceStage
+ *
+ * The SourceStage class is the base of classes which process each block
+ * emitted by a source as it arrives, in the source's thread, e.g., the
+ * HistoryBuffer and the SpikeDetector.
+ *
+ * attach() connects the stage to a source and requests the source's status,
+ * and each block the source emits is then passed to process(). The status is
+ * requested without waiting for the source's thread, so the first blocks may
+ * arrive before it. Until then, sampleRate(nsamples) estimates the sample
+ * rate from the size of a block and the source's read interval.
+ *
+ * detach() waits for any block being processed, so that the stage may be
+ * destroyed once it returns. Subclasses must call detach() in their own
+ * destructors, before the members used by process() are destroyed.
+ */
+class LIBDATA_SOURCE_VISIBILITY SourceStage : public QObject {
+	Q_OBJECT
+
+	public:
+
+		/*! Construct a stage, not attached to any source. */
+		explicit SourceStage(QObject* parent = nullptr);
+
+		/*! Detach from any source. */
+		virtual ~SourceStage();
+
+		SourceStage(const SourceStage&) = delete;
+		SourceStage& operator=(const SourceStage&) = delete;
+
+		/*! Start processing the data emitted by the given source, which
+		 * may live in any thread, and must outlive the stage or be detached
+		 * first. This detaches from any previous source, and resets the
+		 * state of the stage.
+		 */
+		void attach(BaseSource* source);
+
+		/*! Stop processing, waiting for any block being processed in the
+		 * source's thread. This may be called from any thread.
+		 */
+		void detach();
+
+		/*! Return the sample rate reported by the attached source, or NaN
+		 * if it has not reported one.
+		 */
+		float sampleRate() const;
+
+	protected:
+
+		/*! Reset the state of the stage, before it is attached to a source. */
+		virtual void reset() {}
+
+		/*! Process a block, from the source's thread. */
+		virtual void process(const SampleBlock& block) = 0;
+
+		/*! Return the sample rate reported by the source, or if it has not
+		 * reported one, an estimate assuming that it emits blocks of the
+		 * given number of samples at its read interval.
+		 */
+		double sampleRate(arma::uword nsamples) const;
+
+		/*! Return the latest status reported by the source. */
+		QVariantMap sourceStatus() const;
+
+		/*! Return the lock held while a block is processed. Holding it
+		 * prevents blocks from being processed.
+		 */
+		QMutex& processLock() const;
+
+	private:
+
+		/* State shared with the handlers connected to the source. */
+		struct Guard;
+
+		/* Handlers hold the guard's lock while they run, and do nothing
+		 * once detach() has cleared its stage. The guard is shared with
+		 * them, so that a handler which has already started when the stage
+		 * is destroyed does not touch the destroyed stage.
+		 */
+		std::shared_ptr<Guard> m_guard;
+
+		/* Connections to the attached source. */
+		QList<QMetaObject::Connection> m_connections;
+
+		/* Interval in milliseconds at which the source emits blocks, used
+		 * to estimate its sample rate if it reports none.
+		 */
+		int m_readInterval;
+
+		/* Protects the status. */
+		mutable QMutex m_lock;
+		QVariantMap m_status;
+};
+
+}; // end datasource namespace
+
+#endif
+
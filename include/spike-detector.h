@@ -0,0 +1,208 @@
+/*! \file spike-detector.h
+ *
+ * Class detecting spikes in the data emitted by a source, online.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef SPIKE_DETECTOR_H_
+#define SPIKE_DETECTOR_H_
+
+#include "source-stage.h"
+#include "kernel-isa.h"
+
+#include <QtCore>
+
+#include <vector>
+
+namespace datasource {
+
+/*! \struct SpikeEvent
+ *
+ * A spike detected on one channel.
+ */
+struct SpikeEvent {
+
+	/*! The channel on which the spike was detected. */
+	int channel;
+
+	/*! The sample at which the channel crossed its threshold, numbered
+	 * from the first sample emitted after the detector was attached.
+	 */
+	quint64 sample;
+
+	/*! The value of the trough of the spike, the smallest sample in the
+	 * refractory period following the crossing.
+	 */
+	qint16 amplitude;
+};
+
+/*! Find the samples of one channel below a threshold.
+ *
+ * \param in The samples of one channel.
+ * \param nsamples The number of samples.
+ * \param level The threshold.
+ * \param indices The index of each sample below the threshold is appended
+ * 	to this, in increasing order.
+ * \param isa The instruction set to use.
+ *
+ * Samples are compared a vector at a time, and only vectors containing a
+ * sample below the threshold are examined further, so the cost is close to
+ * that of reading the samples when spikes are sparse.
+ */
+LIBDATA_SOURCE_VISIBILITY void samplesBelow(const qint16* in, arma::uword nsamples,
+		qint16 level, std::vector<arma::uword>& indices,
+		KernelIsa isa = KernelIsa::Best);
+
+/*! \class SpikeDetector
+ *
+ * The SpikeDetector class finds spikes in the data emitted by a source as
+ * each block arrives, in the source's thread, so that closed-loop experiments
+ * can respond to spikes within milliseconds without shipping the raw data
+ * elsewhere.
+ *
+ * The noise of each channel is estimated from the median absolute deviation
+ * (MAD) of its samples from their median, as MAD / 0.6745. The median and MAD
+ * of each block are folded into running estimates, which forget older blocks
+ * with the time constant noiseTimeConstant(). A spike is detected when a
+ * channel crosses below its median by threshold() times its noise, at least
+ * refractoryPeriod() after the last spike on that channel.
+ *
+ * Detected spikes are emitted in spikesAvailable(), ordered by sample. A
+ * spike is emitted with the block containing the end of its refractory
+ * period, which is usually the block in which it is detected.
+ */
+class LIBDATA_SOURCE_VISIBILITY SpikeDetector : public SourceStage {
+	Q_OBJECT
+
+	public:
+
+		/*! Default threshold, in multiples of the noise. */
+		static constexpr double DefaultThreshold = 4.5;
+
+		/*! Default refractory period, in milliseconds. */
+		static constexpr double DefaultRefractoryPeriod = 1.;
+
+		/*! Default time constant of the noise estimates, in seconds. */
+		static constexpr double DefaultNoiseTimeConstant = 10.;
+
+		/*! Construct a detector with the given threshold, in multiples of
+		 * the noise. This throws an std::invalid_argument if the threshold
+		 * is not positive.
+		 */
+		explicit SpikeDetector(double threshold = DefaultThreshold,
+				QObject* parent = nullptr);
+
+		/*! Detach from any source. */
+		~SpikeDetector();
+
+		SpikeDetector(const SpikeDetector&) = delete;
+		SpikeDetector& operator=(const SpikeDetector&) = delete;
+
+		/*! Return the threshold, in multiples of the noise. */
+		double threshold() const;
+
+		/*! Set the threshold, in multiples of the noise, which must be
+		 * positive. This must be called before attach().
+		 */
+		void setThreshold(double threshold);
+
+		/*! Return the refractory period, in milliseconds. */
+		double refractoryPeriod() const;
+
+		/*! Set the refractory period, in milliseconds, which must not be
+		 * negative. This must be called before attach().
+		 */
+		void setRefractoryPeriod(double msec);
+
+		/*! Return the time constant of the noise estimates, in seconds. */
+		double noiseTimeConstant() const;
+
+		/*! Set the time constant of the noise estimates, in seconds, which
+		 * must be positive. This must be called before attach().
+		 */
+		void setNoiseTimeConstant(double seconds);
+
+		/*! Set the instruction set used to find threshold crossings. This
+		 * must be called before attach().
+		 */
+		void setKernelIsa(KernelIsa isa);
+
+		/*! Return the current estimate of the noise of each channel. */
+		QVector<float> noise() const;
+
+		/*! Return the current threshold of each channel. */
+		QVector<qint16> thresholds() const;
+
+	signals:
+
+		/*! Emitted with the spikes detected in a block of the source, if
+		 * there are any.
+		 */
+		void spikesAvailable(QVector<datasource::SpikeEvent> spikes);
+
+	private:
+
+		/* Discard the noise estimates and any spike not yet emitted. */
+		void reset() Q_DECL_OVERRIDE;
+
+		/* Detect spikes in a block, from the source's thread. */
+		void process(const SampleBlock& block) Q_DECL_OVERRIDE;
+
+		/* Fold the median and MAD of each channel of a block into the
+		 * running estimates, with the given weight.
+		 */
+		void updateNoise(const Samples& samples, double weight);
+
+		/* Parameters, fixed while attached. */
+		double m_threshold;
+		double m_refractoryPeriod;
+		double m_noiseTimeConstant;
+		KernelIsa m_isa;
+
+		/* State of the detection, used only by the source's thread. */
+
+		/* Index of the next sample to arrive. */
+		quint64 m_position;
+
+		/* Refractory period in samples, known once the first block arrives. */
+		quint64 m_refractorySamples;
+
+		/* Number of samples in each time constant of the noise estimates. */
+		double m_noiseSamples;
+
+		/* Running estimates of the median and MAD of each channel. */
+		std::vector<double> m_median;
+		std::vector<double> m_mad;
+
+		/* Threshold of each channel. */
+		std::vector<qint16> m_levels;
+
+		/* Last sample of each channel in the previous block. */
+		std::vector<qint16> m_previous;
+
+		/* End of the refractory period of each channel's last spike. */
+		std::vector<quint64> m_refractoryEnd;
+
+		/* Spikes whose refractory period extends beyond the last block. */
+		std::vector<SpikeEvent> m_pending;
+		std::vector<bool> m_isPending;
+
+		/* Scratch space for finding crossings and medians. */
+		std::vector<arma::uword> m_below;
+		std::vector<qint16> m_scratch;
+
+		/* Copies of the noise and thresholds, for other threads, and the
+		 * lock protecting them.
+		 */
+		mutable QMutex m_lock;
+		QVector<float> m_noise;
+		QVector<qint16> m_thresholds;
+};
+
+}; // end datasource namespace
+
+Q_DECLARE_METATYPE(datasource::SpikeEvent);
+
+#endif
+
@@ -0,0 +1,153 @@
+/*! \file synthetic-source.h
+ *
+ * Class for generating synthetic data, for testing and load-testing
+ * consumers without hardware.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef SYNTHETIC_SOURCE_H_
+#define SYNTHETIC_SOURCE_H_
+
+#include "base-source.h"
+#include "frame-pool.h"
+#include "sample-clock.h"
+
+#include <QtCore>
+
+#include <memory> // std::shared_ptr
+#include <vector>
+
+namespace datasource {
+
+/*! \class SyntheticSource
+ *
+ * The SyntheticSource class generates deterministic, synthetic data for any
+ * number of channels, at any sample rate. Each channel carries uniform-ish
+ * noise, a sinusoid with a period of a whole number of samples, and spikes
+ * of a fixed biphasic waveform at roughly regular intervals. Every sample is
+ * a function of only the source's specification, its channel, and its index
+ * in the stream, so the data does not depend on how it is chunked, and may
+ * be regenerated exactly with generate().
+ *
+ * The source is configured by its location, a comma-separated list of
+ * "key=value" pairs. The keys, and their defaults, are:
+ *
+ * 	- "nchannels" Number of channels, up to MaxChannels. Default 64.
+ * 	- "sample-rate" Sample rate, in Hz. Default 20000.
+ * 	- "seed" Seed from which the noise and spike times are derived. Default 0.
+ * 	- "noise" Peak amplitude of the noise. Default 20.
+ * 	- "sine-amplitude" Amplitude of each channel's sinusoid. Default 100.
+ * 	- "spike-rate" Rate of spikes on each channel, in Hz. Default 5.
+ * 	- "spike-amplitude" Amplitude of the trough of each spike. Default 400.
+ *
+ * As with the FileSource, data is emitted in real time by default, and as
+ * fast as consumers release it if "unthrottled" is set to true. The data is
+ * generated column by column, with loops written to be vectorized by the
+ * compiler, so that the source can find the throughput ceiling of the rest
+ * of the library.
+ */
+class LIBDATA_SOURCE_VISIBILITY SyntheticSource : public BaseSource {
+	Q_OBJECT
+
+	public:
+
+		/*! Maximum number of channels. */
+		static constexpr int MaxChannels = 8192;
+
+		/*! Construct a SyntheticSource.
+		 *
+		 * \param spec The specification of the data, as described above.
+		 * \param readInterval Interval at which data is emitted.
+		 * \param parent The parent QObject.
+		 *
+		 * This throws an std::invalid_argument if the specification is invalid.
+		 */
+		SyntheticSource(const QString& spec = QString(), int readInterval = 10,
+				QObject* parent = nullptr);
+
+		SyntheticSource(const SyntheticSource&) = delete;
+		SyntheticSource(SyntheticSource&&) = delete;
+		SyntheticSource& operator=(const SyntheticSource&) = delete;
+
+		/*! Generate the samples of every channel starting at the given
+		 * sample of the stream, filling the given matrix, whose shape
+		 * gives the number of samples and channels generated.
+		 */
+		void generate(quint64 start, Samples& out) const;
+
+	public slots:
+
+		/*! Handle a request to set a named parameter. Only "unthrottled"
+		 * may be set.
+		 */
+		virtual void set(QString param, QVariant data) Q_DECL_OVERRIDE;
+
+		/*! Handle a request to get a named parameter. */
+		virtual void get(QString param) Q_DECL_OVERRIDE;
+
+		/*! Handle a request to initialize the data source. */
+		virtual void initialize() Q_DECL_OVERRIDE;
+
+		/*! Handle a request to start the source's stream of data. */
+		virtual void startStream() Q_DECL_OVERRIDE;
+
+		/*! Handle a request to stop the source's stream of data. */
+		virtual void stopStream() Q_DECL_OVERRIDE;
+
+	private slots:
+		/* Generate and emit the chunks which are due. */
+		void generateData();
+
+	private:
+
+		/* Parse the specification, throwing if it is invalid. */
+		void parseSpec(const QString& spec);
+
+		/* Build the per-channel sinusoids and the spike waveform. */
+		void buildWaveforms();
+
+		/* Generate and emit the next chunk, and return it. */
+		std::shared_ptr<Samples> emitNextChunk();
+
+		/* Pack the device's status and parameters into a map. */
+		virtual QVariantMap packStatus() Q_DECL_OVERRIDE;
+
+		/* Parameters of the data, from the specification. */
+		quint32 m_seed;
+		int m_noise;
+		int m_sineAmplitude;
+		float m_spikeRate;
+		int m_spikeAmplitude;
+
+		/* One period of each channel's sinusoid, concatenated, and the
+		 * offset and length of each channel's period.
+		 */
+		std::vector<qint16> m_sineTable;
+		std::vector<int> m_sineOffsets;
+		std::vector<int> m_sinePeriods;
+
+		/* Waveform of each spike, and the interval between spikes. */
+		std::vector<qint16> m_spikeWaveform;
+		quint64 m_spikeInterval;
+
+		/* Single-shot timer used to emit new data. */
+		QTimer* m_timer;
+
+		/* Clock pacing emission at the sample rate. */
+		SampleClock m_clock;
+
+		/* Index of the next sample emitted. */
+		quint64 m_position;
+
+		/* If true, emit chunks as fast as consumers release them. */
+		bool m_unthrottled;
+
+		/* Pool from which chunks are allocated. */
+		FramePool m_pool;
+};
+
+}; // end datasource namespace
+
+#endif
+
@@ -25,9 +25,24 @@ CONFIG += c++11 debug_and_release
 
 RESOURCES += resources/resources.qrc
 
+# Generate the table of HiDens electrode positions from the electrode list
+ELECTRODE_LIST = resources/electrode-list.txt
+electrode_table.input = ELECTRODE_LIST
+electrode_table.output = build/electrode-table-data.h
+electrode_table.commands = python3 $$PWD/resources/generate-electrode-table.py \
+	${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+electrode_table.CONFIG += target_predeps no_link
+electrode_table.variable_out = GENERATED_FILES
+QMAKE_EXTRA_COMPILERS += electrode_table
+INCLUDEPATH += build
+
 DEFINES += COMPILE_LIBDATA_SOURCE
 QMAKE_CXXFLAGS += -Wno-attributes
 
+# Keep multiplies and adds separate, so that the scalar and vector
+# filter kernels round identically even where FMA is available.
+QMAKE_CXXFLAGS += -ffp-contract=off
+
 win32 {
 	CONFIG += console
 	LIBS += -Llib -lnicaiu64
@@ -40,7 +55,7 @@ linux {
 	LIBS += -L/usr/lib/x86_64-linux-gnu/hdf5/serial
 }
 LIBS += -L../libdatafile/lib \
-	-L/usr/local/lib -larmadillo -lhdf5_cpp -lhdf5
+	-L/usr/local/lib -larmadillo -lhdf5_cpp -lhdf5 -lz
 win32 {
 	LIBS += -ldatafile0
 	LIBS += -Llib -lnicaiu64 -lNIDAQmx64
@@ -54,12 +69,48 @@ CONFIG(debug, debug|release) {
 
 # Input
 HEADERS += include/configuration.h \
+		   include/sample-block.h \
+		   include/frame-ring.h \
+		   include/frame-pool.h \
+		   include/sample-clock.h \
 		   include/base-source.h \
+		   include/kernel-isa.h \
 		   include/hidens-source.h \
+		   include/hidens-convert.h \
+		   include/electrode-table.h \
 		   include/mcs-source.h \
+		   include/recording-file.h \
+		   include/chunk-cache.h \
+		   include/hdf5-chunk-reader.h \
+		   include/raw-recording-file.h \
+		   include/file-prefetcher.h \
+		   include/chunk-range.h \
 		   include/file-source.h \
+		   include/synthetic-source.h \
+		   include/recording-sink.h \
+		   include/source-stage.h \
+		   include/history-buffer.h \
+		   include/preview-stage.h \
+		   include/spike-detector.h \
+		   include/filter-stage.h \
 		   include/data-source.h
-SOURCES += src/hidens-source.cc \
+SOURCES += src/kernel-isa.cc \
+		   src/hidens-source.cc \
+		   src/hidens-convert.cc \
+		   src/electrode-table.cc \
 		   src/mcs-source.cc \
+		   src/recording-file.cc \
+		   src/chunk-cache.cc \
+		   src/hdf5-chunk-reader.cc \
+		   src/raw-recording-file.cc \
+		   src/file-prefetcher.cc \
+		   src/chunk-range.cc \
 		   src/file-source.cc \
+		   src/synthetic-source.cc \
+		   src/recording-sink.cc \
+		   src/source-stage.cc \
+		   src/history-buffer.cc \
+		   src/preview-stage.cc \
+		   src/spike-detector.cc \
+		   src/filter-stage.cc \
 		   src/data-source.cc
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""generate-electrode-table.py
+
+Generate the compile-time table of HiDens electrode positions, and the
+reverse lookup from (x, y) indices to electrode index, from the file
+electrode-list.txt.
+
+Each line of the list describes the electrode whose index is the line
+number, in the format:
+
+    <xpos> <ypos> x<x>y<y>p<label> <unused>
+
+Usage: generate-electrode-table.py <electrode-list.txt> <output.h>
+
+(C) 2017 Benjamin Naecker bnaecker@stanford.edu
+"""
+
+import re
+import sys
+
+LINE_RE = re.compile(r'^(\d+)\s+(\d+)\s+x(-?\d+)y(-?\d+)p([A-Za-z])\s+\d+$')
+
+def parse(path):
+    electrodes = []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            match = LINE_RE.match(line)
+            if match is None:
+                raise ValueError('{}:{}: malformed electrode "{}"'.format(
+                        path, lineno, line))
+            xpos, ypos, x, y, label = match.groups()
+            electrodes.append((int(xpos), int(ypos), int(x), int(y), label))
+    return electrodes
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write('Usage: {} <electrode-list.txt> <output.h>\n'.format(argv[0]))
+        return 1
+    electrodes = parse(argv[1])
+    xs = [e[2] for e in electrodes]
+    ys = [e[3] for e in electrodes]
+    xmin, ymin = min(xs), min(ys)
+    width, height = max(xs) - xmin + 1, max(ys) - ymin + 1
+
+    grid = [-1] * (width * height)
+    for index, (_, _, x, y, _) in enumerate(electrodes):
+        cell = (x - xmin) * height + (y - ymin)
+        if grid[cell] != -1:
+            raise ValueError('Electrodes {} and {} share position ({}, {})'.format(
+                    grid[cell], index, x, y))
+        grid[cell] = index
+
+    out = []
+    out.append('/* Generated by generate-electrode-table.py from electrode-list.txt.')
+    out.append(' * Do not edit.')
+    out.append(' */')
+    out.append('')
+    out.append('namespace datasource {')
+    out.append('namespace electrodetable {')
+    out.append('')
+    out.append('constexpr int Count = {};'.format(len(electrodes)))
+    out.append('constexpr int XMin = {};'.format(xmin))
+    out.append('constexpr int YMin = {};'.format(ymin))
+    out.append('constexpr int Width = {};'.format(width))
+    out.append('constexpr int Height = {};'.format(height))
+    out.append('')
+    out.append('constexpr ElectrodeRecord Records[Count] = {')
+    for xpos, ypos, x, y, label in electrodes:
+        out.append("\t{{ {}, {}, {}, {}, '{}' }},".format(xpos, ypos, x, y, label))
+    out.append('};')
+    out.append('')
+    out.append('constexpr qint16 Grid[Width * Height] = {')
+    for i in range(0, len(grid), 16):
+        out.append('\t' + ', '.join(str(v) for v in grid[i:i + 16]) + ',')
+    out.append('};')
+    out.append('')
+    out.append('}; // end electrodetable namespace')
+    out.append('}; // end datasource namespace')
+    out.append('')
+
+    with open(argv[2], 'w') as f:
+        f.write('\n'.join(out))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,130 @@
+/*! \file chunk-cache.cc
+ *
+ * Implementation of the process-wide cache of decoded chunks of recordings.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "chunk-cache.h"
+
+#include <iterator> // std::prev
+
+namespace datasource {
+
+constexpr quint64 ChunkCache::DefaultCapacity;
+
+uint qHash(const ChunkCache::Key& key, uint seed)
+{
+	return ::qHash(key.file, seed) ^ ::qHash(key.dataset, seed) ^ ::qHash(key.index, seed) ^
+			::qHash(key.size, seed) ^ ::qHash(key.modified, seed);
+}
+
+ChunkCache::ChunkCache(quint64 capacity) :
+	m_capacity(capacity),
+	m_size(0),
+	m_hits(0),
+	m_misses(0)
+{
+}
+
+ChunkCache& ChunkCache::instance()
+{
+	static ChunkCache cache;
+	return cache;
+}
+
+QByteArray ChunkCache::find(const Key& key)
+{
+	QMutexLocker lock(&m_lock);
+	auto it = m_entries.find(key);
+	if (it == m_entries.end()) {
+		m_misses++;
+		return {};
+	}
+	m_hits++;
+	m_lru.splice(m_lru.end(), m_lru, it->use);
+	return it->data;
+}
+
+void ChunkCache::insert(const Key& key, const QByteArray& data)
+{
+	QMutexLocker lock(&m_lock);
+	auto it = m_entries.find(key);
+	if (it != m_entries.end()) {
+		m_size -= it->data.size();
+		m_lru.erase(it->use);
+		m_entries.erase(it);
+	}
+	if (static_cast<quint64>(data.size()) > m_capacity) {
+		return;
+	}
+	m_lru.push_back(key);
+	m_entries.insert(key, { data, std::prev(m_lru.end()) });
+	m_size += data.size();
+	evict();
+}
+
+void ChunkCache::clear()
+{
+	QMutexLocker lock(&m_lock);
+	m_entries.clear();
+	m_lru.clear();
+	m_size = 0;
+}
+
+quint64 ChunkCache::capacity() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_capacity;
+}
+
+void ChunkCache::setCapacity(quint64 bytes)
+{
+	QMutexLocker lock(&m_lock);
+	m_capacity = bytes;
+	evict();
+}
+
+quint64 ChunkCache::size() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_size;
+}
+
+int ChunkCache::count() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_entries.size();
+}
+
+quint64 ChunkCache::hits() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_hits;
+}
+
+quint64 ChunkCache::misses() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_misses;
+}
+
+float ChunkCache::hitRate() const
+{
+	QMutexLocker lock(&m_lock);
+	const auto total = m_hits + m_misses;
+	return total ? static_cast<float>(m_hits) / total : 0.;
+}
+
+void ChunkCache::evict()
+{
+	while ((m_size > m_capacity) && !m_lru.empty()) {
+		auto it = m_entries.find(m_lru.front());
+		m_size -= it->data.size();
+		m_entries.erase(it);
+		m_lru.pop_front();
+	}
+}
+
+}; // end datasource namespace
+
@@ -0,0 +1,111 @@
+/*! \file chunk-range.cc
+ *
+ * Implementation of class reading a range of a recording synchronously.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "chunk-range.h"
+
+#include <algorithm> // std::min, std::max
+#include <stdexcept> // std::invalid_argument, std::out_of_range
+
+namespace datasource {
+
+ChunkRange::iterator& ChunkRange::iterator::operator++()
+{
+	m_index++;
+	if (m_index < m_range->size()) {
+		m_range->load(m_index);
+	}
+	return *this;
+}
+
+quint64 ChunkRange::iterator::start() const
+{
+	return m_range->m_start + m_index * m_range->m_chunkSize;
+}
+
+ChunkRange::ChunkRange(const QString& filename, quint64 start, quint64 stop,
+		quint64 chunkSize, const std::vector<int>& channels) :
+	m_start(start),
+	m_chunkSize(chunkSize)
+{
+	if (m_chunkSize == 0) {
+		throw std::invalid_argument("The chunk size must be at least one sample.");
+	}
+	m_file = RecordingFile::open(filename);
+	m_file->setReadAhead(0);
+	const auto fileChannels = m_file->nchannels();
+	for (auto channel : channels) {
+		if ((channel < 0) || (channel >= fileChannels)) {
+			throw std::invalid_argument("The requested channels are not in the file.");
+		}
+	}
+	m_stop = std::max(m_start, std::min(stop, m_file->nsamples()));
+	m_runs = RecordingFile::channelRuns(channels, fileChannels);
+	m_nchannels = channels.empty() ? fileChannels : static_cast<int>(channels.size());
+}
+
+ChunkRange::iterator ChunkRange::begin()
+{
+	if (size()) {
+		load(0);
+	}
+	return iterator(this, 0);
+}
+
+ChunkRange::iterator ChunkRange::end()
+{
+	return iterator(this, size());
+}
+
+quint64 ChunkRange::start() const
+{
+	return m_start;
+}
+
+quint64 ChunkRange::stop() const
+{
+	return m_stop;
+}
+
+quint64 ChunkRange::chunkSize() const
+{
+	return m_chunkSize;
+}
+
+quint64 ChunkRange::size() const
+{
+	const auto length = m_stop - m_start;
+	return (length == 0) ? 0 : (length - 1) / m_chunkSize + 1;
+}
+
+int ChunkRange::nchannels() const
+{
+	return m_nchannels;
+}
+
+float ChunkRange::sampleRate() const
+{
+	return m_file->sampleRate();
+}
+
+void ChunkRange::read(quint64 index, Samples& out)
+{
+	if (index >= size()) {
+		throw std::out_of_range("The requested chunk is not in the range.");
+	}
+	const auto first = m_start + index * m_chunkSize;
+	const auto last = first + std::min(m_chunkSize, m_stop - first);
+	out.set_size(last - first, m_nchannels);
+	m_file->data(m_runs, first, last, out);
+}
+
+void ChunkRange::load(quint64 index)
+{
+	read(index, m_chunk);
+}
+
+}; // end datasource namespace
+
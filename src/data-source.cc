@@ -7,8 +7,54 @@
 
 #include "data-source.h"
 
+#include <limits>
+#include <vector>
+
 namespace datasource {
 
+constexpr int BaseSource::MaxBlocksInFlight;
+
+/* Tags preceding a sample index or a time in seconds on the wire. */
+static constexpr char SampleTag = 0;
+static constexpr char SecondsTag = 1;
+
+/* Tags preceding a list of channels or a channel string on the wire. */
+static constexpr char ChannelListTag = 0;
+static constexpr char ChannelStringTag = 1;
+
+/* Serialize a sample index as a tag followed by a uint64_t, or a time in
+ * seconds as a tag followed by a double, so that each is read back as the
+ * type it was sent as.
+ */
+static QByteArray serializeSampleOrTime(const QVariant& value)
+{
+	QByteArray buffer(1 + sizeof(quint64), 0);
+	const auto type = static_cast<QMetaType::Type>(value.type());
+	if ((type == QMetaType::Float) || (type == QMetaType::Double)) {
+		double x = value.toDouble();
+		buffer[0] = SecondsTag;
+		std::memcpy(buffer.data() + 1, &x, sizeof(x));
+	} else {
+		quint64 x = value.toULongLong();
+		buffer[0] = SampleTag;
+		std::memcpy(buffer.data() + 1, &x, sizeof(x));
+	}
+	return buffer;
+}
+
+/* Deserialize a sample index or time in seconds written by serializeSampleOrTime(). */
+static QVariant deserializeSampleOrTime(const char* buffer)
+{
+	if (buffer[0] == SecondsTag) {
+		double x = 0.;
+		std::memcpy(&x, buffer + 1, sizeof(x));
+		return x;
+	}
+	quint64 x = 0;
+	std::memcpy(&x, buffer + 1, sizeof(x));
+	return x;
+}
+
 BaseSource* create(const QString& type, const QString& location, int readInterval)
 {
 	if (type == "mcs") {
@@ -21,6 +67,8 @@ BaseSource* create(const QString& type, const QString& location, int readInterva
 		return new HidensSource(location, readInterval);
 	} else if (type == "file") {
 		return new FileSource(location, readInterval);
+	} else if (type == "synthetic") {
+		return new SyntheticSource(location, readInterval);
 	} else {
 		throw std::invalid_argument("Unknown source type: " + type.toStdString());
 	}
@@ -35,18 +83,25 @@ QByteArray serialize(const QString& param, const QVariant& value)
 			(param == "device-type") ||
 			(param == "state") ||
 			(param == "location") ||
+			(param == "fpga-location") ||
+			(param == "emit-mode") ||
 			(param == "configuration-file") ){
 		/* String, serialized as UTF8 byte array. */
 		buffer = value.toByteArray();
 	} else if ( (param == "nchannels") ||
 			(param == "plug") ||
 			(param == "chip-id") ||
-			(param == "read-interval") ){
+			(param == "read-interval") ||
+			(param == "pipeline-depth") ||
+			(param == "prefetch-depth") ||
+			(param == "prefetch-hits") ||
+			(param == "prefetch-misses") ){
 		/* Unsigned integer types, serialized as uint32_t. */
 		quint32 x = value.toUInt();
 		buffer.resize(sizeof(x));
 		std::memcpy(buffer.data(), &x, sizeof(x));
-	} else if (param == "has-analog-output") {
+	} else if ( (param == "has-analog-output") ||
+			(param == "unthrottled") ){
 		/* Boolean */
 		buffer.resize(sizeof(bool));
 		auto val = value.toBool();
@@ -62,11 +117,71 @@ QByteArray serialize(const QString& param, const QVariant& value)
 		std::memcpy(buffer.data() + sizeof(size), aout.data(), size * sizeof(double));
 	} else if ( (param == "gain") ||
 			(param == "adc-range") ||
-			(param == "sample-rate") ){
+			(param == "sample-rate") ||
+			(param == "initialization-time") ||
+			(param == "playback-rate") ||
+			(param == "chunk-cache-hit-rate") ){
 		/* Floating point types. */
 		float x = value.toFloat();
 		buffer.resize(sizeof(x));
 		std::memcpy(buffer.data(), &x, sizeof(x));
+	} else if ( (param == "chunk-cache-capacity") ||
+			(param == "chunk-cache-size") ){
+		/* Size in bytes, serialized as uint64_t. */
+		quint64 x = value.toULongLong();
+		buffer.resize(sizeof(x));
+		std::memcpy(buffer.data(), &x, sizeof(x));
+	} else if (param == "position") {
+		/* Sample index or time in seconds, serialized with its type. */
+		buffer = serializeSampleOrTime(value);
+	} else if (param == "loop-range") {
+		/* Range [start, end) of sample indices or times in seconds,
+		 * serialized as the start and end, each with its type. An empty
+		 * range is serialized as no bytes at all.
+		 */
+		auto range = value.toList();
+		if (range.size() == 2) {
+			buffer = serializeSampleOrTime(range.at(0)) +
+				serializeSampleOrTime(range.at(1));
+		}
+	} else if (param == "channels") {
+		/* A list of channels is serialized as a tag, the count as uint32_t,
+		 * and each channel as uint32_t. A string such as "0-3,7", or a list
+		 * holding anything other than channel numbers, is serialized as a
+		 * tag followed by the comma-separated items in UTF-8, so that the
+		 * source parses exactly what was requested.
+		 */
+		QStringList items { value.toString() };
+		std::vector<quint32> channels;
+		bool isList = ((value.type() != QVariant::String) &&
+				(value.type() != QVariant::ByteArray) &&
+				value.canConvert<QVariantList>());
+		if (isList) {
+			items.clear();
+			for (const auto& item : value.toList()) {
+				bool ok = false;
+				auto x = item.toLongLong(&ok);
+				items << item.toString();
+				if ((item.type() == QVariant::String) || !ok || (x < 0) ||
+						(x > std::numeric_limits<quint32>::max())) {
+					isList = false;
+				} else {
+					channels.push_back(static_cast<quint32>(x));
+				}
+			}
+		}
+		if (isList) {
+			quint32 size = channels.size();
+			buffer.resize(1 + sizeof(size) * (size + 1));
+			buffer[0] = ChannelListTag;
+			std::memcpy(buffer.data() + 1, &size, sizeof(size));
+			if (size) {
+				std::memcpy(buffer.data() + 1 + sizeof(size),
+						channels.data(), sizeof(size) * size);
+			}
+		} else {
+			buffer = QByteArray(1, ChannelStringTag) + items.join(',').toUtf8();
+		}
 	} else if (param == "configuration") {
 		/* Configuration is a vector of Electrode structs. Serialize
 		 * size as uint32_t followed by raw data.
@@ -101,15 +216,26 @@ QVariant deserialize(const QString& param, const QByteArray& buffer)
 			(param == "device-type") ||
 			(param == "state") ||
 			(param == "location") ||
+			(param == "fpga-location") ||
+			(param == "emit-mode") ||
 			(param == "configuration-file") ){
 		data = buffer;
 	} else if ( (param == "nchannels") ||
 			(param == "plug") ||
 			(param == "chip-id") ||
-			(param == "read-interval") ){
+			(param == "read-interval") ||
+			(param == "pipeline-depth") ||
+			(param == "prefetch-depth") ||
+			(param == "prefetch-hits") ||
+			(param == "prefetch-misses") ){
 		quint32 x = 0;
 		std::memcpy(&x, buffer.data(), sizeof(x));
 		data = x;
+	} else if ( (param == "has-analog-output") ||
+			(param == "unthrottled") ){
+		bool x = false;
+		std::memcpy(&x, buffer.data(), sizeof(x));
+		data = x;
 	} else if (param == "analog-output") {
 		quint32 size = 0;
 		std::memcpy(&size, buffer.data(), sizeof(size));
@@ -119,10 +245,42 @@ QVariant deserialize(const QString& param, const QByteArray& buffer)
 		data = QVariant::fromValue<decltype(aout)>(aout);
 	} else if ( (param == "gain") ||
 			(param == "adc-range") ||
-			(param == "sample-rate") ){
+			(param == "sample-rate") ||
+			(param == "initialization-time") ||
+			(param == "playback-rate") ||
+			(param == "chunk-cache-hit-rate") ){
 		float x = 0.0;
 		std::memcpy(&x, buffer.data(), sizeof(x));
 		data = x;
+	} else if ( (param == "chunk-cache-capacity") ||
+			(param == "chunk-cache-size") ){
+		quint64 x = 0;
+		std::memcpy(&x, buffer.data(), sizeof(x));
+		data = x;
+	} else if (param == "position") {
+		data = deserializeSampleOrTime(buffer.data());
+	} else if (param == "loop-range") {
+		const int size = 1 + sizeof(quint64);
+		QVariantList range;
+		if (buffer.size() >= 2 * size) {
+			range << deserializeSampleOrTime(buffer.data()) <<
+				deserializeSampleOrTime(buffer.data() + size);
+		}
+		data = range;
+	} else if (param == "channels") {
+		if (buffer.startsWith(ChannelStringTag)) {
+			data = QString::fromUtf8(buffer.mid(1));
+		} else {
+			quint32 size = 0;
+			std::memcpy(&size, buffer.data() + 1, sizeof(size));
+			QVariantList list;
+			for (decltype(size) i = 0; i < size; i++) {
+				quint32 x = 0;
+				std::memcpy(&x, buffer.data() + 1 + sizeof(size) * (i + 1), sizeof(x));
+				list << x;
+			}
+			data = list;
+		}
 	} else if (param == "configuration") {
 		quint32 size = 0;
 		auto elsize = Electrode::bytesize();
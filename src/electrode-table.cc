@@ -0,0 +1,51 @@
+/*! \file electrode-table.cc
+ *
+ * Implementation of lookups into the table of HiDens electrode positions.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "electrode-table.h"
+
+/* Generated from resources/electrode-list.txt at build time. */
+#include "electrode-table-data.h"
+
+namespace datasource {
+
+int electrodeCount()
+{
+	return electrodetable::Count;
+}
+
+const ElectrodeRecord* electrodeRecord(int index)
+{
+	if ((index < 0) || (index >= electrodetable::Count)) {
+		return nullptr;
+	}
+	return &electrodetable::Records[index];
+}
+
+int electrodeIndex(int x, int y)
+{
+	x -= electrodetable::XMin;
+	y -= electrodetable::YMin;
+	if ((x < 0) || (x >= electrodetable::Width) ||
+			(y < 0) || (y >= electrodetable::Height)) {
+		return -1;
+	}
+	return electrodetable::Grid[x * electrodetable::Height + y];
+}
+
+Electrode electrodeAt(int index)
+{
+	auto* record = electrodeRecord(index);
+	if (!record) {
+		return Electrode{};
+	}
+	return Electrode(index, record->xpos, static_cast<quint16>(record->x),
+			record->ypos, static_cast<quint16>(record->y),
+			static_cast<quint8>(record->label));
+}
+
+}; // end datasource namespace
+
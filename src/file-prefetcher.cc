@@ -0,0 +1,215 @@
+/*! \file file-prefetcher.cc
+ *
+ * Implementation of class reading upcoming chunks of a data file in
+ * a background thread.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "file-prefetcher.h"
+
+#include <algorithm> // std::min
+#include <exception> // std::exception
+
+namespace datasource {
+
+constexpr int FilePrefetcher::DefaultDepth;
+constexpr int FilePrefetcher::MaxDepth;
+
+FilePrefetcher::FilePrefetcher(RecordingFile* file, QObject* parent) :
+	QThread(parent),
+	m_file(file),
+	m_fileChannels(0),
+	m_chunkSize(0),
+	m_nchannels(0),
+	m_depth(DefaultDepth),
+	m_position(0),
+	m_loopStart(0),
+	m_generation(0),
+	m_stop(false),
+	m_hits(0),
+	m_misses(0)
+{
+	m_nsamples = m_file->nsamples();
+	m_fileChannels = m_file->nchannels();
+	m_loopEnd = m_nsamples;
+	setChannels({});
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+	stopReading();
+}
+
+void FilePrefetcher::setChunkSize(quint64 nsamples)
+{
+	m_chunkSize = nsamples;
+	m_pool.reserve(m_chunkSize, m_nchannels);
+}
+
+void FilePrefetcher::setChannels(const std::vector<int>& channels)
+{
+	m_runs = RecordingFile::channelRuns(channels, m_fileChannels);
+	m_nchannels = channels.empty() ? m_fileChannels : static_cast<int>(channels.size());
+	if (m_chunkSize) {
+		m_pool.reserve(m_chunkSize, m_nchannels);
+	}
+}
+
+void FilePrefetcher::setDepth(int depth)
+{
+	QMutexLocker lock(&m_lock);
+	m_depth = std::max(1, std::min(depth, MaxDepth));
+	m_wake.wakeAll();
+}
+
+int FilePrefetcher::depth() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_depth;
+}
+
+void FilePrefetcher::startReading(quint64 position)
+{
+	stopReading();
+	m_lock.lock();
+	m_stop = false;
+	m_ready.clear();
+	m_position = position;
+	m_generation++;
+	m_lock.unlock();
+	start();
+}
+
+void FilePrefetcher::stopReading()
+{
+	m_lock.lock();
+	m_stop = true;
+	m_ready.clear();
+	m_wake.wakeAll();
+	m_lock.unlock();
+	wait();
+}
+
+void FilePrefetcher::seek(quint64 position)
+{
+	QMutexLocker lock(&m_lock);
+	m_ready.clear();
+	m_position = position;
+	m_generation++;
+	m_wake.wakeAll();
+}
+
+void FilePrefetcher::setLoopRange(quint64 start, quint64 end)
+{
+	QMutexLocker lock(&m_lock);
+	m_loopEnd = std::min(end, m_nsamples);
+	m_loopStart = std::min(start, m_loopEnd);
+	m_wake.wakeAll();
+}
+
+quint64 FilePrefetcher::loopStart() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_loopStart;
+}
+
+quint64 FilePrefetcher::loopEnd() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_loopEnd;
+}
+
+std::shared_ptr<Samples> FilePrefetcher::take(quint64* start)
+{
+	QMutexLocker lock(&m_lock);
+	if (m_ready.isEmpty()) {
+		m_misses++;
+		return nullptr;
+	}
+	m_hits++;
+	auto chunk = m_ready.dequeue();
+	m_wake.wakeAll();
+	if (start) {
+		*start = chunk.start;
+	}
+	return chunk.data;
+}
+
+quint64 FilePrefetcher::nsamples() const
+{
+	return m_nsamples;
+}
+
+quint64 FilePrefetcher::hits() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_hits;
+}
+
+quint64 FilePrefetcher::misses() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_misses;
+}
+
+void FilePrefetcher::run()
+{
+	if (m_chunkSize == 0) {
+		return;
+	}
+
+	QMutexLocker lock(&m_lock);
+	while (!m_stop) {
+		if ((m_ready.size() >= m_depth) || (m_loopStart >= m_loopEnd)) {
+			m_wake.wait(&m_lock);
+			continue;
+		}
+
+		/* Claim the next chunk, wrapping around at the end of the loop
+		 * range. A position before the range, e.g., from a seek, plays
+		 * forward into it.
+		 */
+		if (m_position >= m_loopEnd) {
+			m_position = m_loopStart;
+		}
+		const auto start = m_position;
+		const auto end = std::min(m_loopEnd, start + m_chunkSize);
+		const auto generation = m_generation;
+		m_position = end;
+
+		/* Read without holding the lock, so that the consumer never
+		 * waits on the file. A failed read stops prefetching, since later
+		 * chunks of the file can't be trusted either.
+		 */
+		lock.unlock();
+		auto chunk = m_pool.acquire(end - start, m_nchannels);
+		QString failure;
+		try {
+			m_file->data(m_runs, start, end, *chunk);
+		} catch (std::exception& e) {
+			failure = QString("Could not read samples %1 to %2 of the "
+					"data file: %3").arg(start).arg(end).arg(e.what());
+		} catch (...) {
+			failure = QString("Could not read samples %1 to %2 of the "
+					"data file.").arg(start).arg(end);
+		}
+		lock.relock();
+
+		if (!failure.isNull()) {
+			m_stop = true;
+			m_ready.clear();
+			lock.unlock();
+			emit readFailed(failure);
+			return;
+		}
+
+		/* Drop chunks read from before a seek. */
+		if ((generation == m_generation) && !m_stop) {
+			m_ready.enqueue({ start, chunk });
+		}
+	}
+}
+
+}; // end datasource namespace
+
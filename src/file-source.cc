@@ -8,78 +8,367 @@
 
 #include "file-source.h"
 
-#include "libdatafile/include/hidensfile.h"
+#include <cmath> // std::llround
+#include <limits> // std::numeric_limits
 
 namespace datasource {
 
+constexpr float FileSource::MaxPlaybackRate;
+
 FileSource::FileSource(const QString& filename, int readInterval, QObject *parent) :
 	BaseSource("file", "none", readInterval, qSNaN(), parent),
 	m_filename(filename),
-	m_currentSample(0)
+	m_currentSample(0),
+	m_playbackRate(1.),
+	m_unthrottled(false)
 {
 	if (!QFile::exists(m_filename)) {
 		throw std::invalid_argument("The requested data file does not exist.");
 	}
 	m_sourceLocation = filename;
 
+	m_gettableParameters.insert("location");
+	m_gettableParameters.insert("prefetch-depth");
+	m_settableParameters.insert("prefetch-depth");
+	m_gettableParameters.insert("playback-rate");
+	m_settableParameters.insert("playback-rate");
+	m_gettableParameters.insert("unthrottled");
+	m_settableParameters.insert("unthrottled");
+	m_gettableParameters.insert("position");
+	m_settableParameters.insert("position");
+	m_gettableParameters.insert("loop-range");
+	m_settableParameters.insert("loop-range");
+	m_gettableParameters.insert("channels");
+	m_settableParameters.insert("channels");
+	m_gettableParameters.insert("chunk-cache-capacity");
+	m_settableParameters.insert("chunk-cache-capacity");
+
 	/* 
-	 * Create file of correct runtime type. This will throw a
-	 * std::invalid_argument if the file cannot be created.
+	 * Open the file with the backend for its format. This will throw a
+	 * std::invalid_argument if the file cannot be read.
 	 */
-	m_gettableParameters.insert("location");
-	if (datafile::array(m_filename.toStdString()) == "hidens") {
-		m_datafile.reset(new hidensfile::HidensFile(m_filename.toStdString()));
+	m_datafile = RecordingFile::open(m_filename);
+	m_deviceType = m_datafile->array();
+	if (m_deviceType.startsWith("hidens")) {
 		m_gettableParameters.insert("configuration");
 		m_gettableParameters.insert("plug");
 	} else {
-		m_datafile.reset(new datafile::DataFile(m_filename.toStdString()));
 		m_gettableParameters.insert("analog-output");
 		m_gettableParameters.insert("has-analog-output");
 	}
-	m_deviceType = QByteArray::fromStdString(m_datafile->array());
+	m_prefetcher.reset(new FilePrefetcher(m_datafile.get()));
+
+	/* A failed read ends playback, since the rest of the file can't be
+	 * trusted. The failure is reported from the prefetch thread, and
+	 * handled in this source's thread.
+	 */
+	QObject::connect(m_prefetcher.get(), &FilePrefetcher::readFailed,
+			this, [this](QString msg) {
+				if (m_state == "streaming") {
+					handleError(msg);
+				}
+			}, Qt::QueuedConnection);
 
 	m_readTimer = new QTimer(this);
-	m_readTimer->setInterval(m_readInterval);
+	m_readTimer->setTimerType(Qt::PreciseTimer);
+	m_readTimer->setSingleShot(true);
 	QObject::connect(m_readTimer, &QTimer::timeout,
 			this, &FileSource::readDataFromFile);
 }
 
 FileSource::~FileSource()
 {
+	/* Stop reading before the file is closed. */
+	m_prefetcher.reset();
 }
 
 void FileSource::getSourceInfo()
 {
-
 	/* Read basic information */
 	m_sampleRate = m_datafile->sampleRate();
 	m_frameSize = static_cast<int>(static_cast<float>(m_readInterval) * m_sampleRate / 1000);
 	m_gain = m_datafile->gain();
-	m_nchannels = m_datafile->nchannels();
+	m_fileChannels = m_datafile->nchannels();
 	m_adcRange = m_datafile->offset();
+	m_prefetcher->setChunkSize(m_frameSize);
 
 	/* Read analog output */
-	if (m_datafile->analogOutputSize()) {
-		auto aout = m_datafile->analogOutput();
-		m_analogOutput.resize(aout.size());
-		std::memcpy(aout.memptr(), m_analogOutput.data(), aout.size() * sizeof(double));
-	}
+	m_analogOutput = m_datafile->analogOutput();
 
 	/* Read Hidens-specific information */
 	if (m_deviceType.startsWith("hidens")) {
 		m_plug = 0;
 		m_chipId = 1;
-		auto* p = dynamic_cast<hidensfile::HidensFile*>(m_datafile.get());
-		if (!p) {
+		m_fileConfiguration = m_datafile->configuration();
+	}
+}
+
+void FileSource::selectChannels(const std::vector<int>& channels)
+{
+	m_channels = channels;
+	if (m_channels.empty()) {
+		m_nchannels = m_fileChannels;
+		m_configuration = m_fileConfiguration;
+	} else {
+		m_nchannels = static_cast<quint32>(m_channels.size());
+		m_configuration.clear();
+		for (auto channel : m_channels) {
+			if (channel < m_fileConfiguration.size()) {
+				m_configuration.append(m_fileConfiguration.at(channel));
+			}
+		}
+	}
+	m_prefetcher->setChannels(m_channels);
+}
+
+ChunkRange FileSource::chunks(quint64 start, quint64 stop, quint64 chunkSize,
+		const QVariant& channels) const
+{
+	/* The range checks the channels against the file it opens. */
+	std::vector<int> selected;
+	if (channels.isValid() && !parseChannels(channels,
+				std::numeric_limits<int>::max(), &selected)) {
+		throw std::invalid_argument("The requested channels are invalid.");
+	}
+	return ChunkRange(m_filename, start, stop, chunkSize, selected);
+}
+
+bool FileSource::parseChannels(const QVariant& value, int nchannels, 
+		std::vector<int>* channels)
+{
+	/* Accept either a list, or a comma-separated string, of channels
+	 * and inclusive ranges of channels, such as "0-3,7".
+	 */
+	QVariantList items;
+	if ((value.type() == QVariant::String) || (value.type() == QVariant::ByteArray)) {
+		auto spec = value.toString().trimmed();
+		if (spec.isEmpty() || (spec == "all")) {
+			channels->clear();
+			return true;
+		}
+		for (const auto& item : spec.split(',')) {
+			items << item;
+		}
+	} else if (value.canConvert<QVariantList>()) {
+		items = value.toList();
+	} else {
+		return false;
+	}
+
+	std::vector<int> selected;
+	QSet<int> seen;
+	for (const auto& item : items) {
+		int first, last;
+		bool ok = true;
+		auto str = item.toString().trimmed();
+		if ((item.type() == QVariant::String) && (str.indexOf('-', 1) > 0)) {
+			bool ok2;
+			first = str.section('-', 0, 0).toInt(&ok);
+			last = str.section('-', 1).toInt(&ok2);
+			ok = ok && ok2;
+		} else {
+			first = last = item.toInt(&ok);
+		}
+		if (!ok || (first < 0) || (last < first) || (last >= nchannels)) {
+			return false;
+		}
+		for (auto channel = first; channel <= last; channel++) {
+			if (seen.contains(channel)) {
+				return false;
+			}
+			seen.insert(channel);
+			selected.push_back(channel);
+		}
+	}
+	*channels = std::move(selected);
+	return true;
+}
+
+void FileSource::set(QString param, QVariant value)
+{
+	if (!m_settableParameters.contains(param)) {
+		emit setResponse(param, false, 
+				QString("Cannot set parameter \"%1\" of a file data source.").arg(param));
+		return;
+	}
+
+	if (m_state == "invalid") {
+		emit setResponse(param, false,
+				"Can only set parameters in either 'initialized' or 'streaming' state.");
+		return;
+	}
+
+	if (param == "prefetch-depth") {
+		bool ok;
+		auto depth = value.toInt(&ok);
+		if (!ok || (depth < 1) || (depth > FilePrefetcher::MaxDepth)) {
+			emit setResponse(param, false, 
+					QString("The prefetch depth must be an integer in "
+					"the range [1, %1].").arg(FilePrefetcher::MaxDepth));
+			return;
+		}
+		m_prefetcher->setDepth(depth);
+		emit setResponse(param, true);
+
+	} else if (param == "playback-rate") {
+		bool ok;
+		auto rate = value.toFloat(&ok);
+		if (!ok || !(rate > 0.) || (rate > MaxPlaybackRate)) {
+			emit setResponse(param, false, 
+					QString("The playback rate must be a number in "
+					"the range (0, %1].").arg(MaxPlaybackRate));
+			return;
+		}
+		m_playbackRate = rate;
+		m_clock.setRate(m_playbackRate);
+		emit setResponse(param, true);
+
+	} else if (param == "unthrottled") {
+		if (!value.canConvert<bool>()) {
+			emit setResponse(param, false, "The unthrottled mode must be a boolean.");
+			return;
+		}
+		m_unthrottled = value.toBool();
+
+		/* Resume paced playback from the current position, rather than
+		 * catching up with, or waiting for, the clock.
+		 */
+		if (m_state == "streaming") {
+			m_clock.start();
+			m_readTimer->start(0);
+		}
+		emit setResponse(param, true);
+
+	} else if (param == "chunk-cache-capacity") {
+		bool ok;
+		auto capacity = value.toLongLong(&ok);
+		if (!ok || (capacity < 0)) {
+			emit setResponse(param, false, 
+					"The chunk cache capacity must be a non-negative number of bytes.");
+			return;
+		}
+		ChunkCache::instance().setCapacity(static_cast<quint64>(capacity));
+		emit setResponse(param, true);
+
+	} else if (param == "position") {
+		quint64 position;
+		if (!toSample(value, &position) || (position >= m_prefetcher->nsamples())) {
+			emit setResponse(param, false,
+					QString("The position must be a sample index, or a time "
+					"in seconds, within the file's %1 samples.").arg(
+					m_prefetcher->nsamples()));
+			return;
+		}
+		seekTo(position);
+		emit setResponse(param, true);
+
+	} else if (param == "loop-range") {
+		/* An empty range loops over the whole file. */
+		auto range = value.toList();
+		quint64 start = 0, end = m_prefetcher->nsamples();
+		if (!range.isEmpty() && ((range.size() != 2) ||
+				!toSample(range.at(0), &start) || !toSample(range.at(1), &end) ||
+				(start >= end) || (end > m_prefetcher->nsamples()))) {
+			emit setResponse(param, false,
+					QString("The loop range must be a pair [start, end) of sample "
+					"indices, or times in seconds, within the file's %1 samples.").arg(
+					m_prefetcher->nsamples()));
+			return;
+		}
+		m_prefetcher->setLoopRange(start, end);
+
+		/* Continue from the current position if it is within the new range,
+		 * and otherwise jump to its start. Either way, chunks read ahead
+		 * under the old range are discarded.
+		 */
+		seekTo(((m_currentSample >= start) && (m_currentSample < end)) ?
+				m_currentSample : start);
+		emit setResponse(param, true);
+
+	} else if (param == "channels") {
+		if (m_state != "initialized") {
+			emit setResponse(param, false,
+					"The channels can only be selected while the stream is stopped.");
+			return;
+		}
+		std::vector<int> channels;
+		if (!parseChannels(value, m_fileChannels, &channels)) {
+			emit setResponse(param, false,
+					QString("The channels must be a list of distinct channels, or "
+					"ranges of channels such as \"0-3\", within the file's %1 "
+					"channels.").arg(m_fileChannels));
 			return;
 		}
-		m_configuration = QConfiguration::fromStdVector(p->configuration());
+		selectChannels(channels);
+		emit setResponse(param, true);
+	}
+}
+
+bool FileSource::toSample(const QVariant& value, quint64* sample) const
+{
+	switch (static_cast<QMetaType::Type>(value.type())) {
+		case QMetaType::Int:
+		case QMetaType::UInt:
+		case QMetaType::Long:
+		case QMetaType::ULong:
+		case QMetaType::LongLong:
+		case QMetaType::ULongLong: {
+			if (value.toLongLong() < 0) {
+				return false;
+			}
+			*sample = value.toULongLong();
+			return true;
+		}
+		case QMetaType::Float:
+		case QMetaType::Double: {
+			auto seconds = value.toDouble();
+			if (!(seconds >= 0.)) {
+				return false;
+			}
+			*sample = static_cast<quint64>(std::llround(seconds * m_sampleRate));
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+void FileSource::seekTo(quint64 position)
+{
+	/* The clock is left running, so the next chunk is emitted when it
+	 * would have been anyway, only from the new position.
+	 */
+	m_currentSample = position;
+	if (m_state == "streaming") {
+		m_prefetcher->seek(position);
 	}
 }
 
-void FileSource::set(QString param, QVariant /* value */)
+void FileSource::get(QString param)
 {
-	emit setResponse(param, false, "Cannot set parameters of a file data source.");
+	if ((m_state != "invalid") && (param == "prefetch-depth")) {
+		emit getResponse(param, true, m_prefetcher->depth());
+		return;
+	} else if ((m_state != "invalid") && (param == "playback-rate")) {
+		emit getResponse(param, true, m_playbackRate);
+		return;
+	} else if ((m_state != "invalid") && (param == "unthrottled")) {
+		emit getResponse(param, true, m_unthrottled);
+		return;
+	} else if ((m_state != "invalid") && (param == "position")) {
+		emit getResponse(param, true, m_currentSample);
+		return;
+	} else if ((m_state != "invalid") && (param == "loop-range")) {
+		emit getResponse(param, true, loopRange());
+		return;
+	} else if ((m_state != "invalid") && (param == "channels")) {
+		emit getResponse(param, true, channelList());
+		return;
+	} else if ((m_state != "invalid") && (param == "chunk-cache-capacity")) {
+		emit getResponse(param, true, ChunkCache::instance().capacity());
+		return;
+	}
+	BaseSource::get(param);
 }
 
 void FileSource::initialize()
@@ -91,6 +380,7 @@ void FileSource::initialize()
 		success = true;
 		m_connectTime = QDateTime::currentDateTime();
 		getSourceInfo();
+		selectChannels({});
 	} else {
 		msg = "Can only initialize from the 'invalid' state.";
 		success = false;
@@ -105,7 +395,11 @@ void FileSource::startStream()
 	if (m_state == "initialized") {
 		m_state = "streaming";
 		m_startTime = QDateTime::currentDateTime();
-		m_readTimer->start();
+		m_prefetcher->startReading(m_currentSample);
+		m_clock.setSampleRate(m_sampleRate);
+		m_clock.setRate(m_playbackRate);
+		m_clock.start();
+		m_readTimer->start(m_unthrottled ? 0 : m_clock.msecsUntil(m_frameSize));
 		success = true;
 	} else {
 		msg = "Can only start stream from 'initialized' state.";
@@ -120,9 +414,11 @@ void FileSource::stopStream()
 	QString msg;
 	if (m_state == "streaming") {
 		m_readTimer->stop();
+		m_prefetcher->stopReading();
+		releaseInFlight();
 		m_state = "initialized";
 		m_startTime = {};
-		m_currentSample = 0;
+		m_currentSample = m_prefetcher->loopStart();
 		success = true;
 	} else {
 		msg = "Can only stop stream from 'streaming' state.";
@@ -131,28 +427,96 @@ void FileSource::stopStream()
 	emit streamStopped(success, msg);
 }
 
+void FileSource::handleError(const QString& msg)
+{
+	m_readTimer->stop();
+	m_prefetcher->stopReading();
+	releaseInFlight();
+	BaseSource::handleError(msg);
+}
+
 void FileSource::readDataFromFile()
 {
-	datasource::Samples s;
-	if (m_currentSample >= static_cast<decltype(m_currentSample)>(m_datafile->nsamples())) {
-		/* Wrap data around to the beginning of the file, and 
-		 * start returning that data as well.
+	if (m_unthrottled) {
+
+		/* Poll again as soon as possible while making progress, and back
+		 * off while waiting for consumers or the file.
 		 */
-		m_currentSample = 0;
+		auto emitted = emitUnthrottled([this]() { return emitNextChunk(); });
+		m_readTimer->start(emitted ? 0 : 1);
+		return;
+	}
+
+	/* Emit every chunk which the clock says is due. After a late tick,
+	 * or a chunk which was not ready in time, this catches up with the
+	 * clock, so that the stream never falls behind the true sample rate.
+	 */
+	bool ready = true;
+	while (m_clock.pending() >= static_cast<quint64>(m_frameSize)) {
+		auto frame = emitNextChunk();
+		if (!frame) {
+			ready = false;
+			break;
+		}
+		m_clock.advance(frame->n_rows);
+	}
+
+	/* Wake up when the next chunk is due, or shortly if it is late. */
+	m_readTimer->start(ready ? m_clock.msecsUntil(m_frameSize) : 1);
+}
+
+std::shared_ptr<Samples> FileSource::emitNextChunk()
+{
+	/* Hand over the next chunk, if it has been read. Otherwise the miss
+	 * is counted, and the chunk is emitted at the next tick instead.
+	 */
+	quint64 start;
+	auto frame = m_prefetcher->take(&start);
+	if (!frame) {
+		return nullptr;
 	}
-	auto endSample = std::min(
-			static_cast<decltype(m_currentSample)>(m_datafile->nsamples()),
-			m_currentSample + m_frameSize);
-	m_datafile->data(0, m_nchannels, m_currentSample, endSample, s);
-	m_currentSample += endSample - m_currentSample;
-	emit dataAvailable(s);
+
+	/* Track the position of playback, wrapping around to the start of
+	 * the loop range as the prefetcher does.
+	 */
+	m_currentSample = start + frame->n_rows;
+	if (m_currentSample >= m_prefetcher->loopEnd()) {
+		m_currentSample = m_prefetcher->loopStart();
+	}
+	publish(SampleBlock(frame));
+	return frame;
+}
+
+QVariantList FileSource::channelList() const
+{
+	QVariantList list;
+	for (quint32 i = 0; i < m_nchannels; i++) {
+		list << (m_channels.empty() ? static_cast<int>(i) : m_channels[i]);
+	}
+	return list;
+}
+
+QVariantList FileSource::loopRange() const
+{
+	return { m_prefetcher->loopStart(), m_prefetcher->loopEnd() };
 }
 
 QVariantMap FileSource::packStatus()
 {
 	auto map = BaseSource::packStatus();
 	map.insert("location", m_sourceLocation);
-	if (m_datafile->array().find("hidens") != std::string::npos) {
+	map.insert("prefetch-depth", m_prefetcher->depth());
+	map.insert("prefetch-hits", m_prefetcher->hits());
+	map.insert("prefetch-misses", m_prefetcher->misses());
+	map.insert("playback-rate", m_playbackRate);
+	map.insert("unthrottled", m_unthrottled);
+	map.insert("position", m_currentSample);
+	map.insert("loop-range", loopRange());
+	map.insert("channels", channelList());
+	map.insert("chunk-cache-capacity", ChunkCache::instance().capacity());
+	map.insert("chunk-cache-size", ChunkCache::instance().size());
+	map.insert("chunk-cache-hit-rate", ChunkCache::instance().hitRate());
+	if (m_deviceType.startsWith("hidens")) {
 		map.insert("configuration", configToJson(m_configuration));
 		map.insert("plug", m_plug);
 		map.insert("chip-id", m_chipId);
@@ -0,0 +1,365 @@
+/*! \file filter-stage.cc
+ *
+ * Implementation of classes applying an IIR filter to the data emitted
+ * by a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "filter-stage.h"
+
+#include <algorithm> // std::min, std::max, std::fill, std::find
+#include <cmath> // std::sin, std::cos, std::lrint
+#include <cstring> // std::memcpy
+#include <stdexcept> // std::invalid_argument
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define FILTER_STAGE_X86
+# include <immintrin.h>
+#endif
+
+namespace datasource {
+
+static constexpr double Pi = 3.14159265358979323846;
+
+/* Number of channels filtered side by side, and number of samples of
+ * them held in the tile at once.
+ */
+static constexpr arma::uword Lanes = 16;
+static constexpr arma::uword TileSamples = 64;
+
+/* Filter the tile through each section in turn, one channel at a time. */
+static void filterTileScalar(float* tile, arma::uword nsamples, float* state,
+		const Biquad* sections, size_t nsections)
+{
+	for (size_t s = 0; s < nsections; s++) {
+		const auto& q = sections[s];
+		auto* z1 = state + s * 2 * Lanes;
+		auto* z2 = z1 + Lanes;
+		for (arma::uword t = 0; t < nsamples; t++) {
+			auto* x = tile + t * Lanes;
+			for (arma::uword w = 0; w < Lanes; w++) {
+				const float in = x[w];
+				const float y = q.b0 * in + z1[w];
+				z1[w] = q.b1 * in - q.a1 * y + z2[w];
+				z2[w] = q.b2 * in - q.a2 * y;
+				x[w] = y;
+			}
+		}
+	}
+}
+
+#ifdef FILTER_STAGE_X86
+
+/* Filter the tile through each section in turn, 4 channels per vector. */
+__attribute__((target("sse2")))
+static void filterTileSse2(float* tile, arma::uword nsamples, float* state,
+		const Biquad* sections, size_t nsections)
+{
+	constexpr int nvectors = Lanes / 4;
+	for (size_t s = 0; s < nsections; s++) {
+		const auto& q = sections[s];
+		const auto b0 = _mm_set1_ps(q.b0), b1 = _mm_set1_ps(q.b1), b2 = _mm_set1_ps(q.b2);
+		const auto a1 = _mm_set1_ps(q.a1), a2 = _mm_set1_ps(q.a2);
+		auto* z = state + s * 2 * Lanes;
+		__m128 z1[nvectors], z2[nvectors];
+		for (int v = 0; v < nvectors; v++) {
+			z1[v] = _mm_loadu_ps(z + 4 * v);
+			z2[v] = _mm_loadu_ps(z + Lanes + 4 * v);
+		}
+		for (arma::uword t = 0; t < nsamples; t++) {
+			auto* x = tile + t * Lanes;
+			for (int v = 0; v < nvectors; v++) {
+				const auto in = _mm_loadu_ps(x + 4 * v);
+				const auto y = _mm_add_ps(_mm_mul_ps(b0, in), z1[v]);
+				z1[v] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, in), _mm_mul_ps(a1, y)), z2[v]);
+				z2[v] = _mm_sub_ps(_mm_mul_ps(b2, in), _mm_mul_ps(a2, y));
+				_mm_storeu_ps(x + 4 * v, y);
+			}
+		}
+		for (int v = 0; v < nvectors; v++) {
+			_mm_storeu_ps(z + 4 * v, z1[v]);
+			_mm_storeu_ps(z + Lanes + 4 * v, z2[v]);
+		}
+	}
+}
+
+/* Filter the tile through each section in turn, 8 channels per vector. */
+__attribute__((target("avx2")))
+static void filterTileAvx2(float* tile, arma::uword nsamples, float* state,
+		const Biquad* sections, size_t nsections)
+{
+	constexpr int nvectors = Lanes / 8;
+	for (size_t s = 0; s < nsections; s++) {
+		const auto& q = sections[s];
+		const auto b0 = _mm256_set1_ps(q.b0), b1 = _mm256_set1_ps(q.b1);
+		const auto b2 = _mm256_set1_ps(q.b2);
+		const auto a1 = _mm256_set1_ps(q.a1), a2 = _mm256_set1_ps(q.a2);
+		auto* z = state + s * 2 * Lanes;
+		__m256 z1[nvectors], z2[nvectors];
+		for (int v = 0; v < nvectors; v++) {
+			z1[v] = _mm256_loadu_ps(z + 8 * v);
+			z2[v] = _mm256_loadu_ps(z + Lanes + 8 * v);
+		}
+		for (arma::uword t = 0; t < nsamples; t++) {
+			auto* x = tile + t * Lanes;
+			for (int v = 0; v < nvectors; v++) {
+				const auto in = _mm256_loadu_ps(x + 8 * v);
+				const auto y = _mm256_add_ps(_mm256_mul_ps(b0, in), z1[v]);
+				z1[v] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, in),
+							_mm256_mul_ps(a1, y)), z2[v]);
+				z2[v] = _mm256_sub_ps(_mm256_mul_ps(b2, in), _mm256_mul_ps(a2, y));
+				_mm256_storeu_ps(x + 8 * v, y);
+			}
+		}
+		for (int v = 0; v < nvectors; v++) {
+			_mm256_storeu_ps(z + 8 * v, z1[v]);
+			_mm256_storeu_ps(z + Lanes + 8 * v, z2[v]);
+		}
+	}
+}
+
+#endif // FILTER_STAGE_X86
+
+/* Design one section of a Butterworth filter, following the RBJ
+ * audio-EQ cookbook.
+ */
+static Biquad designSection(bool highpass, double cutoff, double sampleRate, double q)
+{
+	const auto w0 = 2 * Pi * cutoff / sampleRate;
+	const auto cosw = std::cos(w0);
+	const auto alpha = std::sin(w0) / (2 * q);
+	const auto a0 = 1 + alpha;
+	const auto b = (highpass ? (1 + cosw) : (1 - cosw)) / 2;
+	return {
+		static_cast<float>(b / a0),
+		static_cast<float>((highpass ? -2 * b : 2 * b) / a0),
+		static_cast<float>(b / a0),
+		static_cast<float>(-2 * cosw / a0),
+		static_cast<float>((1 - alpha) / a0)
+	};
+}
+
+/* Design the sections of a Butterworth filter of order 2 * nsections. */
+static std::vector<Biquad> designButterworth(bool highpass, double cutoff,
+		double sampleRate, int nsections)
+{
+	if (!(cutoff > 0.) || !(cutoff < sampleRate / 2) || (nsections < 1)) {
+		throw std::invalid_argument("Filter cutoffs must be between zero "
+				"and the Nyquist frequency.");
+	}
+	std::vector<Biquad> sections;
+	const auto order = 2 * nsections;
+	for (int k = 1; k <= nsections; k++) {
+		const auto q = 1. / (2 * std::sin((2 * k - 1) * Pi / (2 * order)));
+		sections.push_back(designSection(highpass, cutoff, sampleRate, q));
+	}
+	return sections;
+}
+
+BiquadFilter::BiquadFilter(const std::vector<Biquad>& sections) :
+	m_sections(sections),
+	m_nchannels(0)
+{
+}
+
+BiquadFilter BiquadFilter::highpass(double cutoff, double sampleRate, int nsections)
+{
+	return BiquadFilter(designButterworth(true, cutoff, sampleRate, nsections));
+}
+
+BiquadFilter BiquadFilter::lowpass(double cutoff, double sampleRate, int nsections)
+{
+	return BiquadFilter(designButterworth(false, cutoff, sampleRate, nsections));
+}
+
+BiquadFilter BiquadFilter::bandpass(double low, double high, double sampleRate,
+		int nsections)
+{
+	auto sections = designButterworth(true, low, sampleRate, nsections);
+	if (high < sampleRate / 2) {
+		const auto lowpass = designButterworth(false, high, sampleRate, nsections);
+		sections.insert(sections.end(), lowpass.begin(), lowpass.end());
+	}
+	return BiquadFilter(sections);
+}
+
+const std::vector<Biquad>& BiquadFilter::sections() const
+{
+	return m_sections;
+}
+
+void BiquadFilter::reset()
+{
+	const auto ngroups = (m_nchannels + Lanes - 1) / Lanes;
+	m_state.assign(ngroups * m_sections.size() * 2 * Lanes, 0.f);
+}
+
+void BiquadFilter::apply(Samples& samples, KernelIsa isa)
+{
+	if (m_sections.empty() || samples.is_empty()) {
+		return;
+	}
+	if (samples.n_cols != m_nchannels) {
+		m_nchannels = samples.n_cols;
+		reset();
+	}
+	auto* filterTile = &filterTileScalar;
+#ifdef FILTER_STAGE_X86
+	switch (resolveKernelIsa(isa)) {
+		case KernelIsa::Avx2:
+			filterTile = &filterTileAvx2;
+			break;
+		case KernelIsa::Sse2:
+			filterTile = &filterTileSse2;
+			break;
+		default:
+			break;
+	}
+#else
+	Q_UNUSED(isa);
+#endif
+
+	/* Filter each group of channels a tile at a time. Lanes beyond the
+	 * last channel are filtered as zeros, and discarded.
+	 */
+	const auto nsamples = samples.n_rows;
+	const auto nsections = m_sections.size();
+	m_tile.resize(TileSamples * Lanes);
+	auto* tile = m_tile.data();
+	for (arma::uword c0 = 0; c0 < m_nchannels; c0 += Lanes) {
+		const auto width = std::min(Lanes, m_nchannels - c0);
+		auto* state = m_state.data() + (c0 / Lanes) * nsections * 2 * Lanes;
+		if (width < Lanes) {
+			std::fill(m_tile.begin(), m_tile.end(), 0.f);
+		}
+		for (arma::uword t0 = 0; t0 < nsamples; t0 += TileSamples) {
+			const auto n = std::min(TileSamples, nsamples - t0);
+			for (arma::uword w = 0; w < width; w++) {
+				const auto* in = samples.colptr(c0 + w) + t0;
+				for (arma::uword t = 0; t < n; t++) {
+					tile[t * Lanes + w] = in[t];
+				}
+			}
+			filterTile(tile, n, state, m_sections.data(), nsections);
+			for (arma::uword w = 0; w < width; w++) {
+				auto* out = samples.colptr(c0 + w) + t0;
+				for (arma::uword t = 0; t < n; t++) {
+					const auto y = std::min(std::max(tile[t * Lanes + w], -32768.f), 32767.f);
+					out[t] = static_cast<qint16>(std::lrint(y));
+				}
+			}
+		}
+	}
+}
+
+constexpr double FilterStage::DefaultLowCutoff;
+constexpr double FilterStage::DefaultHighCutoff;
+
+FilterStage::FilterStage(double low, double high, QObject* parent) :
+	SourceStage(parent),
+	m_low(low),
+	m_high(high),
+	m_isa(KernelIsa::Best),
+	m_designed(false)
+{
+	if (!(low > 0.) || !(high > low)) {
+		throw std::invalid_argument("The band of a filter must be positive and not empty.");
+	}
+}
+
+FilterStage::~FilterStage()
+{
+	detach();
+}
+
+void FilterStage::reset()
+{
+	m_designed = false;
+}
+
+double FilterStage::lowCutoff() const
+{
+	return m_low;
+}
+
+double FilterStage::highCutoff() const
+{
+	return m_high;
+}
+
+void FilterStage::setKernelIsa(KernelIsa isa)
+{
+	m_isa = isa;
+}
+
+void FilterStage::setChannels(const std::vector<int>& channels)
+{
+	for (size_t i = 0; i < channels.size(); i++) {
+		if ((channels[i] < 0) || (std::find(channels.begin(),
+				channels.begin() + i, channels[i]) != channels.begin() + i)) {
+			throw std::invalid_argument("The filtered channels must be "
+					"distinct and not negative.");
+		}
+	}
+	m_channels = channels;
+}
+
+std::vector<int> FilterStage::channels() const
+{
+	return m_channels;
+}
+
+void FilterStage::process(const SampleBlock& block)
+{
+	const auto& samples = block.samples();
+	if (samples.is_empty()) {
+		return;
+	}
+
+	/* Design the filter when the first block arrives. A band beyond
+	 * the Nyquist frequency of the source passes nothing through.
+	 */
+	if (!m_designed) {
+		const auto rate = sampleRate(samples.n_rows);
+		try {
+			m_filter = BiquadFilter::bandpass(m_low, m_high, rate);
+		} catch (std::invalid_argument&) {
+			m_filter = BiquadFilter({ Biquad { 0.f, 0.f, 0.f, 0.f, 0.f } });
+		}
+		m_designed = true;
+	}
+
+	auto frame = m_pool.acquire(samples.n_rows, samples.n_cols);
+	std::memcpy(frame->memptr(), samples.memptr(), samples.n_elem * sizeof(qint16));
+	if (m_channels.empty()) {
+		m_filter.apply(*frame, m_isa);
+	} else {
+
+		/* Gather the selected channels of the source, filter them, and
+		 * scatter them back over the copy of the block.
+		 */
+		arma::uword nselected = 0;
+		for (auto channel : m_channels) {
+			nselected += (static_cast<arma::uword>(channel) < samples.n_cols);
+		}
+		m_selected.set_size(samples.n_rows, nselected);
+		arma::uword column = 0;
+		for (auto channel : m_channels) {
+			if (static_cast<arma::uword>(channel) < samples.n_cols) {
+				m_selected.col(column++) = samples.col(channel);
+			}
+		}
+		m_filter.apply(m_selected, m_isa);
+		column = 0;
+		for (auto channel : m_channels) {
+			if (static_cast<arma::uword>(channel) < samples.n_cols) {
+				frame->col(channel) = m_selected.col(column++);
+			}
+		}
+	}
+	emit dataAvailable(SampleBlock(frame));
+}
+
+}; // end datasource namespace
+
@@ -0,0 +1,295 @@
+/*! \file hdf5-chunk-reader.cc
+ *
+ * Implementation of class reading compressed HDF5 recordings, decompressing
+ * chunks of the file in parallel.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "hdf5-chunk-reader.h"
+#include "recording-file.h"
+#include "chunk-cache.h"
+
+#include <zlib.h>
+
+#include <algorithm> // std::min, std::max
+#include <cstring> // std::memcpy
+
+namespace datasource {
+
+Hdf5ChunkReader::Hdf5ChunkReader(const QString& filename) :
+	m_path(QFileInfo(filename).canonicalFilePath()),
+	m_size(QFileInfo(filename).size()),
+	m_modified(QFileInfo(filename).lastModified().toMSecsSinceEpoch()),
+	m_file(-1),
+	m_dataset(-1),
+	m_nchannels(0),
+	m_nsamples(0),
+	m_chunkChannels(0),
+	m_chunkSamples(0),
+	m_rows(0),
+	m_readAhead(std::max(1, QThread::idealThreadCount()))
+{
+#if H5_VERSION_GE(1, 10, 2)
+	QMutexLocker hdf5(hdf5Mutex());
+	m_file = H5Fopen(QFile::encodeName(filename).constData(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if ((m_file < 0) || (H5Lexists(m_file, "data", H5P_DEFAULT) <= 0)) {
+		return;
+	}
+	m_dataset = H5Dopen2(m_file, "data", H5P_DEFAULT);
+	if (m_dataset < 0) {
+		return;
+	}
+
+	/* Check that the dataset holds 16-bit samples, shaped (channels, samples). */
+	auto type = H5Dget_type(m_dataset);
+	const bool isInt16 = (H5Tequal(type, H5T_NATIVE_SHORT) > 0);
+	H5Tclose(type);
+	auto space = H5Dget_space(m_dataset);
+	hsize_t dims[2] = { 0, 0 };
+	const bool isMatrix = (H5Sget_simple_extent_ndims(space) == 2);
+	if (isMatrix) {
+		H5Sget_simple_extent_dims(space, dims, nullptr);
+	}
+	H5Sclose(space);
+
+	/* Check that it is chunked and deflated, and filtered by nothing
+	 * other than shuffle and deflate. Uncompressed chunks gain nothing
+	 * from decoding in parallel, and are left to libdatafile.
+	 */
+	auto plist = H5Dget_create_plist(m_dataset);
+	hsize_t chunk[2] = { 0, 0 };
+	const bool isChunked = (H5Pget_layout(plist) == H5D_CHUNKED) &&
+			(H5Pget_chunk(plist, 2, chunk) == 2);
+	bool filtersSupported = true;
+	bool isDeflated = false;
+	const auto nfilters = H5Pget_nfilters(plist);
+	for (int i = 0; i < nfilters; i++) {
+		unsigned int flags;
+		size_t nvalues = 0;
+		auto filter = H5Pget_filter2(plist, i, &flags, &nvalues,
+				nullptr, 0, nullptr, nullptr);
+		if ((filter != H5Z_FILTER_DEFLATE) && (filter != H5Z_FILTER_SHUFFLE)) {
+			filtersSupported = false;
+		}
+		isDeflated = isDeflated || (filter == H5Z_FILTER_DEFLATE);
+		m_filters.push_back(filter);
+	}
+	H5Pclose(plist);
+
+	if (!isInt16 || !isMatrix || !isChunked || !filtersSupported || !isDeflated) {
+		H5Dclose(m_dataset);
+		m_dataset = -1;
+		return;
+	}
+	m_nchannels = dims[0];
+	m_nsamples = dims[1];
+	m_chunkChannels = chunk[0];
+	m_chunkSamples = chunk[1];
+	m_rows = (m_nchannels + m_chunkChannels - 1) / m_chunkChannels;
+#else
+	Q_UNUSED(filename);
+#endif
+}
+
+Hdf5ChunkReader::~Hdf5ChunkReader()
+{
+	/* Decompression tasks use the dataset, so let them finish first. */
+	for (auto& future : m_chunks) {
+		future.waitForFinished();
+	}
+	QMutexLocker hdf5(hdf5Mutex());
+	if (m_dataset >= 0) {
+		H5Dclose(m_dataset);
+	}
+	if (m_file >= 0) {
+		H5Fclose(m_file);
+	}
+}
+
+bool Hdf5ChunkReader::isValid() const
+{
+	return (m_dataset >= 0);
+}
+
+int Hdf5ChunkReader::readAhead() const
+{
+	return m_readAhead;
+}
+
+void Hdf5ChunkReader::setReadAhead(int columns)
+{
+	m_readAhead = std::max(0, columns);
+}
+
+bool Hdf5ChunkReader::read(int firstChannel, int lastChannel,
+		quint64 start, quint64 end, Samples& out)
+{
+	if (!isValid()) {
+		return false;
+	}
+	const auto first = static_cast<quint64>(std::max(0, firstChannel));
+	const auto last = std::min(static_cast<quint64>(std::max(0, lastChannel)), m_nchannels);
+	end = std::min(end, m_nsamples);
+	if ((first >= last) || (start >= end)) {
+		out.set_size(0, 0);
+		return true;
+	}
+	out.set_size(end - start, last - first);
+
+	/* Start decompressing every chunk needed, and those ahead of them,
+	 * before waiting on any of them.
+	 */
+	const auto firstColumn = start / m_chunkSamples;
+	const auto lastColumn = (end - 1) / m_chunkSamples;
+	const auto firstRow = first / m_chunkChannels;
+	const auto lastRow = (last - 1) / m_chunkChannels;
+	QVector<QFuture<QByteArray>> needed;
+	for (auto column = firstColumn; column <= lastColumn; column++) {
+		for (auto row = firstRow; row <= lastRow; row++) {
+			needed << chunk(column, row);
+		}
+	}
+	const auto ncolumns = (m_nsamples + m_chunkSamples - 1) / m_chunkSamples;
+	const auto readAheadEnd = std::min(ncolumns, lastColumn + 1 + m_readAhead);
+	for (auto column = lastColumn + 1; column < readAheadEnd; column++) {
+		for (auto row = firstRow; row <= lastRow; row++) {
+			chunk(column, row);
+		}
+	}
+
+	/* Copy the requested part of each chunk. Each channel of a chunk is
+	 * a contiguous run of samples, as is each column of the output.
+	 */
+	bool ok = true;
+	int i = 0;
+	for (auto column = firstColumn; column <= lastColumn; column++) {
+		const auto chunkStart = column * m_chunkSamples;
+		const auto s0 = std::max(start, chunkStart);
+		const auto s1 = std::min(end, chunkStart + m_chunkSamples);
+		for (auto row = firstRow; row <= lastRow; row++) {
+			const auto data = needed[i++].result();
+			if (data.isEmpty()) {
+				m_chunks.remove(column * m_rows + row);
+				m_lru.removeOne(column * m_rows + row);
+				ok = false;
+				continue;
+			}
+			const auto* samples = reinterpret_cast<const qint16*>(data.constData());
+			const auto chunkFirst = row * m_chunkChannels;
+			const auto c0 = std::max(first, chunkFirst);
+			const auto c1 = std::min(last, chunkFirst + m_chunkChannels);
+			for (auto c = c0; c < c1; c++) {
+				std::memcpy(out.colptr(c - first) + (s0 - start),
+						samples + (c - chunkFirst) * m_chunkSamples + (s0 - chunkStart),
+						(s1 - s0) * sizeof(qint16));
+			}
+		}
+	}
+	evict();
+	return ok;
+}
+
+QFuture<QByteArray> Hdf5ChunkReader::chunk(quint64 column, quint64 row)
+{
+	const auto index = column * m_rows + row;
+	auto it = m_chunks.find(index);
+	if (it != m_chunks.end()) {
+		m_lru.removeOne(index);
+		m_lru.append(index);
+		return *it;
+	}
+	auto future = QtConcurrent::run([this, column, row, index]() {
+				const ChunkCache::Key key { m_path, "data", index, m_size, m_modified };
+				auto data = ChunkCache::instance().find(key);
+				if (data.isNull()) {
+					data = decode(column, row);
+					if (!data.isEmpty()) {
+						ChunkCache::instance().insert(key, data);
+					}
+				}
+				return data;
+			});
+	m_chunks.insert(index, future);
+	m_lru.append(index);
+	return future;
+}
+
+QByteArray Hdf5ChunkReader::decode(quint64 column, quint64 row) const
+{
+#if H5_VERSION_GE(1, 10, 2)
+	/* Read the chunk as stored. This is the only part which holds the lock. */
+	hsize_t offset[2] = { row * m_chunkChannels, column * m_chunkSamples };
+	const auto chunkBytes = static_cast<int>(m_chunkChannels * m_chunkSamples * sizeof(qint16));
+	QByteArray data;
+	uint32_t skipped = 0;
+	{
+		QMutexLocker hdf5(hdf5Mutex());
+		hsize_t size = 0;
+		if ((H5Dget_chunk_storage_size(m_dataset, offset, &size) < 0) || (size == 0)) {
+			return {};
+		}
+		data.resize(static_cast<int>(size));
+		if (H5Dread_chunk(m_dataset, H5P_DEFAULT, offset, &skipped, data.data()) < 0) {
+			return {};
+		}
+	}
+
+	/* Undo the filters in reverse order, except any skipped for this chunk. */
+	for (auto i = static_cast<int>(m_filters.size()) - 1; i >= 0; i--) {
+		if (skipped & (1u << i)) {
+			continue;
+		}
+		QByteArray decoded(chunkBytes, Qt::Uninitialized);
+		if (m_filters[i] == H5Z_FILTER_DEFLATE) {
+			uLongf length = chunkBytes;
+			if ((uncompress(reinterpret_cast<Bytef*>(decoded.data()), &length,
+					reinterpret_cast<const Bytef*>(data.constData()), data.size()) != Z_OK) ||
+					(length != static_cast<uLongf>(chunkBytes))) {
+				return {};
+			}
+		} else {
+
+			/* Shuffling stores the low bytes of all samples, then the
+			 * high bytes. Interleave them again.
+			 */
+			if (data.size() != chunkBytes) {
+				return {};
+			}
+			const auto n = chunkBytes / 2;
+			const auto* in = data.constData();
+			auto* out = decoded.data();
+			for (int j = 0; j < n; j++) {
+				out[2 * j] = in[j];
+				out[2 * j + 1] = in[n + j];
+			}
+		}
+		data = decoded;
+	}
+	return (data.size() == chunkBytes) ? data : QByteArray();
+#else
+	Q_UNUSED(column);
+	Q_UNUSED(row);
+	return {};
+#endif
+}
+
+void Hdf5ChunkReader::evict()
+{
+	/* Keep the chunks for a couple of reads, plus those read ahead. Chunks
+	 * still being decompressed are kept, so that none outlive the reader.
+	 */
+	const auto capacity = static_cast<int>((m_readAhead + 2) * m_rows);
+	auto it = m_lru.begin();
+	while ((m_lru.size() > capacity) && (it != m_lru.end())) {
+		if (m_chunks.value(*it).isFinished()) {
+			m_chunks.remove(*it);
+			it = m_lru.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+}; // end datasource namespace
+
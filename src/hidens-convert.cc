@@ -0,0 +1,237 @@
+/*! \file hidens-convert.cc
+ *
+ * Implementation of kernels converting raw HiDens frames into samples.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "hidens-convert.h"
+
+#include <algorithm> // std::min
+#include <array>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HIDENS_CONVERT_X86
+# include <immintrin.h>
+#endif
+
+namespace datasource {
+
+/* Number of frames, and of channels, in each block transposed by
+ * the vectorized kernels.
+ */
+static constexpr int BlockSize = 16;
+
+/* Convert the photodiode signal of a range of frames, into the
+ * last of `ncolumns` output columns.
+ */
+static inline void convertPhotodiode(const uchar* in, arma::uword first, 
+		arma::uword last, arma::uword nframes, int ncolumns, qint16* out)
+{
+	auto* photodiode = out + (ncolumns - 1) * nframes;
+	for (auto f = first; f < last; f++) {
+		photodiode[f] = (in[f * HidensFrameBytes + HidensPhotodiodeByte] &
+				HidensPhotodiodeMask) ? -255 : 0;
+	}
+}
+
+/* Convert a range of frames, one value at a time. */
+static void convertScalar(const uchar* in, arma::uword first, arma::uword last, 
+		arma::uword nframes, const int* columns, int ncolumns, qint16* out)
+{
+	for (auto f = first; f < last; f++) {
+		const auto* frame = in + f * HidensFrameBytes;
+		for (int c = 0; c < HidensDataChannels; c++) {
+			if (columns[c] >= 0) {
+				out[columns[c] * nframes + f] = -static_cast<qint16>(frame[c]);
+			}
+		}
+	}
+	convertPhotodiode(in, first, last, nframes, ncolumns, out);
+}
+
+#ifdef HIDENS_CONVERT_X86
+
+/* Transpose a 16x16 block of bytes held in 16 registers, in place.
+ *
+ * On entry, each register holds 16 consecutive channels from one frame.
+ * On exit, each register holds 16 consecutive frames from one channel.
+ * This interleaves pairs of registers at successively wider granularity:
+ * bytes, then 2-, 4- and 8-byte units.
+ */
+__attribute__((target("sse2")))
+static inline void transposeSse2(__m128i* r)
+{
+	__m128i a[BlockSize], b[BlockSize];
+	for (int i = 0; i < 8; i++) {
+		a[i] = _mm_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+		a[i + 8] = _mm_unpackhi_epi8(r[2 * i], r[2 * i + 1]);
+	}
+	for (int h = 0; h < 2; h++) {
+		for (int k = 0; k < 4; k++) {
+			b[h * 8 + k] = _mm_unpacklo_epi16(a[h * 8 + 2 * k], a[h * 8 + 2 * k + 1]);
+			b[h * 8 + k + 4] = _mm_unpackhi_epi16(a[h * 8 + 2 * k], a[h * 8 + 2 * k + 1]);
+		}
+	}
+	for (int g = 0; g < 4; g++) {
+		for (int m = 0; m < 2; m++) {
+			a[g * 4 + m] = _mm_unpacklo_epi32(b[g * 4 + 2 * m], b[g * 4 + 2 * m + 1]);
+			a[g * 4 + m + 2] = _mm_unpackhi_epi32(b[g * 4 + 2 * m], b[g * 4 + 2 * m + 1]);
+		}
+	}
+	for (int p = 0; p < 8; p++) {
+		r[2 * p] = _mm_unpacklo_epi64(a[2 * p], a[2 * p + 1]);
+		r[2 * p + 1] = _mm_unpackhi_epi64(a[2 * p], a[2 * p + 1]);
+	}
+}
+
+/* Transpose two 16x16 blocks of bytes, one in each 128-bit lane of
+ * 16 registers. This is identical to transposeSse2(), as the unpack
+ * instructions operate independently within each lane.
+ */
+__attribute__((target("avx2")))
+static inline void transposeAvx2(__m256i* r)
+{
+	__m256i a[BlockSize], b[BlockSize];
+	for (int i = 0; i < 8; i++) {
+		a[i] = _mm256_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+		a[i + 8] = _mm256_unpackhi_epi8(r[2 * i], r[2 * i + 1]);
+	}
+	for (int h = 0; h < 2; h++) {
+		for (int k = 0; k < 4; k++) {
+			b[h * 8 + k] = _mm256_unpacklo_epi16(a[h * 8 + 2 * k], a[h * 8 + 2 * k + 1]);
+			b[h * 8 + k + 4] = _mm256_unpackhi_epi16(a[h * 8 + 2 * k], a[h * 8 + 2 * k + 1]);
+		}
+	}
+	for (int g = 0; g < 4; g++) {
+		for (int m = 0; m < 2; m++) {
+			a[g * 4 + m] = _mm256_unpacklo_epi32(b[g * 4 + 2 * m], b[g * 4 + 2 * m + 1]);
+			a[g * 4 + m + 2] = _mm256_unpackhi_epi32(b[g * 4 + 2 * m], b[g * 4 + 2 * m + 1]);
+		}
+	}
+	for (int p = 0; p < 8; p++) {
+		r[2 * p] = _mm256_unpacklo_epi64(a[2 * p], a[2 * p + 1]);
+		r[2 * p + 1] = _mm256_unpackhi_epi64(a[2 * p], a[2 * p + 1]);
+	}
+}
+
+/* Widen 16 frames of one channel to int16, invert and store them. */
+__attribute__((target("sse2")))
+static inline void storeChannelSse2(__m128i v, qint16* out)
+{
+	const auto zero = _mm_setzero_si128();
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+			_mm_sub_epi16(zero, _mm_unpacklo_epi8(v, zero)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8),
+			_mm_sub_epi16(zero, _mm_unpackhi_epi8(v, zero)));
+}
+
+/* Convert frames in blocks of 16 frames by 16 channels. Every block is
+ * transposed, but only the channels mapped to an output column are stored.
+ */
+__attribute__((target("sse2")))
+static void convertSse2(const uchar* in, arma::uword nframes, 
+		const int* columns, int ncolumns, qint16* out)
+{
+	const auto nblocks = nframes / BlockSize;
+	for (arma::uword block = 0; block < nblocks; block++) {
+		const auto f0 = block * BlockSize;
+		for (int c = 0; c < HidensDataChannels; c += BlockSize) {
+
+			/* The last block overlaps the previous one, so that all
+			 * loads stay inside the data channels of each frame.
+			 */
+			const auto c0 = std::min(c, HidensDataChannels - BlockSize);
+			__m128i r[BlockSize];
+			for (int i = 0; i < BlockSize; i++) {
+				r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+						in + (f0 + i) * HidensFrameBytes + c0));
+			}
+			transposeSse2(r);
+			for (int i = 0; i < BlockSize; i++) {
+				if (columns[c0 + i] >= 0) {
+					storeChannelSse2(r[i], out + columns[c0 + i] * nframes + f0);
+				}
+			}
+		}
+		convertPhotodiode(in, f0, f0 + BlockSize, nframes, ncolumns, out);
+	}
+	convertScalar(in, nblocks * BlockSize, nframes, nframes, columns, ncolumns, out);
+}
+
+/* Convert frames in blocks of 16 frames by 32 channels, each 128-bit
+ * lane of the registers transposing 16 channels.
+ */
+__attribute__((target("avx2")))
+static void convertAvx2(const uchar* in, arma::uword nframes, 
+		const int* columns, int ncolumns, qint16* out)
+{
+	const int width = 2 * BlockSize;
+	const auto zero = _mm256_setzero_si256();
+	const auto nblocks = nframes / BlockSize;
+	for (arma::uword block = 0; block < nblocks; block++) {
+		const auto f0 = block * BlockSize;
+		for (int c = 0; c < HidensDataChannels; c += width) {
+			const auto c0 = std::min(c, HidensDataChannels - width);
+			__m256i r[BlockSize];
+			for (int i = 0; i < BlockSize; i++) {
+				r[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+						in + (f0 + i) * HidensFrameBytes + c0));
+			}
+			transposeAvx2(r);
+			for (int i = 0; i < BlockSize; i++) {
+				const auto lo = columns[c0 + i];
+				const auto hi = columns[c0 + BlockSize + i];
+				if (lo >= 0) {
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + lo * nframes + f0),
+							_mm256_sub_epi16(zero, _mm256_cvtepu8_epi16(
+							_mm256_castsi256_si128(r[i]))));
+				}
+				if (hi >= 0) {
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + hi * nframes + f0),
+							_mm256_sub_epi16(zero, _mm256_cvtepu8_epi16(
+							_mm256_extracti128_si256(r[i], 1))));
+				}
+			}
+		}
+		convertPhotodiode(in, f0, f0 + BlockSize, nframes, ncolumns, out);
+	}
+	convertScalar(in, nblocks * BlockSize, nframes, nframes, columns, ncolumns, out);
+}
+
+#endif // HIDENS_CONVERT_X86
+
+void convertHidensFrames(const uchar* in, arma::uword nframes,
+		qint16* out, KernelIsa isa)
+{
+	static const auto identity = [] {
+		std::array<int, HidensDataChannels> columns;
+		for (int c = 0; c < HidensDataChannels; c++) {
+			columns[c] = c;
+		}
+		return columns;
+	}();
+	convertHidensFrames(in, nframes, identity.data(), 
+			HidensEmittedChannels, out, isa);
+}
+
+void convertHidensFrames(const uchar* in, arma::uword nframes,
+		const int* columns, int ncolumns, qint16* out, KernelIsa isa)
+{
+	switch (resolveKernelIsa(isa)) {
+#ifdef HIDENS_CONVERT_X86
+		case KernelIsa::Avx2:
+			convertAvx2(in, nframes, columns, ncolumns, out);
+			break;
+		case KernelIsa::Sse2:
+			convertSse2(in, nframes, columns, ncolumns, out);
+			break;
+#endif
+		default:
+			convertScalar(in, 0, nframes, nframes, columns, ncolumns, out);
+			break;
+	}
+}
+
+}; // end datasource namespace
+
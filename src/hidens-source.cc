@@ -7,17 +7,30 @@
  */
 
 #include "hidens-source.h"
+#include "hidens-convert.h"
+#include "electrode-table.h"
 
-#include <algorithm> 	// for std::for_each
+#include <algorithm> 	// for std::max, std::min
 #include <cmath>		// std::isnan
+#include <memory>	// std::make_shared
 
 namespace datasource {
 
+constexpr int HidensSource::DefaultPipelineDepth;
+constexpr int HidensSource::MaxPipelineDepth;
+
 HidensSource::HidensSource(const QString& addr, int readInterval, QObject *parent) :
 	BaseSource("hidens", "hidens", readInterval, SampleRate, parent),
-	m_addr(addr),
-	m_port(HidensPort),
-	m_electrodeIndices(m_hidensFrameSize)
+	m_fpgaAddr(FpgaAddr),
+	m_fpgaPort(FpgaPort),
+	m_electrodeIndices(m_hidensFrameSize),
+	m_pipelineDepth(DefaultPipelineDepth),
+	m_outstandingRequests(0),
+	m_commandsSent(0),
+	m_bareCommandSent(false),
+	m_flushing(false),
+	m_flushBytes(0),
+	m_initializationTime(qQNaN())
 {
 	/* -1 corresponds to invalid channels. */
 	m_electrodeIndices.fill(-1);
@@ -25,7 +38,7 @@ HidensSource::HidensSource(const QString& addr, int readInterval, QObject *paren
 	/* The photodiode channel (last) is always valid. */
 	m_electrodeIndices(m_hidensFrameSize - 1) = 1;
 
-	/* Set sizes of acquisition and emission buffers.
+	/* Set sizes of acquisition buffer and emitted frames.
 	 * NOTE: Data is transposed between receipt and emission,
 	 * as well as converted from uint8_t to int16_t.
 	 */
@@ -33,14 +46,32 @@ HidensSource::HidensSource(const QString& addr, int readInterval, QObject *paren
 	m_acqBuffer.set_size(m_hidensFrameSize, 
 			static_cast<int>(m_sampleRate * 
 			static_cast<float>(m_readInterval) / 1000.));
-	m_emitBuffer.set_size(static_cast<int>(m_sampleRate *
-			static_cast<float>(m_readInterval) / 1000.),
-			m_nchannels);
+	m_emitMode = "full";
+	m_channelColumns.resize(m_nDataChannels);
+	updateChannelMap();
 
 	/* Setup source location and socket for connecting to ThreadedServer. */
+	if (!parseLocation(addr, HidensPort, m_addr, m_port)) {
+		m_addr = addr;
+		m_port = HidensPort;
+	}
 	m_sourceLocation = addr;
 	m_socket = new QTcpSocket(this);
 
+	/* Fail commands which are not answered in time. */
+	m_commandTimer.setSingleShot(true);
+	m_commandTimer.setInterval(RequestWaitTime);
+	QObject::connect(&m_commandTimer, &QTimer::timeout,
+			this, &HidensSource::handleCommandTimeout);
+
+	/* Give up on stale data which never arrives after stopping. */
+	m_flushTimer.setSingleShot(true);
+	QObject::connect(&m_flushTimer, &QTimer::timeout, this, [this]() {
+				m_socket->readAll();
+				m_flushBytes = 0;
+				flushStream();
+			});
+
 	/* Add valid gettable/settable parameters for a HiDens data source. */
 	m_gettableParameters.insert("configuration");
 	m_settableParameters.insert("configuration");
@@ -48,6 +79,12 @@ HidensSource::HidensSource(const QString& addr, int readInterval, QObject *paren
 	m_settableParameters.insert("configuration-file");
 	m_gettableParameters.insert("plug");
 	m_settableParameters.insert("plug");
+	m_gettableParameters.insert("pipeline-depth");
+	m_settableParameters.insert("pipeline-depth");
+	m_gettableParameters.insert("fpga-location");
+	m_settableParameters.insert("fpga-location");
+	m_gettableParameters.insert("emit-mode");
+	m_settableParameters.insert("emit-mode");
 }
 
 HidensSource::~HidensSource()
@@ -65,6 +102,7 @@ void HidensSource::initialize()
 		QObject::connect(m_socket, 
 				static_cast<void(QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error),
 				this, [&] { handleConnectionMade(false); });
+		m_initializationTimer.start();
 		m_socket->connectToHost(m_addr, m_port);
 	} else {
 		emit initialized(false, "Can only initialize from 'invalid' state.");
@@ -94,10 +132,16 @@ void HidensSource::startStream()
 		}
 		m_state = "streaming";
 
-		/* Connect function for reading data and request first chunk. */
+		/* Connect function for reading data and request the first chunks.
+		 * The first request starts from live data, and the remainder keep
+		 * the pipeline full, so that the server always has a request to
+		 * answer as soon as the next chunk is acquired.
+		 */
 		QObject::connect(m_socket, &QTcpSocket::readyRead,
 				this, &HidensSource::recvDataFrame);
 		requestData("live");
+		m_outstandingRequests = 1;
+		fillPipeline();
 
 		valid = true;
 	} else {
@@ -120,12 +164,17 @@ void HidensSource::stopStream()
 	
 		/* Flush remaning data.
 		 *
-		 * After the read interval, call the functor below, flushing
-		 * the socket.
+		 * Discard the answers to all outstanding requests as they arrive.
+		 * Commands queued in the meantime are held back, so that their
+		 * replies are not confused with stale data. If the server does not
+		 * answer every request, the socket is flushed after a timeout.
 		 */
-		QTimer::singleShot(m_readInterval, [this]() -> void {
-				m_socket->readAll();
-			});
+		m_flushing = true;
+		m_flushBytes = static_cast<qint64>(m_outstandingRequests) * m_bytesPerEmitFrame;
+		m_flushTimer.start(m_readInterval * std::max(m_outstandingRequests, 1) +
+				RequestWaitTime);
+		m_outstandingRequests = 0;
+		flushStream();
 
 		valid = true;
 	} else {
@@ -148,38 +197,94 @@ void HidensSource::set(QString param, QVariant value)
 		return;
 	}
 
-	if (param == "plug") {
+	if (param == "pipeline-depth") {
 		bool ok;
-		auto plug = value.toUInt(&ok);
-		if (!ok || (plug > 4) ) {
-			m_plug = -1;
+		auto depth = value.toInt(&ok);
+		if (!ok || (depth < 1) || (depth > MaxPipelineDepth)) {
 			emit setResponse(param, false, 
-					"The plug value was not an integer or outside the allowed range [0, 4].");
+					QString("The pipeline depth must be an integer in "
+					"the range [1, %1].").arg(MaxPipelineDepth));
 			return;
 		}
-		askHidens("select " + QByteArray::number(plug));
-		if (!verifyReply(getHidensReply())) {
-			m_plug = -1;
-			emit setResponse(param, false, "The requested plug does not contain a chip.");
+		m_pipelineDepth = depth;
+		emit setResponse(param, true);
+		return;
+
+	} else if (param == "emit-mode") {
+		auto mode = value.toString();
+		if ((mode != "full") && (mode != "connected")) {
+			emit setResponse(param, false, 
+					"The emit mode must be one of \"full\" or \"connected\".");
 			return;
 		}
+		m_emitMode = mode;
+		updateChannelMap();
+		if (!m_configuration.isEmpty()) {
+			buildConfiguration();
+		}
+		emit setResponse(param, true);
+		return;
 
-		/* Verify a chip is plugged in to the requested slot */
-		askHidens("id");
-		auto reply = getHidensReply();
-		auto id = reply.toUInt(&ok);
-		if (!ok || (id == 65535)) {
-			emit setResponse(param, false, "The chip in the requested plug appears invalid.");
+	} else if (param == "fpga-location") {
+		QString addr;
+		quint16 port;
+		if (!parseLocation(value.toString(), FpgaPort, addr, port)) {
+			emit setResponse(param, false, 
+					"The FPGA location must be given as \"host[:port]\".");
 			return;
 		}
-		
-		/* Valid plug number and valid chip id in that plug. */
-		m_plug = plug;
-		m_chipId = id;
+		m_fpgaAddr = addr;
+		m_fpgaPort = port;
 		emit setResponse(param, true);
+		return;
 
-		/* Get configuration for the connected chip */
-		getConfigurationFromServer();
+	} else if (param == "plug") {
+		bool ok;
+		auto plug = value.toUInt(&ok);
+		if (!ok || (plug > 4) ) {
+			m_plug = -1;
+			emit setResponse(param, false, 
+					"The plug value was not an integer or outside the allowed range [0, 4].");
+			return;
+		}
+
+		/* Select the plug, and verify a chip is plugged in to it. The
+		 * chip is only identified once the plug has been selected, and
+		 * a failed selection, including one which timed out, is answered
+		 * at once.
+		 */
+		sendCommand("select " + QByteArray::number(plug),
+				[this, param, plug](bool ok, const QList<QByteArray>&) {
+			if (!ok) {
+				m_plug = -1;
+				emit setResponse(param, false, 
+						"The requested plug does not contain a chip.");
+				return;
+			}
+			sendCommand("id", [this, param, plug]
+					(bool ok, const QList<QByteArray>& reply) {
+						if (!ok) {
+							m_plug = -1;
+							emit setResponse(param, false, 
+									"Could not identify the chip in the requested plug.");
+							return;
+						}
+						auto id = reply.value(0).toUInt(&ok);
+						if (!ok || (id == 65535)) {
+							emit setResponse(param, false, 
+									"The chip in the requested plug appears invalid.");
+							return;
+						}
+
+						/* Valid plug number and valid chip id in that plug. */
+						m_plug = plug;
+						m_chipId = id;
+						emit setResponse(param, true);
+
+						/* Get configuration for the connected chip */
+						getConfigurationFromServer();
+					});
+		});
 		return;
 
 	} else if (param == "configuration") {
@@ -211,7 +316,7 @@ void HidensSource::set(QString param, QVariant value)
 		}
 
 		m_configFuture = QtConcurrent::run(sendConfigToFpga, 
-				m_configurationFile, FpgaAddr, FpgaPort);
+				m_configurationFile, m_fpgaAddr, m_fpgaPort);
 		m_configWatcher.setFuture(m_configFuture);
 		QObject::connect(&m_configWatcher, 
 				&decltype(m_configWatcher)::finished,
@@ -222,76 +327,84 @@ void HidensSource::set(QString param, QVariant value)
 	}
 }
 
+void HidensSource::get(QString param)
+{
+	if ((m_state != "invalid") && (param == "pipeline-depth")) {
+		emit getResponse(param, true, m_pipelineDepth);
+		return;
+	} else if ((m_state != "invalid") && (param == "emit-mode")) {
+		emit getResponse(param, true, m_emitMode);
+		return;
+	} else if ((m_state != "invalid") && (param == "fpga-location")) {
+		emit getResponse(param, true, 
+				QString("%1:%2").arg(m_fpgaAddr).arg(m_fpgaPort));
+		return;
+	}
+	BaseSource::get(param);
+}
+
 void HidensSource::handleConnectionMade(bool made)
 {
 	QObject::disconnect(m_socket, 0, 0, 0);
 	if (made) {
 
-		/* Set some communication parameters */
-		askHidens("setbytes " + QByteArray::number(m_hidensFrameSize));
-		if (!verifyReply(getHidensReply())) {
-			m_socket->disconnectFromHost();
-			emit initialized(false, "Error initializing communication with HiDens data server.");
-			return;
-		}
-
-		askHidens("header_frameno off");
-		if (!verifyReply(getHidensReply())) {
-			m_socket->disconnectFromHost();
-			emit initialized(false, "Error initializing communication with HiDens data server.");
-			return;
-		}
-
-		askHidens("client_name blds");
-		if (!verifyReply(getHidensReply())) {
-			m_socket->disconnectFromHost();
-			emit initialized(false, "Error initializing communication with HiDens data server.");
-			return;
-		}
-
-		askHidens("sr");
-		auto reply = getHidensReply();
-		bool ok;
-		m_sampleRate = reply.toFloat(&ok);
-		if (!ok) {
-			m_socket->disconnectFromHost();
-			QString msg { "Could not retrieve sampling rate from HiDens server. "
-					"Make sure the server is running and a chip is plugged into the Neurolizer." };
-			emit initialized(false, msg);
-			return;
-		}
-
-		askHidens("gain 0");
-		reply = getHidensReply();
-		auto gain = reply.toFloat(&ok);
-		if (!ok) {
-			m_socket->disconnectFromHost();
-			QString msg { "Could not retrieve gain from HiDens server. "
-					"Make sure the server is running and a chip is plugged into the Neurolizer." };
-			emit initialized(false, msg);
-			return;
-		}
-		m_deviceGain = gain;
+		QObject::connect(m_socket, &QTcpSocket::readyRead,
+				this, &HidensSource::handleCommandReply);
 
-		askHidens("adc_range");
-		reply = getHidensReply();
-		auto adcRange = reply.toFloat(&ok);
-		if (!ok) {
-			m_socket->disconnectFromHost();
-			QString msg { "Could not retrieve ADC range from HiDens server. "
-					"Make sure the server is running and a chip is plugged into the Neurolizer." };
-			emit initialized(false, msg);
-			return;
-		}
-		m_adcRange = adcRange;
-		m_gain = m_adcRange / static_cast<float>(1 << 8) / m_deviceGain;
+		/* Set some communication parameters.
+		 *
+		 * The whole handshake is queued at once, and so is sent to the
+		 * server in a single write. The replies are parsed in order as
+		 * they arrive.
+		 */
+		auto verify = [this](bool ok, const QList<QByteArray>&) {
+			if (!ok) {
+				failInitialization("Error initializing communication with HiDens data server.");
+			}
+		};
+		sendCommand("setbytes " + QByteArray::number(m_hidensFrameSize), verify);
+		sendCommand("header_frameno off", verify);
+		sendCommand("client_name blds", verify);
+
+		/* Query the device parameters. Each reply must be a single number. */
+		sendCommand("sr", [this](bool ok, const QList<QByteArray>& reply) {
+			auto rate = ok ? reply.value(0).toFloat(&ok) : 0.f;
+			if (!ok) {
+				failInitialization("Could not retrieve sampling rate from HiDens server. "
+						"Make sure the server is running and a chip is plugged into the Neurolizer.");
+				return;
+			}
+			m_sampleRate = rate;
+		});
+
+		sendCommand("gain 0", [this](bool ok, const QList<QByteArray>& reply) {
+			auto gain = ok ? reply.value(0).toFloat(&ok) : 0.f;
+			if (!ok) {
+				failInitialization("Could not retrieve gain from HiDens server. "
+						"Make sure the server is running and a chip is plugged into the Neurolizer.");
+				return;
+			}
+			m_deviceGain = gain;
+		});
+
+		sendCommand("adc_range", [this](bool ok, const QList<QByteArray>& reply) {
+			auto adcRange = ok ? reply.value(0).toFloat(&ok) : 0.f;
+			if (!ok) {
+				failInitialization("Could not retrieve ADC range from HiDens server. "
+						"Make sure the server is running and a chip is plugged into the Neurolizer.");
+				return;
+			}
+			m_adcRange = adcRange;
+			m_gain = m_adcRange / static_cast<float>(1 << 8) / m_deviceGain;
 
-		QObject::connect(m_socket, &QAbstractSocket::disconnected,
-				this, &HidensSource::handleDisconnect);
+			QObject::connect(m_socket, &QAbstractSocket::disconnected,
+					this, &HidensSource::handleDisconnect);
 
-		m_state = "initialized";
-		m_connectTime = QDateTime::currentDateTime();
-		emit initialized(true);
+			m_state = "initialized";
+			m_connectTime = QDateTime::currentDateTime();
+			m_initializationTime = m_initializationTimer.nsecsElapsed() / 1e6;
+			emit initialized(true);
+		});
 
 	} else {
 		qDebug() << "Could not connect to HiDens data server.";
@@ -306,33 +419,159 @@ void HidensSource::handleDisconnect()
 	handleError("Unexpectedly disconnected from HiDens data server.");
 }
 
-void HidensSource::askHidens(const QByteArray& cmd)
+void HidensSource::askHidens(const QByteArray& request)
 {
 	qint64 nwritten = 0;
 	do {
-		auto tmp = m_socket->write(cmd.data() + nwritten, cmd.size() - nwritten);
+		auto tmp = m_socket->write(request.data() + nwritten, request.size() - nwritten);
 		if (tmp == -1) {
 			QObject::disconnect(m_socket, 0, 0, 0);
 			m_socket->disconnectFromHost();
 			handleError("Error sending request to HiDens data server.");
+			return;
 		} else {
 			nwritten += tmp;
 		}
-	} while (nwritten < cmd.size());
+	} while (nwritten < request.size());
+}
+
+void HidensSource::sendCommand(const QByteArray& request,
+		ReplyParser complete, ReplyCallback callback)
+{
+	m_commands.enqueue(Command{ request, complete, callback });
+
+	/* Commands queued together, e.g., by a single slot, are sent
+	 * together once control returns to the event loop.
+	 */
+	if (m_commands.size() == m_commandsSent + 1) {
+		QTimer::singleShot(0, this, &HidensSource::sendCommands);
+	}
+}
+
+void HidensSource::sendCommand(const QByteArray& request, ReplyCallback callback)
+{
+	sendCommand(request, expectLines(1), callback);
+}
+
+HidensSource::ReplyParser HidensSource::expectLines(int nlines)
+{
+	return [nlines](const QList<QByteArray>& reply) -> bool {
+		return (reply.size() >= nlines) || 
+			(!reply.isEmpty() && reply.first().startsWith("Error"));
+	};
 }
 
-QByteArray HidensSource::getHidensReply()
+void HidensSource::sendCommands()
 {
-	QByteArray reply;
-	if (!m_socket->waitForReadyRead(RequestWaitTime)) {
-		handleError("Communication with the HiDens data server timed out.");
+	if (m_flushing || m_bareCommandSent || 
+			(m_commandsSent == m_commands.size()) || 
+			(m_state == "streaming")) {
+		return;
+	}
+	QByteArrayList requests;
+	for (auto i = m_commandsSent; i < m_commands.size(); i++) {
+		requests << m_commands.at(i).request;
+	}
+	if (m_commandsSent == 0) {
+		m_replyLines.clear();
+		m_commandTimer.start();
+	}
+	m_bareCommandSent = (m_commandsSent == 0) && (requests.size() == 1);
+	m_commandsSent = m_commands.size();
+	if (m_bareCommandSent) {
+		askHidens(requests.first());
 	} else {
-		reply = m_socket->readLine();
-		if (reply.endsWith('\n')) {
-			reply.chop(1);
+		askHidens(requests.join('\n') + '\n');
+	}
+}
+
+void HidensSource::handleCommandReply()
+{
+	/* Data received while streaming is handled by recvDataFrame(). */
+	if (m_state == "streaming") {
+		return;
+	}
+	if (m_flushing) {
+		flushStream();
+		return;
+	}
+
+	while (m_commandsSent && m_socket->canReadLine()) {
+		auto line = m_socket->readLine();
+		if (line.endsWith('\n')) {
+			line.chop(1);
+		}
+		m_replyLines << line;
+		if (!m_commands.head().complete(m_replyLines)) {
+			continue;
 		}
+
+		/* Reply to the oldest command is complete. Remove the command
+		 * before running its callback, which may queue further commands,
+		 * and give the next command a full timeout from now.
+		 */
+		auto command = m_commands.dequeue();
+		auto reply = m_replyLines;
+		m_replyLines.clear();
+		m_commandsSent--;
+		if (m_commandsSent) {
+			m_commandTimer.start();
+		} else {
+			m_commandTimer.stop();
+			m_bareCommandSent = false;
+		}
+		command.callback(verifyReply(reply.first()), reply);
+	}
+
+	/* Send any commands held back while a bare command was answered. */
+	if (!m_commandsSent) {
+		sendCommands();
 	}
-	return reply;
+}
+
+void HidensSource::flushStream()
+{
+	if (!m_flushing) {
+		return;
+	}
+	auto nread = m_socket->read(std::min(m_socket->bytesAvailable(), m_flushBytes)).size();
+	m_flushBytes -= nread;
+	if (m_flushBytes == 0) {
+		m_flushTimer.stop();
+		m_flushing = false;
+		sendCommands();
+	}
+}
+
+void HidensSource::handleCommandTimeout()
+{
+	if (!m_commandsSent) {
+		return;
+	}
+	auto command = m_commands.dequeue();
+	clearCommands();
+	command.callback(false, {});
+	handleError("Communication with the HiDens data server timed out.");
+}
+
+void HidensSource::clearCommands()
+{
+	m_flushTimer.stop();
+	m_flushing = false;
+	m_flushBytes = 0;
+	m_commandTimer.stop();
+	m_commands.clear();
+	m_replyLines.clear();
+	m_commandsSent = 0;
+	m_bareCommandSent = false;
+}
+
+void HidensSource::failInitialization(const QString& msg)
+{
+	clearCommands();
+	QObject::disconnect(m_socket, 0, 0, 0);
+	m_socket->disconnectFromHost();
+	emit initialized(false, msg);
 }
 
 bool HidensSource::verifyReply(const QByteArray& reply)
@@ -342,7 +581,20 @@ bool HidensSource::verifyReply(const QByteArray& reply)
 
 void HidensSource::requestData(const QByteArray& method)
 {
-	askHidens(method + " " + QByteArray::number(m_readInterval));
+	/* Requests are only terminated when several may be in flight. */
+	auto request = method + " " + QByteArray::number(m_readInterval);
+	if (m_pipelineDepth > 1) {
+		request += '\n';
+	}
+	askHidens(request);
+}
+
+void HidensSource::fillPipeline()
+{
+	while (m_outstandingRequests < m_pipelineDepth) {
+		requestData("stream");
+		m_outstandingRequests++;
+	}
 }
 
 void HidensSource::recvDataFrame()
@@ -353,8 +605,8 @@ void HidensSource::recvDataFrame()
 
 	/* Read all avaialable frames.
 	 *
-	 * This should only be run once, as we only request another frame
-	 * after reading a full one from the HiDens server.
+	 * Up to m_pipelineDepth requests are in flight, so several chunks may
+	 * be available at once. Each is parsed as soon as it has fully arrived.
 	 */
 	while (m_socket->bytesAvailable() >= m_bytesPerEmitFrame) {
 
@@ -371,7 +623,13 @@ void HidensSource::recvDataFrame()
 			nread += ret;
 		} while (nread < m_bytesPerEmitFrame);
 
-		/* Convert photodiode signal.
+		/* Replace the answered request before converting the chunk, so
+		 * that the server never waits on us.
+		 */
+		m_outstandingRequests = std::max(m_outstandingRequests - 1, 0);
+		fillPipeline();
+
+		/* Convert photodiode signal while transferring data.
 		 *
 		 * The digital signals from the small LVDS adapter board are grouped
 		 * into a couple of data channels. The photodiode bit is the 4th bit
@@ -385,108 +643,98 @@ void HidensSource::recvDataFrame()
 		 * See https://wiki-bsse.ethz.ch/display/DBSSECMOSMEA/HiDens+Neurolizer+LVDS+Adapter
 		 * for more information.
 		 */
-		m_acqBuffer.row(m_hidensFrameSize - 1).for_each(
-				[](uchar& x) { 
-					x = ( x & 0x08 ) ? 255 : 0; // set elements with 4th bit a 1 to 255
-				});
+		const auto nframes = m_acqBuffer.n_cols;
+		auto frame = m_framePool.acquire(nframes, m_nchannels);
 
 		/* 
-		 * Transfer all channel data into emit buffer.
+		 * Transfer all channel data into a frame from the pool.
 		 *
 		 * Channels 0-125 are the data channels (some of which may be invalid).
-		 * Channel 130 contains the photodiode signal.
+		 * Channel 130 contains the photodiode signal, the 4th bit of which
+		 * is set to 255 (before inversion). The kernel transposes, widens
+		 * and inverts the data, and extracts the photodiode bit, in a single
+		 * vectorized pass over the raw frames. Only the channels emitted
+		 * in the current mode are written.
 		 */
-		const auto flip = static_cast<qint16>(-1);
-		m_emitBuffer.cols(0, m_nDataChannels - 1) = 
-				arma::conv_to<datasource::Samples>::from(
-				m_acqBuffer.rows(0, m_nDataChannels - 1).t()) * flip;
-		m_emitBuffer.col(m_nchannels - 1) = 
-				arma::conv_to<datasource::Samples>::from(
-				m_acqBuffer.row(m_hidensFrameSize - 1).t()) * flip;
+		convertHidensFrames(m_acqBuffer.memptr(), nframes, 
+				m_channelColumns.data(), m_nchannels, frame->memptr());
 
-		/* Emit new data frame. */
-		emit dataAvailable(m_emitBuffer);
+		/* Emit new data frame. No copy of the frame is made, regardless
+		 * of the number of receivers.
+		 */
+		publish(SampleBlock(frame));
 	}
-
-	/* Request next chunk of data. */
-	requestData("stream");
 }
 
-void HidensSource::getConfigurationFromServer()
+void HidensSource::getConfigurationFromServer(std::function<void(bool)> done)
 {
-	askHidens("ch 0-125");
-	if (!m_socket->waitForReadyRead(RequestWaitTime)) {
-		handleError("Communication with the HiDens data server timed out.");
-		return;
-	}
-	auto bytes = m_socket->readAll();
-	if (!verifyReply(bytes)) {
-		handleError("Could not retrieve configuration from HiDens server.");
-		return;
-	}
-	auto originalChannelReply = QString(bytes);
+	/* One line is returned for each data channel. */
+	sendCommand("ch 0-" + QByteArray::number(m_nDataChannels - 1),
+			expectLines(m_nDataChannels),
+			[this, done](bool ok, const QList<QByteArray>& reply) {
+				if (!ok) {
+					/* Timeouts are reported by handleCommandTimeout(). */
+					if (!reply.isEmpty()) {
+						handleError("Could not retrieve configuration from HiDens server.");
+					}
+				} else {
+					parseConfiguration(reply);
+				}
+				if (done) {
+					done(ok);
+				}
+			});
+}
 
+void HidensSource::parseConfiguration(const QList<QByteArray>& reply)
+{
 	/* Get actual connected electrodes in a list */
-	auto stripFunction = [](QString& s) { if (s.endsWith(" ")) { s.chop(1); } };
-	auto channelStringList = originalChannelReply.split("\n");
-	std::for_each(channelStringList.begin(), channelStringList.end(), stripFunction);
 	m_electrodeIndices.fill(-1);
 	m_electrodeIndices(m_hidensFrameSize - 1) = 1;
 	int n = 0;
-	for (auto& each : channelStringList) {
-		if (each.size()) {
+	for (auto& each : reply) {
+		auto channel = each.trimmed();
+		if (channel.size()) {
 			/* Convert valid channels to int's. Invalids are left at -1. */
-			m_electrodeIndices(n) = each.toInt();
+			m_electrodeIndices(n) = channel.toInt();
+		}
+		if (++n == m_nDataChannels) {
+			break;
 		}
-		n += 1;
 	}
 
-	/* 
-	 * Read the electrode positions from the resource file, rather than parsing
-	 * from the server.
-	 */
-	QFile electrodeFile(":/electrode-list.txt");
-	if (!electrodeFile.exists()) {
-		m_configuration = {};
-		handleError("Electrode configuration file 'electrode-list.txt' is missing!");
+	updateChannelMap();
+	buildConfiguration();
+}
 
-		/* Should really just get this from the server. */
-		return;
+void HidensSource::updateChannelMap()
+{
+	const bool connectedOnly = (m_emitMode == "connected");
+	int ncolumns = 0;
+	for (int i = 0; i < m_nDataChannels; i++) {
+		m_channelColumns[i] = (!connectedOnly || (m_electrodeIndices(i) >= 0)) ? 
+				ncolumns++ : -1;
 	}
-	electrodeFile.open(QIODevice::ReadOnly);
-	auto electrodeList = QString(electrodeFile.readAll()).split("\n");
-	electrodeFile.close();
+	m_nchannels = ncolumns + 1;
+	m_framePool.reserve(m_acqBuffer.n_cols, m_nchannels);
+}
 
-	/* Parse configuration */
+void HidensSource::buildConfiguration()
+{
+	/* 
+	 * Look up the electrode positions of emitted channels in the table
+	 * generated from the electrode list at build time, rather than parsing
+	 * them from the server. Channels not connected to an electrode, and the
+	 * photodiode, are given an empty (all zeros) electrode.
+	 */
 	m_configuration.clear();
 	m_configuration.reserve(m_nchannels);
-	QRegularExpression re("\\s|[xyp]");
-	for (int i = 0; i < m_nTotalChannels; i++) {
-		Electrode el { };
-		/*
-		 * Channels not connected to an electrode are given an
-		 * empty (all zeros) electrode.
-		 */
-
-		/*
-		 * Channels with a valid electrode number are given an
-		 * electrode with x/y positions read from the corresponding
-		 * line of the electrodeList.
-		 */
-		if (m_electrodeIndices(i) >= 0) {
-			el.index = m_electrodeIndices(i);
-
-			auto positionList = electrodeList.at(m_electrodeIndices(i)).split(re);
-			el.xpos = positionList[0].toInt();
-			el.ypos = positionList[1].toInt();
-			el.x = positionList[3].toInt();
-			el.y = positionList[4].toInt();
-			el.label = positionList[5][0].toLatin1();
+	for (int i = 0; i < m_nDataChannels; i++) {
+		if (m_channelColumns[i] >= 0) {
+			m_configuration << electrodeAt(m_electrodeIndices(i));
 		}
-
-		/* Push electrode to configuration. */
-		m_configuration << el;
 	}
+	m_configuration << Electrode{};
 }
 
 QPair<bool, QString> HidensSource::sendConfigToFpga(
@@ -532,20 +780,49 @@ void HidensSource::handleConfigSendResponse()
 {
 	QObject::disconnect(&m_configWatcher, 0, 0, 0);
 	auto result = m_configFuture.result();
-	QString msg;
 	if (result.first) {
 		m_configurationFile = result.second;
-		getConfigurationFromServer();
-		getConfigurationFromServer(); // actually needed twice for some reason
+		/* Actually needed twice for some reason. */
+		auto respond = [this](bool ok) {
+			emit setResponse("configuration", ok, ok ? QString() :
+					"Could not retrieve configuration from HiDens server.");
+		};
+		getConfigurationFromServer([this, respond](bool ok) {
+					if (ok) {
+						getConfigurationFromServer(respond);
+					} else {
+						respond(false);
+					}
+				});
 	} else {
 		m_configurationFile.clear();
-		msg = "Could not send the configuration to the server.";
+		emit setResponse("configuration", false, 
+				"Could not send the configuration to the server.");
+	}
+}
+
+bool HidensSource::parseLocation(const QString& location, 
+		quint16 defaultPort, QString& addr, quint16& port)
+{
+	auto parts = location.split(':');
+	if ((parts.size() > 2) || parts.first().isEmpty()) {
+		return false;
+	}
+	port = defaultPort;
+	if (parts.size() == 2) {
+		bool ok;
+		port = parts.at(1).toUShort(&ok);
+		if (!ok || (port == 0)) {
+			return false;
+		}
 	}
-	emit setResponse("configuration", result.first, msg);
+	addr = parts.first();
+	return true;
 }
 
 void HidensSource::handleError(const QString& msg)
 {
+	clearCommands();
 	QObject::disconnect(m_socket, 0, 0, 0);
 	m_socket->disconnectFromHost();
 	BaseSource::handleError(msg);
@@ -558,6 +835,10 @@ QVariantMap HidensSource::packStatus()
 	map.insert("configuration", configToVariant(m_configuration));
 	map.insert("configuration-file", m_configurationFile.toUtf8());
 	map.insert("plug", m_plug);
+	map.insert("pipeline-depth", m_pipelineDepth);
+	map.insert("initialization-time", m_initializationTime);
+	map.insert("emit-mode", m_emitMode);
+	map.insert("fpga-location", QString("%1:%2").arg(m_fpgaAddr).arg(m_fpgaPort));
 	return map;
 }
 
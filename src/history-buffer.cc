@@ -0,0 +1,202 @@
+/*! \file history-buffer.cc
+ *
+ * Implementation of class retaining the most recent data emitted by a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "history-buffer.h"
+#include "recording-sink.h"
+
+#include <algorithm> // std::min, std::max
+#include <cmath> // std::ceil
+#include <cstring> // std::memcpy
+#include <stdexcept> // std::invalid_argument, std::out_of_range
+
+namespace datasource {
+
+HistoryBuffer::HistoryBuffer(double seconds, QObject* parent) :
+	SourceStage(parent),
+	m_seconds(seconds),
+	m_capacity(0),
+	m_end(0),
+	m_writing(0)
+{
+	if (!(seconds > 0.)) {
+		throw std::invalid_argument("A history buffer must retain a positive duration.");
+	}
+}
+
+HistoryBuffer::~HistoryBuffer()
+{
+	detach();
+	QMutexLocker lock(&m_lock);
+	auto dumps = m_dumps;
+	lock.unlock();
+	for (auto& dump : dumps) {
+		dump.waitForFinished();
+	}
+}
+
+void HistoryBuffer::reset()
+{
+	m_storage.reset();
+	m_capacity = 0;
+	m_end.store(0);
+	m_writing.store(0);
+}
+
+double HistoryBuffer::seconds() const
+{
+	return m_seconds;
+}
+
+quint64 HistoryBuffer::capacity() const
+{
+	return m_end.load(std::memory_order_acquire) ? m_capacity : 0;
+}
+
+int HistoryBuffer::nchannels() const
+{
+	return m_end.load(std::memory_order_acquire) ? static_cast<int>(m_storage.n_cols) : 0;
+}
+
+quint64 HistoryBuffer::begin() const
+{
+	/* Samples being overwritten by a block still being copied in
+	 * are no longer retained.
+	 */
+	if (m_end.load(std::memory_order_acquire) == 0) {
+		return 0;
+	}
+	const auto writing = m_writing.load(std::memory_order_acquire);
+	return (writing > m_capacity) ? writing - m_capacity : 0;
+}
+
+quint64 HistoryBuffer::end() const
+{
+	return m_end.load(std::memory_order_acquire);
+}
+
+const arma::subview<qint16> HistoryBuffer::snapshot(quint64 from, quint64 to) const
+{
+	const auto end = m_end.load(std::memory_order_acquire);
+	const auto writing = m_writing.load(std::memory_order_acquire);
+	const auto oldest = (writing > m_capacity) ? writing - m_capacity : 0;
+	if ((end == 0) || (from > to) || (to > end) || (from < oldest)) {
+		throw std::out_of_range("The requested samples are not retained.");
+	}
+	return m_storage.submat(from % m_capacity, 0,
+			arma::size(to - from, m_storage.n_cols));
+}
+
+Samples HistoryBuffer::copy(quint64 from, quint64 to) const
+{
+	/* No block is copied in while the lock is held. */
+	QMutexLocker lock(&processLock());
+	return Samples(snapshot(from, to));
+}
+
+bool HistoryBuffer::isIntact(quint64 from) const
+{
+	/* Order the caller's reads of the samples before the check. If a read
+	 * saw a sample written after m_writing was advanced, this sees the
+	 * advanced value.
+	 */
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (m_end.load(std::memory_order_acquire) == 0) {
+		return true;
+	}
+	const auto writing = m_writing.load(std::memory_order_relaxed);
+	return (writing <= m_capacity) || (from >= writing - m_capacity);
+}
+
+void HistoryBuffer::process(const SampleBlock& block)
+{
+	/* Allocate the buffer when the first block arrives, at which point
+	 * the number of channels is known.
+	 */
+	const auto& samples = block.samples();
+	auto end = m_end.load(std::memory_order_relaxed);
+	if (end == 0) {
+		if (samples.is_empty()) {
+			return;
+		}
+		const auto rate = sampleRate(samples.n_rows);
+		m_capacity = std::max(static_cast<quint64>(std::ceil(m_seconds * rate)),
+				static_cast<quint64>(1));
+		m_storage.set_size(2 * m_capacity, samples.n_cols);
+	}
+	if (samples.n_cols != m_storage.n_cols) {
+		return;
+	}
+
+	/* Only the last capacity samples of a block can be retained. */
+	const quint64 skip = (samples.n_rows > m_capacity) ? samples.n_rows - m_capacity : 0;
+	const quint64 n = samples.n_rows - skip;
+	end += skip;
+
+	/* Mark the samples about to be overwritten before writing any. */
+	m_writing.store(end + n, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	const auto position = end % m_capacity;
+	const auto first = std::min(n, m_capacity - position);
+	for (arma::uword c = 0; c < samples.n_cols; c++) {
+		const auto* in = samples.colptr(c) + skip;
+		auto* out = m_storage.colptr(c);
+		std::memcpy(out + position, in, first * sizeof(qint16));
+		std::memcpy(out + position + m_capacity, in, first * sizeof(qint16));
+		if (first < n) {
+			std::memcpy(out, in + first, (n - first) * sizeof(qint16));
+			std::memcpy(out + m_capacity, in + first, (n - first) * sizeof(qint16));
+		}
+	}
+	m_end.store(end + n, std::memory_order_release);
+}
+
+void HistoryBuffer::requestDump(quint64 from, quint64 to, QString filename)
+{
+	QMutexLocker lock(&m_lock);
+	for (auto it = m_dumps.begin(); it != m_dumps.end(); ) {
+		it = it->isFinished() ? m_dumps.erase(it) : it + 1;
+	}
+	m_dumps << QtConcurrent::run([this, from, to, filename]() {
+				dump(from, to, filename);
+			});
+}
+
+void HistoryBuffer::dump(quint64 from, quint64 to, const QString& filename)
+{
+	/* Copy the range first, so that it cannot be overwritten while it
+	 * is written to disk.
+	 */
+	Samples window;
+	try {
+		window = copy(from, to);
+	} catch (std::out_of_range& e) {
+		emit dumpFinished(filename, false, e.what());
+		return;
+	}
+
+	const auto status = sourceStatus();
+	try {
+		RecordingSink sink(filename);
+		sink.setMetadata(status);
+		sink.start();
+		sink.record(SampleBlock(std::move(window)));
+		sink.detach();
+		if (sink.samplesWritten() != to - from) {
+			emit dumpFinished(filename, false,
+					QString("Could not write to the file %1.").arg(filename));
+			return;
+		}
+	} catch (std::invalid_argument& e) {
+		emit dumpFinished(filename, false, e.what());
+		return;
+	}
+	emit dumpFinished(filename, true);
+}
+
+}; // end datasource namespace
+
@@ -0,0 +1,49 @@
+/*! \file kernel-isa.cc
+ *
+ * Implementation of the selection of the instruction set used by kernels.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "kernel-isa.h"
+
+namespace datasource {
+
+bool kernelSupported(KernelIsa isa)
+{
+	switch (isa) {
+		case KernelIsa::Best:
+		case KernelIsa::Scalar:
+			return true;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		case KernelIsa::Sse2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse2");
+		case KernelIsa::Avx2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+KernelIsa resolveKernelIsa(KernelIsa isa)
+{
+	/* Resolve the best supported instruction set, once. */
+	static const KernelIsa best = [] {
+		if (kernelSupported(KernelIsa::Avx2)) {
+			return KernelIsa::Avx2;
+		} else if (kernelSupported(KernelIsa::Sse2)) {
+			return KernelIsa::Sse2;
+		}
+		return KernelIsa::Scalar;
+	}();
+	if (isa == KernelIsa::Best) {
+		return best;
+	}
+	return kernelSupported(isa) ? isa : KernelIsa::Scalar;
+}
+
+}; // end datasource namespace
+
@@ -62,9 +62,8 @@ McsSource::McsSource(int readInterval, QObject *parent) :
 	m_acquisitionBufferSize = m_acquisitionBlockSize * m_nchannels;
 	m_trigger = "none";
 
-	/* Initialize acquisition buffer */
-	m_acqBuffer.set_size(m_acquisitionBlockSize, m_nchannels);
-	m_acqBuffer.fill(0);
+	/* Preallocate frames into which data is acquired. */
+	m_framePool.reserve(m_acquisitionBlockSize, m_nchannels);
 
 	/* Setup the MCS-specific parameters that can be manipulated
 	 * and retrieved.
@@ -660,12 +659,13 @@ void McsSource::readDeviceBuffer()
 	if (!m_inputTask)
 		return;
 
+	/* Read directly into a frame from the pool. */
+	auto frame = m_framePool.acquire(m_acquisitionBlockSize, m_nchannels);
 	int32 nread = 0;
 	int32 status = DAQmxReadBinaryI16(m_inputTask, m_acquisitionBlockSize,
-			m_triggerTimeout, m_deviceFillMode, m_acqBuffer.memptr(),
+			m_triggerTimeout, m_deviceFillMode, frame->memptr(),
 			m_acquisitionBufferSize, &nread, nullptr);
 	if (status) {
-		qInfo() << m_acqBuffer.memptr();
 		resetTasks();
 		emit error(QString("An error occurred reading data from the MCS"
 					" source: %1").arg(getDaqmxError(status)));
@@ -678,7 +678,9 @@ void McsSource::readDeviceBuffer()
 		return;
 	}
 
-	emit dataAvailable(m_acqBuffer * static_cast<qint16>(-1));
+	/* Invert in place, rather than into a temporary. */
+	*frame *= static_cast<qint16>(-1);
+	publish(SampleBlock(frame));
 }
 
 bool McsSource::event(QEvent* event)
@@ -0,0 +1,241 @@
+/*! \file preview-stage.cc
+ *
+ * Implementation of class computing a decimated min/max envelope of the
+ * data emitted by a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "preview-stage.h"
+
+#include <algorithm> // std::min, std::max
+#include <limits> // std::numeric_limits
+#include <stdexcept> // std::invalid_argument
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define PREVIEW_STAGE_X86
+# include <immintrin.h>
+#endif
+
+namespace datasource {
+
+static constexpr qint16 EmptyMin = std::numeric_limits<qint16>::max();
+static constexpr qint16 EmptyMax = std::numeric_limits<qint16>::min();
+
+/* Compute the envelope of samples [first, last), one value at a time. */
+static inline void envelopeScalar(const qint16* in, arma::uword first,
+		arma::uword last, qint16& min, qint16& max)
+{
+	for (auto i = first; i < last; i++) {
+		min = std::min(min, in[i]);
+		max = std::max(max, in[i]);
+	}
+}
+
+#ifdef PREVIEW_STAGE_X86
+
+/* Reduce running minima and maxima of 8 values each to single values. */
+__attribute__((target("sse2")))
+static inline void reduceSse2(__m128i lo, __m128i hi, qint16& min, qint16& max)
+{
+	lo = _mm_min_epi16(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+	hi = _mm_max_epi16(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+	lo = _mm_min_epi16(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+	hi = _mm_max_epi16(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+	lo = _mm_min_epi16(lo, _mm_shufflelo_epi16(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+	hi = _mm_max_epi16(hi, _mm_shufflelo_epi16(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+	min = std::min(min, static_cast<qint16>(_mm_cvtsi128_si32(lo)));
+	max = std::max(max, static_cast<qint16>(_mm_cvtsi128_si32(hi)));
+}
+
+/* Compute the envelope of each bin, 8 samples at a time. */
+__attribute__((target("sse2")))
+static void envelopeSse2(const qint16* in, const arma::uword* edges,
+		arma::uword nbins, qint16* minima, qint16* maxima)
+{
+	for (arma::uword b = 0; b < nbins; b++) {
+		auto i = edges[b];
+		const auto last = edges[b + 1];
+		auto lo = _mm_set1_epi16(EmptyMin), hi = _mm_set1_epi16(EmptyMax);
+		for (; i + 8 <= last; i += 8) {
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			lo = _mm_min_epi16(lo, v);
+			hi = _mm_max_epi16(hi, v);
+		}
+		qint16 min = EmptyMin, max = EmptyMax;
+		reduceSse2(lo, hi, min, max);
+		envelopeScalar(in, i, last, min, max);
+		minima[b] = min;
+		maxima[b] = max;
+	}
+}
+
+/* Compute the envelope of each bin, 16 samples at a time. */
+__attribute__((target("avx2")))
+static void envelopeAvx2(const qint16* in, const arma::uword* edges,
+		arma::uword nbins, qint16* minima, qint16* maxima)
+{
+	for (arma::uword b = 0; b < nbins; b++) {
+		auto i = edges[b];
+		const auto last = edges[b + 1];
+		auto lo = _mm256_set1_epi16(EmptyMin), hi = _mm256_set1_epi16(EmptyMax);
+		for (; i + 16 <= last; i += 16) {
+			const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			lo = _mm256_min_epi16(lo, v);
+			hi = _mm256_max_epi16(hi, v);
+		}
+		auto lo128 = _mm_min_epi16(_mm256_castsi256_si128(lo),
+				_mm256_extracti128_si256(lo, 1));
+		auto hi128 = _mm_max_epi16(_mm256_castsi256_si128(hi),
+				_mm256_extracti128_si256(hi, 1));
+		if (i + 8 <= last) {
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			lo128 = _mm_min_epi16(lo128, v);
+			hi128 = _mm_max_epi16(hi128, v);
+			i += 8;
+		}
+		qint16 min = EmptyMin, max = EmptyMax;
+		reduceSse2(lo128, hi128, min, max);
+		envelopeScalar(in, i, last, min, max);
+		minima[b] = min;
+		maxima[b] = max;
+	}
+}
+
+#endif // PREVIEW_STAGE_X86
+
+void minMaxEnvelope(const qint16* in, const arma::uword* edges, arma::uword nbins,
+		qint16* minima, qint16* maxima, KernelIsa isa)
+{
+	switch (resolveKernelIsa(isa)) {
+#ifdef PREVIEW_STAGE_X86
+		case KernelIsa::Avx2:
+			envelopeAvx2(in, edges, nbins, minima, maxima);
+			break;
+		case KernelIsa::Sse2:
+			envelopeSse2(in, edges, nbins, minima, maxima);
+			break;
+#endif
+		default:
+			for (arma::uword b = 0; b < nbins; b++) {
+				minima[b] = EmptyMin;
+				maxima[b] = EmptyMax;
+				envelopeScalar(in, edges[b], edges[b + 1], minima[b], maxima[b]);
+			}
+			break;
+	}
+}
+
+constexpr float PreviewStage::DefaultRate;
+
+PreviewStage::PreviewStage(float rate, QObject* parent) :
+	SourceStage(parent),
+	m_rate(rate),
+	m_isa(KernelIsa::Best),
+	m_binSamples(0.),
+	m_position(0),
+	m_bin(0)
+{
+	if (!(rate > 0.)) {
+		throw std::invalid_argument("The rate of a preview must be positive.");
+	}
+}
+
+PreviewStage::~PreviewStage()
+{
+	detach();
+}
+
+void PreviewStage::reset()
+{
+	m_binSamples = 0.;
+	m_position = 0;
+	m_bin = 0;
+}
+
+float PreviewStage::rate() const
+{
+	return m_rate;
+}
+
+void PreviewStage::setRate(float rate)
+{
+	if (!(rate > 0.)) {
+		throw std::invalid_argument("The rate of a preview must be positive.");
+	}
+	m_rate = rate;
+}
+
+void PreviewStage::setKernelIsa(KernelIsa isa)
+{
+	m_isa = isa;
+}
+
+quint64 PreviewStage::binStart(quint64 bin) const
+{
+	return static_cast<quint64>(bin * m_binSamples);
+}
+
+void PreviewStage::process(const SampleBlock& block)
+{
+	/* Size the bins when the first block arrives, at which point the
+	 * number of channels is known.
+	 */
+	const auto& samples = block.samples();
+	if (samples.is_empty()) {
+		return;
+	}
+	if (m_binSamples == 0.) {
+		m_binSamples = std::max(sampleRate(samples.n_rows) / m_rate, 1.);
+		m_partialMin.set_size(1, samples.n_cols);
+		m_partialMin.fill(EmptyMin);
+		m_partialMax.set_size(1, samples.n_cols);
+		m_partialMax.fill(EmptyMax);
+	}
+	if (samples.n_cols != m_partialMin.n_cols) {
+		return;
+	}
+
+	/* Find the bins completed by this block, and their edges within it.
+	 * The first of them began in an earlier block if a bin is partial,
+	 * and the samples after the last of them begin a new partial bin.
+	 */
+	const auto first = m_position;
+	const auto last = m_position + samples.n_rows;
+	m_edges.clear();
+	m_edges.push_back(0);
+	arma::uword nbins = 0;
+	while (binStart(m_bin + nbins + 1) <= last) {
+		nbins++;
+		m_edges.push_back(binStart(m_bin + nbins) - first);
+	}
+	m_edges.push_back(samples.n_rows);
+
+	Samples minima(nbins, samples.n_cols), maxima(nbins, samples.n_cols);
+	for (arma::uword c = 0; c < samples.n_cols; c++) {
+		const auto* in = samples.colptr(c);
+		qint16 min, max;
+		minMaxEnvelope(in, m_edges.data(), nbins,
+				minima.colptr(c), maxima.colptr(c), m_isa);
+		minMaxEnvelope(in, m_edges.data() + nbins, 1, &min, &max, m_isa);
+		if (nbins) {
+			minima(0, c) = std::min(minima(0, c), m_partialMin(c));
+			maxima(0, c) = std::max(maxima(0, c), m_partialMax(c));
+			m_partialMin(c) = min;
+			m_partialMax(c) = max;
+		} else {
+			m_partialMin(c) = std::min(m_partialMin(c), min);
+			m_partialMax(c) = std::max(m_partialMax(c), max);
+		}
+	}
+	m_position = last;
+	if (nbins) {
+		const auto bin = m_bin;
+		m_bin += nbins;
+		emit previewAvailable(bin, SampleBlock(std::move(minima)),
+				SampleBlock(std::move(maxima)));
+	}
+}
+
+}; // end datasource namespace
+
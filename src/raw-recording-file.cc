@@ -0,0 +1,205 @@
+/*! \file raw-recording-file.cc
+ *
+ * Implementation of class for reading recordings stored as raw binary samples.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "raw-recording-file.h"
+
+#include <algorithm> // std::min
+#include <cstring> // std::memcpy
+#include <stdexcept> // std::invalid_argument
+
+#ifdef Q_OS_UNIX
+# include <sys/mman.h> // madvise
+# include <unistd.h> // sysconf
+#endif
+
+namespace datasource {
+
+constexpr qint64 RawRecordingFile::ReadAheadBytes;
+
+RawRecordingFile::RawRecordingFile(const QString& filename) :
+	m_file(filename),
+	m_map(nullptr),
+	m_mapSize(0),
+	m_data(nullptr),
+	m_readAheadStart(0),
+	m_readAheadEnd(0)
+{
+	/* Read the description of the data from the sidecar. */
+	QFile sidecar(sidecarName(filename));
+	if (!sidecar.open(QIODevice::ReadOnly)) {
+		throw std::invalid_argument("Could not open the sidecar of the raw data file.");
+	}
+	QJsonParseError error;
+	auto json = QJsonDocument::fromJson(sidecar.readAll(), &error).object();
+	if (error.error != QJsonParseError::NoError) {
+		throw std::invalid_argument("The sidecar of the raw data file is not valid JSON.");
+	}
+	m_sampleRate = static_cast<float>(json.value("sample-rate").toDouble());
+	m_nchannels = json.value("nchannels").toInt();
+	if (!(m_sampleRate > 0.) || (m_nchannels <= 0)) {
+		throw std::invalid_argument("The sidecar of the raw data file must give "
+				"a positive \"sample-rate\" and \"nchannels\".");
+	}
+	auto layout = json.value("layout").toString("interleaved");
+	if ((layout != "interleaved") && (layout != "channel-major")) {
+		throw std::invalid_argument("The layout of a raw data file must be "
+				"\"interleaved\" or \"channel-major\".");
+	}
+	m_interleaved = (layout == "interleaved");
+	const auto headerBytes = static_cast<qint64>(json.value("header-bytes").toDouble(0));
+	m_array = json.value("device-type").toString("raw");
+	m_gain = static_cast<float>(json.value("gain").toDouble(1.));
+	m_offset = static_cast<float>(json.value("offset").toDouble(0.));
+
+	/* Map the whole file, so that the mapping starts on a page boundary. */
+	if (!m_file.open(QIODevice::ReadOnly)) {
+		throw std::invalid_argument("Could not open the raw data file.");
+	}
+	m_mapSize = m_file.size();
+	if ((headerBytes < 0) || (headerBytes > m_mapSize)) {
+		throw std::invalid_argument("The header of the raw data file is "
+				"larger than the file.");
+	}
+	if (headerBytes % sizeof(qint16)) {
+		throw std::invalid_argument("The header of the raw data file must be "
+				"an even number of bytes, so that the samples are aligned.");
+	}
+	m_nsamples = static_cast<quint64>(m_mapSize - headerBytes) /
+			(sizeof(qint16) * m_nchannels);
+	if (m_nsamples == 0) {
+		return;
+	}
+	m_map = m_file.map(0, m_mapSize);
+	if (!m_map) {
+		throw std::invalid_argument("Could not map the raw data file into memory.");
+	}
+	m_data = reinterpret_cast<const qint16*>(m_map + headerBytes);
+#ifdef Q_OS_UNIX
+	advise(m_map, m_mapSize, MADV_SEQUENTIAL);
+#endif
+}
+
+RawRecordingFile::~RawRecordingFile()
+{
+	if (m_map) {
+		m_file.unmap(m_map);
+	}
+}
+
+QString RawRecordingFile::sidecarName(const QString& filename)
+{
+	return filename + ".json";
+}
+
+QString RawRecordingFile::array() const
+{
+	return m_array;
+}
+
+quint64 RawRecordingFile::nsamples() const
+{
+	return m_nsamples;
+}
+
+int RawRecordingFile::nchannels() const
+{
+	return m_nchannels;
+}
+
+float RawRecordingFile::sampleRate() const
+{
+	return m_sampleRate;
+}
+
+float RawRecordingFile::gain() const
+{
+	return m_gain;
+}
+
+float RawRecordingFile::offset() const
+{
+	return m_offset;
+}
+
+void RawRecordingFile::data(int firstChannel, int lastChannel,
+		quint64 start, quint64 end, Samples& out)
+{
+	firstChannel = std::max(0, firstChannel);
+	lastChannel = std::min(lastChannel, m_nchannels);
+	end = std::min(end, m_nsamples);
+	if ((start >= end) || (firstChannel >= lastChannel)) {
+		out.set_size(0, 0);
+		return;
+	}
+	readAhead(start, end);
+
+	const auto nsamples = static_cast<arma::uword>(end - start);
+	const auto nchannels = static_cast<arma::uword>(lastChannel - firstChannel);
+	if (m_interleaved) {
+
+		/* The mapped samples are a (channels, samples) matrix in Armadillo's
+		 * column-major order. View them in place, and transpose only the
+		 * requested channels into the output.
+		 */
+		const arma::Mat<qint16> view(const_cast<qint16*>(m_data + start * m_nchannels),
+				m_nchannels, nsamples, false, true);
+		out = view.rows(firstChannel, lastChannel - 1).t();
+	} else {
+
+		/* Each channel's samples are contiguous, as are the output's. */
+		out.set_size(nsamples, nchannels);
+		for (arma::uword c = 0; c < nchannels; c++) {
+			std::memcpy(out.colptr(c), m_data + (firstChannel + c) * m_nsamples + start,
+					nsamples * sizeof(qint16));
+		}
+	}
+}
+
+void RawRecordingFile::readAhead(quint64 start, quint64 end)
+{
+	if ((start >= m_readAheadStart) && (end <= m_readAheadEnd)) {
+		return;
+	}
+
+	/* Read ahead a window of the same size in bytes, whatever the layout. */
+	const auto window = std::max<quint64>(end - start,
+			ReadAheadBytes / (sizeof(qint16) * m_nchannels));
+	m_readAheadStart = start;
+	m_readAheadEnd = std::min(m_nsamples, start + window);
+	const auto length = m_readAheadEnd - m_readAheadStart;
+#ifdef Q_OS_UNIX
+	if (m_interleaved) {
+		advise(reinterpret_cast<const uchar*>(m_data + m_readAheadStart * m_nchannels),
+				length * m_nchannels * sizeof(qint16), MADV_WILLNEED);
+	} else {
+		for (int c = 0; c < m_nchannels; c++) {
+			advise(reinterpret_cast<const uchar*>(m_data + c * m_nsamples + m_readAheadStart),
+					length * sizeof(qint16), MADV_WILLNEED);
+		}
+	}
+#else
+	Q_UNUSED(length);
+#endif
+}
+
+void RawRecordingFile::advise(const uchar* begin, qint64 length, int advice)
+{
+#ifdef Q_OS_UNIX
+	/* madvise() requires an address aligned to a page. */
+	static const auto pageSize = static_cast<quintptr>(sysconf(_SC_PAGESIZE));
+	auto address = reinterpret_cast<quintptr>(begin);
+	auto aligned = address & ~(pageSize - 1);
+	madvise(reinterpret_cast<void*>(aligned), length + (address - aligned), advice);
+#else
+	Q_UNUSED(begin);
+	Q_UNUSED(length);
+	Q_UNUSED(advice);
+#endif
+}
+
+}; // end datasource namespace
+
@@ -0,0 +1,203 @@
+/*! \file recording-file.cc
+ *
+ * Implementation of the interface for reading previously-recorded data,
+ * and of its HDF5 backend.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "recording-file.h"
+#include "raw-recording-file.h"
+#include "hdf5-chunk-reader.h"
+
+#include "libdatafile/include/hidensfile.h"
+
+#include <stdexcept> // std::invalid_argument
+
+namespace datasource {
+
+QMutex* hdf5Mutex()
+{
+	static QMutex mutex;
+	return &mutex;
+}
+
+/* Return true if the file starts with the HDF5 signature. The signature
+ * may follow a user block, which is 512 bytes or a power of two larger.
+ */
+static bool isHdf5File(const QString& filename)
+{
+	static const QByteArray signature("\x89HDF\r\n\x1a\n", 8);
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	for (qint64 offset = 0; offset + signature.size() <= file.size();
+			offset = offset ? 2 * offset : 512) {
+		if (!file.seek(offset)) {
+			break;
+		}
+		if (file.read(signature.size()) == signature) {
+			return true;
+		}
+	}
+	return false;
+}
+
+std::unique_ptr<RecordingFile> RecordingFile::open(const QString& filename)
+{
+	if (isHdf5File(filename)) {
+		return std::unique_ptr<RecordingFile>(new Hdf5RecordingFile(filename));
+	} else if (QFile::exists(RawRecordingFile::sidecarName(filename))) {
+		return std::unique_ptr<RecordingFile>(new RawRecordingFile(filename));
+	}
+	throw std::invalid_argument("The requested data file is neither an HDF5 "
+			"file nor a raw file with a sidecar describing it.");
+}
+
+RecordingFile::ChannelRuns RecordingFile::channelRuns(
+		const std::vector<int>& channels, int nchannels)
+{
+	ChannelRuns runs;
+	if (channels.empty()) {
+		runs.emplace_back(0, nchannels);
+		return runs;
+	}
+	for (auto channel : channels) {
+		if (!runs.empty() && (runs.back().second == channel)) {
+			runs.back().second++;
+		} else {
+			runs.emplace_back(channel, channel + 1);
+		}
+	}
+	return runs;
+}
+
+void RecordingFile::data(const ChannelRuns& runs, quint64 start, quint64 end, Samples& out)
+{
+	if (runs.size() == 1) {
+		data(runs.front().first, runs.front().second, start, end, out);
+		return;
+	}
+
+	/* Read each run in place, through a matrix using its columns' memory.
+	 * Should a backend resize the matrix anyway, it no longer aliases the
+	 * columns, and the run is copied into place.
+	 */
+	arma::uword column = 0;
+	for (const auto& run : runs) {
+		const auto ncolumns = static_cast<arma::uword>(run.second - run.first);
+		Samples columns(out.colptr(column), out.n_rows, ncolumns, false, false);
+		data(run.first, run.second, start, end, columns);
+		if (columns.memptr() != out.colptr(column)) {
+			out.cols(column, column + ncolumns - 1) = columns;
+		}
+		column += ncolumns;
+	}
+}
+
+Hdf5RecordingFile::Hdf5RecordingFile(const QString& filename)
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	if (datafile::array(filename.toStdString()) == "hidens") {
+		m_file.reset(new hidensfile::HidensFile(filename.toStdString()));
+	} else {
+		m_file.reset(new datafile::DataFile(filename.toStdString()));
+	}
+	hdf5.unlock();
+
+	m_chunkReader.reset(new Hdf5ChunkReader(filename));
+	if (!m_chunkReader->isValid()) {
+		m_chunkReader.reset();
+	}
+}
+
+Hdf5RecordingFile::~Hdf5RecordingFile()
+{
+	m_chunkReader.reset();
+	QMutexLocker hdf5(hdf5Mutex());
+	m_file.reset();
+}
+
+bool Hdf5RecordingFile::isReadingChunks() const
+{
+	return (m_chunkReader != nullptr);
+}
+
+void Hdf5RecordingFile::setReadAhead(int chunks)
+{
+	if (m_chunkReader) {
+		m_chunkReader->setReadAhead(chunks);
+	}
+}
+
+QString Hdf5RecordingFile::array() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	return QString::fromStdString(m_file->array());
+}
+
+quint64 Hdf5RecordingFile::nsamples() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	return static_cast<quint64>(m_file->nsamples());
+}
+
+int Hdf5RecordingFile::nchannels() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	return static_cast<int>(m_file->nchannels());
+}
+
+float Hdf5RecordingFile::sampleRate() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	return m_file->sampleRate();
+}
+
+float Hdf5RecordingFile::gain() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	return m_file->gain();
+}
+
+float Hdf5RecordingFile::offset() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	return m_file->offset();
+}
+
+QVector<double> Hdf5RecordingFile::analogOutput() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	QVector<double> out;
+	if (m_file->analogOutputSize()) {
+		auto aout = m_file->analogOutput();
+		out.resize(aout.size());
+		std::memcpy(out.data(), aout.memptr(), aout.size() * sizeof(double));
+	}
+	return out;
+}
+
+QConfiguration Hdf5RecordingFile::configuration() const
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	auto* p = dynamic_cast<hidensfile::HidensFile*>(m_file.get());
+	if (!p) {
+		return {};
+	}
+	return QConfiguration::fromStdVector(p->configuration());
+}
+
+void Hdf5RecordingFile::data(int firstChannel, int lastChannel,
+		quint64 start, quint64 end, Samples& out)
+{
+	if (m_chunkReader && m_chunkReader->read(firstChannel, lastChannel, start, end, out)) {
+		return;
+	}
+	QMutexLocker hdf5(hdf5Mutex());
+	m_file->data(firstChannel, lastChannel, start, end, out);
+}
+
+}; // end datasource namespace
+
@@ -0,0 +1,425 @@
+/*! \file recording-sink.cc
+ *
+ * Implementation of class recording the data from any source to an HDF5 file.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "recording-sink.h"
+#include "recording-file.h"
+
+#include <algorithm> // std::min, std::max
+#include <cstring> // std::memcpy
+#include <stdexcept> // std::invalid_argument
+
+namespace datasource {
+
+constexpr int RecordingSink::DefaultQueueCapacity;
+constexpr quint64 RecordingSink::DefaultChunkSamples;
+
+RecordingSink::RecordingSink(const QString& filename, QObject* parent) :
+	QThread(parent),
+	m_filename(filename),
+	m_chunkSamples(DefaultChunkSamples),
+	m_compression(0),
+	m_file(-1),
+	m_dataset(-1),
+	m_collected(0),
+	m_queueCapacity(DefaultQueueCapacity),
+	m_sampleRate(qSNaN()),
+	m_gain(qSNaN()),
+	m_offset(qSNaN()),
+	m_written(0),
+	m_dropped(0),
+	m_bytesWritten(0),
+	m_writeNanoseconds(0),
+	m_attached(false),
+	m_stop(false)
+{
+	if (!QFileInfo(m_filename).absoluteDir().exists()) {
+		throw std::invalid_argument("The directory of the recording file does not exist.");
+	}
+}
+
+RecordingSink::~RecordingSink()
+{
+	detach();
+}
+
+void RecordingSink::attach(BaseSource* source)
+{
+	QMutexLocker lock(&m_lock);
+	if (m_attached) {
+		return;
+	}
+	m_attached = true;
+	lock.unlock();
+
+	/* Both handlers run in the source's thread, and only take the lock
+	 * for long enough to queue the block or copy the metadata.
+	 */
+	m_connections << QObject::connect(source, &BaseSource::dataAvailable,
+			this, [this](SampleBlock block) { record(block); },
+			Qt::DirectConnection);
+	m_connections << QObject::connect(source, &BaseSource::status,
+			this, [this](QVariantMap status) { setMetadata(status); },
+			Qt::DirectConnection);
+	start();
+	QMetaObject::invokeMethod(source, "requestStatus");
+}
+
+void RecordingSink::detach()
+{
+	for (auto& connection : m_connections) {
+		QObject::disconnect(connection);
+	}
+	m_connections.clear();
+	{
+		QMutexLocker lock(&m_lock);
+		m_stop = true;
+		m_wake.wakeAll();
+	}
+	wait();
+}
+
+void RecordingSink::setQueueCapacity(int blocks)
+{
+	QMutexLocker lock(&m_lock);
+	m_queueCapacity = std::max(1, blocks);
+}
+
+void RecordingSink::setChunkSamples(quint64 nsamples)
+{
+	m_chunkSamples = std::max(static_cast<quint64>(1), nsamples);
+}
+
+void RecordingSink::setCompression(int level)
+{
+	m_compression = std::min(std::max(0, level), 9);
+}
+
+QString RecordingSink::filename() const
+{
+	return m_filename;
+}
+
+int RecordingSink::queueDepth() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_queue.size();
+}
+
+quint64 RecordingSink::samplesWritten() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_written;
+}
+
+quint64 RecordingSink::blocksDropped() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_dropped;
+}
+
+double RecordingSink::writeThroughput() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_writeNanoseconds ? 1e9 * m_bytesWritten / m_writeNanoseconds : 0.;
+}
+
+void RecordingSink::requestStatus()
+{
+	const auto throughput = writeThroughput();
+	QMutexLocker lock(&m_lock);
+	QVariantMap map {
+		{ "recording-file", m_filename },
+		{ "queue-depth", m_queue.size() },
+		{ "queue-capacity", m_queueCapacity },
+		{ "samples-written", m_written },
+		{ "blocks-dropped", m_dropped },
+		{ "write-throughput", throughput }
+	};
+	lock.unlock();
+	emit status(map);
+}
+
+void RecordingSink::record(const SampleBlock& block)
+{
+	QMutexLocker lock(&m_lock);
+	if (m_stop) {
+		return;
+	}
+	if (m_queue.size() >= m_queueCapacity) {
+		if (m_dropped++ == 0) {
+			lock.unlock();
+			emit error("The recording queue is full, and data is being dropped.");
+		}
+		return;
+	}
+	m_queue.enqueue(block);
+	m_wake.wakeOne();
+}
+
+void RecordingSink::setMetadata(const QVariantMap& status)
+{
+	QMutexLocker lock(&m_lock);
+	m_sampleRate = status.value("sample-rate", m_sampleRate).toFloat();
+	m_gain = status.value("gain", m_gain).toFloat();
+	m_offset = status.value("adc-range", m_offset).toFloat();
+	m_array = status.value("device-type", m_array).toString();
+	if (status.contains("analog-output")) {
+		m_analogOutput = status.value("analog-output").value<QVector<double>>();
+	}
+
+	/* Sources report their configuration as a QConfiguration. It is
+	 * also accepted as JSON, as sent to remote clients: an array of
+	 * electrodes, each an array of the Electrode's fields in order.
+	 */
+	if (status.contains("configuration")) {
+		const auto configuration = status.value("configuration");
+		if (configuration.userType() == qMetaTypeId<QConfiguration>()) {
+			m_configuration = configuration.value<QConfiguration>();
+		} else {
+			m_configuration.clear();
+			for (const auto& value : configuration.toJsonArray()) {
+				auto el = value.toArray();
+				m_configuration.append(Electrode(el.at(0).toInt(), el.at(1).toInt(),
+						el.at(2).toInt(), el.at(3).toInt(), el.at(4).toInt(),
+						el.at(5).toInt()));
+			}
+		}
+	}
+}
+
+void RecordingSink::run()
+{
+	bool ok = true;
+	QMutexLocker lock(&m_lock);
+	while (true) {
+		while (m_queue.isEmpty() && !m_stop) {
+			m_wake.wait(&m_lock);
+		}
+		if (m_queue.isEmpty()) {
+			break;
+		}
+		auto block = m_queue.dequeue();
+		lock.unlock();
+		if (ok && !append(block)) {
+			ok = false;
+			emit error(QString("Could not write to the recording file %1.").arg(m_filename));
+		}
+		lock.relock();
+	}
+	lock.unlock();
+
+	/* Write the final, partial, chunk, and the metadata, which the source
+	 * may have reported only after recording began.
+	 */
+	if (m_dataset >= 0) {
+		if (ok && m_collected) {
+			writeChunk(m_collected);
+		}
+		writeMetadata();
+	}
+	close();
+}
+
+bool RecordingSink::append(const SampleBlock& block)
+{
+	if ((m_dataset < 0) && !create(static_cast<int>(block.nchannels()))) {
+		return false;
+	}
+	if (block.nchannels() != m_chunk.n_cols) {
+		return false;
+	}
+
+	/* Each channel of the block and of the chunk is contiguous, so copy
+	 * the block channel by channel into each chunk it overlaps.
+	 */
+	const auto& samples = block.samples();
+	quint64 copied = 0;
+	while (copied < samples.n_rows) {
+		const auto n = std::min<quint64>(samples.n_rows - copied, m_chunkSamples - m_collected);
+		for (arma::uword c = 0; c < samples.n_cols; c++) {
+			std::memcpy(m_chunk.colptr(c) + m_collected, samples.colptr(c) + copied,
+					n * sizeof(qint16));
+		}
+		copied += n;
+		m_collected += n;
+		if ((m_collected == m_chunkSamples) && !writeChunk(m_chunkSamples)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool RecordingSink::create(int nchannels)
+{
+	m_startTime = QDateTime::currentDateTime();
+	m_chunk.set_size(m_chunkSamples, nchannels);
+	m_collected = 0;
+
+	QMutexLocker hdf5(hdf5Mutex());
+	m_file = H5Fcreate(QFile::encodeName(m_filename).constData(), H5F_ACC_TRUNC,
+			H5P_DEFAULT, H5P_DEFAULT);
+	if (m_file < 0) {
+		return false;
+	}
+
+	/* The dataset grows along samples, one chunk of every channel at a time. */
+	hsize_t dims[2] = { static_cast<hsize_t>(nchannels), 0 };
+	hsize_t maxdims[2] = { static_cast<hsize_t>(nchannels), H5S_UNLIMITED };
+	hsize_t chunk[2] = { static_cast<hsize_t>(nchannels), m_chunkSamples };
+	auto space = H5Screate_simple(2, dims, maxdims);
+	auto plist = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(plist, 2, chunk);
+	if (m_compression) {
+		H5Pset_shuffle(plist);
+		H5Pset_deflate(plist, m_compression);
+	}
+	m_dataset = H5Dcreate2(m_file, "data", H5T_STD_I16LE, space,
+			H5P_DEFAULT, plist, H5P_DEFAULT);
+	H5Pclose(plist);
+	H5Sclose(space);
+	hdf5.unlock();
+
+	if (m_dataset < 0) {
+		return false;
+	}
+	writeMetadata();
+	return true;
+}
+
+bool RecordingSink::writeChunk(quint64 nsamples)
+{
+	QElapsedTimer timer;
+	timer.start();
+	QMutexLocker hdf5(hdf5Mutex());
+
+	/* The chunk is stored channel by channel, exactly as the dataset
+	 * is laid out, so it is written without rearranging it. Only this
+	 * thread changes the number of samples written, so it may be read
+	 * without the lock.
+	 */
+	const auto written = m_written;
+	const hsize_t nchannels = m_chunk.n_cols;
+	hsize_t dims[2] = { nchannels, written + nsamples };
+	bool ok = (H5Dset_extent(m_dataset, dims) >= 0);
+
+	hsize_t memdims[2] = { nchannels, m_chunkSamples };
+	hsize_t start[2] = { 0, 0 };
+	hsize_t count[2] = { nchannels, nsamples };
+	auto memspace = H5Screate_simple(2, memdims, nullptr);
+	H5Sselect_hyperslab(memspace, H5S_SELECT_SET, start, nullptr, count, nullptr);
+	auto filespace = H5Dget_space(m_dataset);
+	start[1] = written;
+	H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, nullptr, count, nullptr);
+	ok = ok && (H5Dwrite(m_dataset, H5T_NATIVE_SHORT, memspace, filespace,
+			H5P_DEFAULT, m_chunk.memptr()) >= 0);
+	H5Sclose(filespace);
+	H5Sclose(memspace);
+	hdf5.unlock();
+
+	m_collected = 0;
+	if (ok) {
+		QMutexLocker lock(&m_lock);
+		m_written += nsamples;
+		m_bytesWritten += nsamples * nchannels * sizeof(qint16);
+		m_writeNanoseconds += timer.nsecsElapsed();
+	}
+	return ok;
+}
+
+/* Replace an attribute of the given object. */
+static void writeAttribute(hid_t object, const char* name, hid_t type, const void* value)
+{
+	if (H5Aexists(object, name) > 0) {
+		H5Adelete(object, name);
+	}
+	auto space = H5Screate(H5S_SCALAR);
+	auto attr = H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(attr, type, value);
+	H5Aclose(attr);
+	H5Sclose(space);
+}
+
+/* Replace a string attribute of the given object. */
+static void writeAttribute(hid_t object, const char* name, const QByteArray& value)
+{
+	auto type = H5Tcopy(H5T_C_S1);
+	H5Tset_size(type, std::max(1, value.size()));
+	writeAttribute(object, name, type, value.constData());
+	H5Tclose(type);
+}
+
+/* Replace a one-dimensional dataset of the given object. */
+static void writeDataset(hid_t file, const char* name, hid_t filetype, hid_t memtype,
+		hsize_t size, const void* data)
+{
+	if (H5Lexists(file, name, H5P_DEFAULT) > 0) {
+		H5Ldelete(file, name, H5P_DEFAULT);
+	}
+	if (size == 0) {
+		return;
+	}
+	auto space = H5Screate_simple(1, &size, nullptr);
+	auto dataset = H5Dcreate2(file, name, filetype, space,
+			H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	H5Dwrite(dataset, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+	H5Dclose(dataset);
+	H5Sclose(space);
+}
+
+void RecordingSink::writeMetadata()
+{
+	QMutexLocker lock(&m_lock);
+	const auto sampleRate = m_sampleRate;
+	const auto gain = m_gain;
+	const auto offset = m_offset;
+	const auto array = m_array.toUtf8();
+	const auto analogOutput = m_analogOutput;
+	const auto configuration = m_configuration;
+	const qint64 nsamples = m_written;
+	lock.unlock();
+
+	QMutexLocker hdf5(hdf5Mutex());
+	writeAttribute(m_dataset, "sample-rate", H5T_NATIVE_FLOAT, &sampleRate);
+	writeAttribute(m_dataset, "gain", H5T_NATIVE_FLOAT, &gain);
+	writeAttribute(m_dataset, "offset", H5T_NATIVE_FLOAT, &offset);
+	writeAttribute(m_dataset, "nsamples", H5T_NATIVE_INT64, &nsamples);
+	writeAttribute(m_dataset, "array", array);
+	writeAttribute(m_dataset, "date", m_startTime.toString("ddd, MMM d, yyyy").toUtf8());
+	writeAttribute(m_dataset, "time", m_startTime.toString("h:mm:ss AP").toUtf8());
+
+	writeDataset(m_file, "analog-output", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE,
+			analogOutput.size(), analogOutput.constData());
+
+	/* Electrodes are stored as a compound type of their fields. */
+	auto type = H5Tcreate(H5T_COMPOUND, sizeof(Electrode));
+	H5Tinsert(type, "index", HOFFSET(Electrode, index), H5T_NATIVE_UINT32);
+	H5Tinsert(type, "xpos", HOFFSET(Electrode, xpos), H5T_NATIVE_UINT32);
+	H5Tinsert(type, "x", HOFFSET(Electrode, x), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "ypos", HOFFSET(Electrode, ypos), H5T_NATIVE_UINT32);
+	H5Tinsert(type, "y", HOFFSET(Electrode, y), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "label", HOFFSET(Electrode, label), H5T_NATIVE_UINT8);
+	writeDataset(m_file, "configuration", type, type,
+			configuration.size(), configuration.constData());
+	H5Tclose(type);
+	H5Fflush(m_file, H5F_SCOPE_LOCAL);
+}
+
+void RecordingSink::close()
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	if (m_dataset >= 0) {
+		H5Dclose(m_dataset);
+		m_dataset = -1;
+	}
+	if (m_file >= 0) {
+		H5Fclose(m_file);
+		m_file = -1;
+	}
+}
+
+}; // end datasource namespace
+
@@ -0,0 +1,115 @@
+/*! \file source-stage.cc
+ *
+ * Implementation of base class for stages processing the data emitted by
+ * a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "source-stage.h"
+
+#include <algorithm> // std::max
+
+namespace datasource {
+
+struct SourceStage::Guard {
+
+	/* Held while a handler runs. Recursive, so that a stage may be
+	 * detached from the source's thread, e.g., by a slot connected
+	 * directly to a signal emitted while processing a block.
+	 */
+	QMutex lock { QMutex::Recursive };
+
+	/* The stage to which blocks are passed, or null once detached. */
+	SourceStage* stage = nullptr;
+};
+
+SourceStage::SourceStage(QObject* parent) :
+	QObject(parent),
+	m_guard(std::make_shared<Guard>()),
+	m_readInterval(0)
+{
+}
+
+SourceStage::~SourceStage()
+{
+	detach();
+}
+
+void SourceStage::attach(BaseSource* source)
+{
+	detach();
+	m_guard = std::make_shared<Guard>();
+	m_readInterval = source->readInterval();
+	{
+		QMutexLocker lock(&m_lock);
+		m_status.clear();
+	}
+	reset();
+	m_guard->stage = this;
+
+	/* Both handlers run in the source's thread. */
+	auto guard = m_guard;
+	m_connections << QObject::connect(source, &BaseSource::dataAvailable,
+			this, [guard](SampleBlock block) {
+				QMutexLocker lock(&guard->lock);
+				if (guard->stage) {
+					guard->stage->process(block);
+				}
+			}, Qt::DirectConnection);
+	m_connections << QObject::connect(source, &BaseSource::status,
+			this, [guard](QVariantMap status) {
+				QMutexLocker lock(&guard->lock);
+				if (guard->stage) {
+					QMutexLocker statusLock(&guard->stage->m_lock);
+					guard->stage->m_status = status;
+				}
+			}, Qt::DirectConnection);
+
+	/* The status is requested directly if the source lives in this thread,
+	 * so that its sample rate is known before the first block. Otherwise
+	 * the request is queued, as blocking on a thread which may not be
+	 * running an event loop could block forever.
+	 */
+	QMetaObject::invokeMethod(source, "requestStatus",
+			(source->thread() == QThread::currentThread()) ?
+			Qt::DirectConnection : Qt::QueuedConnection);
+}
+
+void SourceStage::detach()
+{
+	for (auto& connection : m_connections) {
+		QObject::disconnect(connection);
+	}
+	m_connections.clear();
+
+	/* A handler may have started before the connections were removed. */
+	QMutexLocker lock(&m_guard->lock);
+	m_guard->stage = nullptr;
+}
+
+float SourceStage::sampleRate() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_status.value("sample-rate", qSNaN()).toFloat();
+}
+
+double SourceStage::sampleRate(arma::uword nsamples) const
+{
+	const auto rate = sampleRate();
+	return (rate > 0.) ? rate : 1000. * nsamples / std::max(1, m_readInterval);
+}
+
+QVariantMap SourceStage::sourceStatus() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_status;
+}
+
+QMutex& SourceStage::processLock() const
+{
+	return m_guard->lock;
+}
+
+}; // end datasource namespace
+
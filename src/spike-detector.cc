@@ -0,0 +1,323 @@
+/*! \file spike-detector.cc
+ *
+ * Implementation of class detecting spikes in the data emitted by a source.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "spike-detector.h"
+
+#include <algorithm> // std::min, std::max, std::min_element, std::nth_element
+#include <cmath> // std::exp, std::lround
+#include <cstdlib> // std::abs
+#include <limits> // std::numeric_limits
+#include <stdexcept> // std::invalid_argument
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SPIKE_DETECTOR_X86
+# include <immintrin.h>
+#endif
+
+namespace datasource {
+
+/* Ratio of the MAD to the standard deviation of normally-distributed noise. */
+static constexpr double MadPerSigma = 0.6745;
+
+/* Find samples [first, last) below the threshold, one value at a time. */
+static inline void belowScalar(const qint16* in, arma::uword first, arma::uword last,
+		qint16 level, std::vector<arma::uword>& indices)
+{
+	for (auto i = first; i < last; i++) {
+		if (in[i] < level) {
+			indices.push_back(i);
+		}
+	}
+}
+
+#ifdef SPIKE_DETECTOR_X86
+
+/* Append the index of each sample flagged in a byte mask of compared
+ * 16-bit lanes, in which each lane sets two bits.
+ */
+static inline void appendMasked(arma::uword offset, unsigned int mask,
+		std::vector<arma::uword>& indices)
+{
+	while (mask) {
+		const auto bit = __builtin_ctz(mask);
+		indices.push_back(offset + bit / 2);
+		mask &= ~(3U << bit);
+	}
+}
+
+/* Compare 8 samples at a time. */
+__attribute__((target("sse2")))
+static void belowSse2(const qint16* in, arma::uword nsamples, qint16 level,
+		std::vector<arma::uword>& indices)
+{
+	const auto threshold = _mm_set1_epi16(level);
+	arma::uword i = 0;
+	for (; i + 8 <= nsamples; i += 8) {
+		const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		const auto mask = _mm_movemask_epi8(_mm_cmplt_epi16(v, threshold));
+		if (mask) {
+			appendMasked(i, static_cast<unsigned int>(mask), indices);
+		}
+	}
+	belowScalar(in, i, nsamples, level, indices);
+}
+
+/* Compare 16 samples at a time. */
+__attribute__((target("avx2")))
+static void belowAvx2(const qint16* in, arma::uword nsamples, qint16 level,
+		std::vector<arma::uword>& indices)
+{
+	const auto threshold = _mm256_set1_epi16(level);
+	arma::uword i = 0;
+	for (; i + 16 <= nsamples; i += 16) {
+		const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		const auto mask = _mm256_movemask_epi8(_mm256_cmpgt_epi16(threshold, v));
+		if (mask) {
+			appendMasked(i, static_cast<unsigned int>(mask), indices);
+		}
+	}
+	belowScalar(in, i, nsamples, level, indices);
+}
+
+#endif // SPIKE_DETECTOR_X86
+
+void samplesBelow(const qint16* in, arma::uword nsamples, qint16 level,
+		std::vector<arma::uword>& indices, KernelIsa isa)
+{
+	switch (resolveKernelIsa(isa)) {
+#ifdef SPIKE_DETECTOR_X86
+		case KernelIsa::Avx2:
+			belowAvx2(in, nsamples, level, indices);
+			break;
+		case KernelIsa::Sse2:
+			belowSse2(in, nsamples, level, indices);
+			break;
+#endif
+		default:
+			belowScalar(in, 0, nsamples, level, indices);
+			break;
+	}
+}
+
+constexpr double SpikeDetector::DefaultThreshold;
+constexpr double SpikeDetector::DefaultRefractoryPeriod;
+constexpr double SpikeDetector::DefaultNoiseTimeConstant;
+
+SpikeDetector::SpikeDetector(double threshold, QObject* parent) :
+	SourceStage(parent),
+	m_threshold(threshold),
+	m_refractoryPeriod(DefaultRefractoryPeriod),
+	m_noiseTimeConstant(DefaultNoiseTimeConstant),
+	m_isa(KernelIsa::Best),
+	m_position(0),
+	m_refractorySamples(0),
+	m_noiseSamples(0.)
+{
+	if (!(threshold > 0.)) {
+		throw std::invalid_argument("The threshold of a spike detector must be positive.");
+	}
+	qRegisterMetaType<datasource::SpikeEvent>();
+	qRegisterMetaType<QVector<datasource::SpikeEvent>>();
+}
+
+SpikeDetector::~SpikeDetector()
+{
+	detach();
+}
+
+void SpikeDetector::reset()
+{
+	m_position = 0;
+	m_levels.clear();
+	QMutexLocker lock(&m_lock);
+	m_noise.clear();
+	m_thresholds.clear();
+}
+
+double SpikeDetector::threshold() const
+{
+	return m_threshold;
+}
+
+void SpikeDetector::setThreshold(double threshold)
+{
+	if (!(threshold > 0.)) {
+		throw std::invalid_argument("The threshold of a spike detector must be positive.");
+	}
+	m_threshold = threshold;
+}
+
+double SpikeDetector::refractoryPeriod() const
+{
+	return m_refractoryPeriod;
+}
+
+void SpikeDetector::setRefractoryPeriod(double msec)
+{
+	if (!(msec >= 0.)) {
+		throw std::invalid_argument("The refractory period cannot be negative.");
+	}
+	m_refractoryPeriod = msec;
+}
+
+double SpikeDetector::noiseTimeConstant() const
+{
+	return m_noiseTimeConstant;
+}
+
+void SpikeDetector::setNoiseTimeConstant(double seconds)
+{
+	if (!(seconds > 0.)) {
+		throw std::invalid_argument("The time constant of the noise must be positive.");
+	}
+	m_noiseTimeConstant = seconds;
+}
+
+void SpikeDetector::setKernelIsa(KernelIsa isa)
+{
+	m_isa = isa;
+}
+
+QVector<float> SpikeDetector::noise() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_noise;
+}
+
+QVector<qint16> SpikeDetector::thresholds() const
+{
+	QMutexLocker lock(&m_lock);
+	return m_thresholds;
+}
+
+void SpikeDetector::process(const SampleBlock& block)
+{
+	const auto& samples = block.samples();
+	if (samples.is_empty()) {
+		return;
+	}
+	const auto nsamples = samples.n_rows;
+	const auto nchannels = samples.n_cols;
+
+	/* Set up when the first block arrives, at which point the number of
+	 * channels is known, and estimate the noise from the first block
+	 * before looking for spikes in it.
+	 */
+	const bool first = m_levels.empty();
+	if (first) {
+		const auto rate = sampleRate(nsamples);
+		m_refractorySamples = std::max(static_cast<quint64>(
+					std::lround(m_refractoryPeriod * rate / 1000.)), static_cast<quint64>(1));
+		m_noiseSamples = m_noiseTimeConstant * rate;
+		m_median.assign(nchannels, 0.);
+		m_mad.assign(nchannels, 0.);
+		m_levels.assign(nchannels, std::numeric_limits<qint16>::min());
+		m_previous.assign(nchannels, std::numeric_limits<qint16>::max());
+		m_refractoryEnd.assign(nchannels, 0);
+		m_pending.assign(nchannels, SpikeEvent { 0, 0, 0 });
+		m_isPending.assign(nchannels, false);
+		updateNoise(samples, 1.);
+	}
+	if (nchannels != m_levels.size()) {
+		return;
+	}
+
+	QVector<SpikeEvent> spikes;
+	const auto start = m_position;
+	for (arma::uword c = 0; c < nchannels; c++) {
+		const auto* in = samples.colptr(c);
+		const auto level = m_levels[c];
+
+		/* Finish a spike whose refractory period began in an earlier block. */
+		if (m_isPending[c]) {
+			auto& spike = m_pending[c];
+			const auto end = std::min<quint64>(m_refractoryEnd[c] - start, nsamples);
+			spike.amplitude = std::min(spike.amplitude, *std::min_element(in, in + end));
+			if (m_refractoryEnd[c] <= start + nsamples) {
+				spikes << spike;
+				m_isPending[c] = false;
+			}
+		}
+
+		/* A spike begins at a sample below the threshold, following one
+		 * which is not, outside the refractory period of the last spike.
+		 */
+		m_below.clear();
+		samplesBelow(in, nsamples, level, m_below, m_isa);
+		for (auto i : m_below) {
+			const auto sample = start + i;
+			const auto previous = (i > 0) ? in[i - 1] : m_previous[c];
+			if ((sample < m_refractoryEnd[c]) || (previous < level)) {
+				continue;
+			}
+			m_refractoryEnd[c] = sample + m_refractorySamples;
+			const auto end = std::min<quint64>(m_refractoryEnd[c] - start, nsamples);
+			SpikeEvent spike { static_cast<int>(c), sample,
+					*std::min_element(in + i, in + end) };
+			if (m_refractoryEnd[c] <= start + nsamples) {
+				spikes << spike;
+			} else {
+				m_pending[c] = spike;
+				m_isPending[c] = true;
+			}
+		}
+		m_previous[c] = in[nsamples - 1];
+	}
+	m_position += nsamples;
+
+	if (!spikes.isEmpty()) {
+		std::sort(spikes.begin(), spikes.end(),
+				[](const SpikeEvent& a, const SpikeEvent& b) {
+					return (a.sample < b.sample) ||
+						((a.sample == b.sample) && (a.channel < b.channel));
+				});
+		emit spikesAvailable(spikes);
+	}
+	if (!first) {
+		updateNoise(samples, 1. - std::exp(-static_cast<double>(nsamples) / m_noiseSamples));
+	}
+}
+
+void SpikeDetector::updateNoise(const Samples& samples, double weight)
+{
+	const auto nsamples = samples.n_rows;
+	const auto middle = nsamples / 2;
+	for (arma::uword c = 0; c < samples.n_cols; c++) {
+		m_scratch.assign(samples.colptr(c), samples.colptr(c) + nsamples);
+		std::nth_element(m_scratch.begin(), m_scratch.begin() + middle, m_scratch.end());
+		const int median = m_scratch[middle];
+		for (auto& x : m_scratch) {
+			x = static_cast<qint16>(std::min(std::abs(x - median),
+						static_cast<int>(std::numeric_limits<qint16>::max())));
+		}
+		std::nth_element(m_scratch.begin(), m_scratch.begin() + middle, m_scratch.end());
+		const int mad = m_scratch[middle];
+
+		m_median[c] += weight * (median - m_median[c]);
+		m_mad[c] += weight * (mad - m_mad[c]);
+
+		/* A channel without noise, e.g., a digital input, has no spikes. */
+		if (m_mad[c] > 0.) {
+			const auto level = std::lround(m_median[c] - m_threshold * m_mad[c] / MadPerSigma);
+			m_levels[c] = static_cast<qint16>(std::max(level, 
+						static_cast<long>(std::numeric_limits<qint16>::min())));
+		} else {
+			m_levels[c] = std::numeric_limits<qint16>::min();
+		}
+	}
+
+	QMutexLocker lock(&m_lock);
+	m_noise.resize(samples.n_cols);
+	m_thresholds.resize(samples.n_cols);
+	for (arma::uword c = 0; c < samples.n_cols; c++) {
+		m_noise[c] = m_mad[c] / MadPerSigma;
+		m_thresholds[c] = m_levels[c];
+	}
+}
+
+}; // end datasource namespace
+
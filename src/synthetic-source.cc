@@ -0,0 +1,347 @@
+/*! \file synthetic-source.cc
+ *
+ * Implementation of class generating synthetic data, for testing and
+ * load-testing consumers without hardware.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "synthetic-source.h"
+
+#include <algorithm> // std::min, std::max
+#include <cmath> // std::sin, std::lround
+#include <stdexcept> // std::invalid_argument
+
+namespace datasource {
+
+constexpr int SyntheticSource::MaxChannels;
+
+static constexpr double Pi = 3.14159265358979323846;
+
+/* Hash a 32-bit integer. This is a bijection with good avalanche, built
+ * only from shifts, xors and multiplies, so that loops over it vectorize.
+ */
+static inline quint32 mix(quint32 x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+/* GCC only vectorizes loops with unknown trip counts at -O3, so ask for it
+ * explicitly for the generators. Other compilers vectorize them at -O2.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+# define VECTORIZE __attribute__((optimize("tree-vectorize")))
+#else
+# define VECTORIZE
+#endif
+
+/* Saturate a sample to the range of a qint16. */
+static inline qint16 saturate(qint32 x)
+{
+	return static_cast<qint16>(std::min(32767, std::max(-32768, x)));
+}
+
+/* Fill a run of samples with noise, derived from the index of each sample
+ * and a per-channel key, added to a waveform.
+ */
+VECTORIZE static void generateNoise(quint32 start, quint32 key, qint32 amplitude,
+		const qint16* waveform, qint16* out, arma::uword n)
+{
+	for (arma::uword i = 0; i < n; i++) {
+		const auto h = mix((start + static_cast<quint32>(i)) ^ key);
+		const auto noise = ((static_cast<qint32>(h & 0xffff) +
+					static_cast<qint32>(h >> 16) - 65535) * amplitude) >> 16;
+		out[i] = saturate(noise + waveform[i]);
+	}
+}
+
+SyntheticSource::SyntheticSource(const QString& spec, int readInterval, QObject* parent) :
+	BaseSource("synthetic", "synthetic", readInterval, 20000., parent),
+	m_seed(0),
+	m_noise(20),
+	m_sineAmplitude(100),
+	m_spikeRate(5.),
+	m_spikeAmplitude(400),
+	m_spikeInterval(0),
+	m_position(0),
+	m_unthrottled(false)
+{
+	m_sourceLocation = spec;
+	m_nchannels = 64;
+	parseSpec(spec);
+	m_frameSize = static_cast<int>(static_cast<float>(m_readInterval) * m_sampleRate / 1000);
+	if (m_frameSize <= 0) {
+		throw std::invalid_argument("The sample rate and read interval of a synthetic "
+				"source must give at least one sample per chunk.");
+	}
+	buildWaveforms();
+
+	m_gettableParameters.insert("location");
+	m_gettableParameters.insert("unthrottled");
+	m_settableParameters.insert("unthrottled");
+
+	m_timer = new QTimer(this);
+	m_timer->setTimerType(Qt::PreciseTimer);
+	m_timer->setSingleShot(true);
+	QObject::connect(m_timer, &QTimer::timeout,
+			this, &SyntheticSource::generateData);
+}
+
+void SyntheticSource::parseSpec(const QString& spec)
+{
+	for (const auto& item : spec.split(',', QString::SkipEmptyParts)) {
+		const auto key = item.section('=', 0, 0).trimmed();
+		const auto value = item.section('=', 1).trimmed();
+		bool ok = false;
+		if (key == "nchannels") {
+			auto n = value.toInt(&ok);
+			ok = ok && (n > 0) && (n <= MaxChannels);
+			m_nchannels = n;
+		} else if (key == "sample-rate") {
+			m_sampleRate = value.toFloat(&ok);
+			ok = ok && (m_sampleRate > 0.);
+		} else if (key == "seed") {
+			m_seed = value.toUInt(&ok);
+		} else if (key == "noise") {
+			m_noise = value.toInt(&ok);
+			ok = ok && (m_noise >= 0) && (m_noise <= 32767);
+		} else if (key == "sine-amplitude") {
+			m_sineAmplitude = value.toInt(&ok);
+			ok = ok && (m_sineAmplitude >= 0) && (m_sineAmplitude <= 32767);
+		} else if (key == "spike-rate") {
+			m_spikeRate = value.toFloat(&ok);
+			ok = ok && (m_spikeRate >= 0.);
+		} else if (key == "spike-amplitude") {
+			m_spikeAmplitude = value.toInt(&ok);
+			ok = ok && (m_spikeAmplitude >= 0) && (m_spikeAmplitude <= 32767);
+		}
+		if (!ok) {
+			throw std::invalid_argument(QString("Invalid item \"%1\" in the "
+					"specification of a synthetic source.").arg(item).toStdString());
+		}
+	}
+}
+
+void SyntheticSource::buildWaveforms()
+{
+	/* One period of each channel's sinusoid, of between 20 and 500 samples. */
+	m_sineOffsets.resize(m_nchannels);
+	m_sinePeriods.resize(m_nchannels);
+	m_sineTable.clear();
+	for (quint32 c = 0; c < m_nchannels; c++) {
+		const auto period = 20 + static_cast<int>(mix(m_seed ^ mix(c) ^ 0x27d4eb2fU) % 481);
+		m_sineOffsets[c] = static_cast<int>(m_sineTable.size());
+		m_sinePeriods[c] = period;
+		for (int i = 0; i < period; i++) {
+			m_sineTable.push_back(static_cast<qint16>(std::lround(
+					m_sineAmplitude * std::sin(2 * Pi * i / period))));
+		}
+	}
+
+	/* A biphasic spike lasting 1.5ms: a sharp trough, then a slower,
+	 * smaller peak.
+	 */
+	const auto length = std::max(4, static_cast<int>(std::lround(1.5e-3 * m_sampleRate)));
+	const auto trough = std::max(1, 2 * length / 5);
+	m_spikeWaveform.resize(length);
+	for (int i = 0; i < length; i++) {
+		const auto value = (i < trough) ?
+			-m_spikeAmplitude * std::sin(Pi * i / trough) :
+			m_spikeAmplitude / 3. * std::sin(Pi * (i - trough) / (length - trough));
+		m_spikeWaveform[i] = static_cast<qint16>(std::lround(value));
+	}
+
+	/* Spikes are jittered by up to half the interval between them, so
+	 * they must be at most half as long for spikes not to overlap.
+	 */
+	m_spikeInterval = 0;
+	if (m_spikeRate > 0.) {
+		m_spikeInterval = static_cast<quint64>(m_sampleRate / m_spikeRate);
+		if (m_spikeInterval < 2 * static_cast<quint64>(length)) {
+			throw std::invalid_argument("The spike rate of a synthetic source must "
+					"allow at least two spike durations between spikes.");
+		}
+	}
+}
+
+void SyntheticSource::generate(quint64 start, Samples& out) const
+{
+	const auto nsamples = out.n_rows;
+	const auto nchannels = std::min(out.n_cols, static_cast<arma::uword>(m_nchannels));
+	const auto spikeLength = static_cast<quint64>(m_spikeWaveform.size());
+	for (arma::uword c = 0; c < nchannels; c++) {
+		auto* column = out.colptr(c);
+		const auto key = mix(m_seed ^ mix(static_cast<quint32>(c) + 1));
+
+		/* Noise plus the sinusoid, one contiguous run of its period at
+		 * a time, so that the inner loop is a straight vectorizable pass.
+		 */
+		const auto* sine = m_sineTable.data() + m_sineOffsets[c];
+		const auto period = static_cast<quint64>(m_sinePeriods[c]);
+		auto phase = start % period;
+		for (arma::uword i = 0; i < nsamples; ) {
+			const auto n = std::min<arma::uword>(nsamples - i, period - phase);
+			generateNoise(static_cast<quint32>(start + i), key, m_noise,
+					sine + phase, column + i, n);
+			i += n;
+			phase = 0;
+		}
+
+		/* Add the spikes which overlap this chunk. Spike k starts a jittered
+		 * time after the start of the k-th interval, and ends before the
+		 * next interval starts.
+		 */
+		if (m_spikeInterval == 0) {
+			continue;
+		}
+		const quint64 end = start + nsamples;
+		const auto offset = mix(key ^ 0x5bd1e995U) % m_spikeInterval;
+		quint64 k = (start > offset) ? (start - offset) / m_spikeInterval : 0;
+		k = (k > 0) ? (k - 1) : 0;
+		for (; k * m_spikeInterval + offset < end; k++) {
+			const auto jitter = mix(key ^ static_cast<quint32>(k)) % (m_spikeInterval / 2);
+			const auto spikeStart = k * m_spikeInterval + offset + jitter;
+			const auto from = std::max(spikeStart, start);
+			const auto to = std::min(spikeStart + spikeLength, end);
+			for (auto t = from; t < to; t++) {
+				column[t - start] = saturate(column[t - start] +
+						m_spikeWaveform[t - spikeStart]);
+			}
+		}
+	}
+}
+
+void SyntheticSource::set(QString param, QVariant value)
+{
+	if (!m_settableParameters.contains(param)) {
+		emit setResponse(param, false,
+				QString("Cannot set parameter \"%1\" of a synthetic data source.").arg(param));
+		return;
+	}
+
+	if (m_state == "invalid") {
+		emit setResponse(param, false,
+				"Can only set parameters in either 'initialized' or 'streaming' state.");
+		return;
+	}
+
+	if (param == "unthrottled") {
+		if (!value.canConvert<bool>()) {
+			emit setResponse(param, false, "The unthrottled mode must be a boolean.");
+			return;
+		}
+		m_unthrottled = value.toBool();
+
+		/* Resume paced generation from the current position. */
+		if (m_state == "streaming") {
+			m_clock.start();
+			m_timer->start(0);
+		}
+		emit setResponse(param, true);
+	}
+}
+
+void SyntheticSource::get(QString param)
+{
+	if ((m_state != "invalid") && (param == "unthrottled")) {
+		emit getResponse(param, true, m_unthrottled);
+		return;
+	}
+	BaseSource::get(param);
+}
+
+void SyntheticSource::initialize()
+{
+	bool success;
+	QString msg;
+	if (m_state == "invalid") {
+		m_state = "initialized";
+		m_connectTime = QDateTime::currentDateTime();
+		m_gain = 1.;
+		m_adcRange = 1.;
+		m_nchannels = static_cast<quint32>(m_sinePeriods.size());
+		m_pool.reserve(m_frameSize, m_nchannels);
+		success = true;
+	} else {
+		msg = "Can only initialize from the 'invalid' state.";
+		success = false;
+	}
+	emit initialized(success, msg);
+}
+
+void SyntheticSource::startStream()
+{
+	bool success;
+	QString msg;
+	if (m_state == "initialized") {
+		m_state = "streaming";
+		m_startTime = QDateTime::currentDateTime();
+		m_position = 0;
+		m_clock.setSampleRate(m_sampleRate);
+		m_clock.start();
+		m_timer->start(m_unthrottled ? 0 : m_clock.msecsUntil(m_frameSize));
+		success = true;
+	} else {
+		msg = "Can only start stream from 'initialized' state.";
+		success = false;
+	}
+	emit streamStarted(success, msg);
+}
+
+void SyntheticSource::stopStream()
+{
+	bool success;
+	QString msg;
+	if (m_state == "streaming") {
+		m_timer->stop();
+		releaseInFlight();
+		m_state = "initialized";
+		m_startTime = {};
+		success = true;
+	} else {
+		msg = "Can only stop stream from 'streaming' state.";
+		success = false;
+	}
+	emit streamStopped(success, msg);
+}
+
+void SyntheticSource::generateData()
+{
+	if (m_unthrottled) {
+		auto emitted = emitUnthrottled([this]() { return emitNextChunk(); });
+		m_timer->start(emitted ? 0 : 1);
+		return;
+	}
+
+	/* Emit every chunk which the clock says is due. */
+	while (m_clock.pending() >= static_cast<quint64>(m_frameSize)) {
+		emitNextChunk();
+		m_clock.advance(m_frameSize);
+	}
+	m_timer->start(m_clock.msecsUntil(m_frameSize));
+}
+
+std::shared_ptr<Samples> SyntheticSource::emitNextChunk()
+{
+	auto frame = m_pool.acquire(m_frameSize, m_nchannels);
+	generate(m_position, *frame);
+	m_position += m_frameSize;
+	publish(SampleBlock(frame));
+	return frame;
+}
+
+QVariantMap SyntheticSource::packStatus()
+{
+	auto map = BaseSource::packStatus();
+	map.insert("location", m_sourceLocation);
+	map.insert("unthrottled", m_unthrottled);
+	return map;
+}
+
+}; // end datasource namespace
+
@@ -0,0 +1,223 @@
+/*! \file mock-hidens-server.cc
+ *
+ * Implementation of a local stand-in for the HiDens ThreadedServer and FPGA.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#include "mock-hidens-server.h"
+
+constexpr int MockHidensServer::FrameSize;
+constexpr int MockHidensServer::NumDataChannels;
+constexpr int MockHidensServer::PhotodiodePeriod;
+constexpr quint32 MockHidensServer::ChipId;
+
+MockHidensServer::MockHidensServer(float sampleRate, QObject* parent) :
+	QObject(parent),
+	m_sampleRate(sampleRate),
+	m_paced(true),
+	m_plug(1),
+	m_selectedPlug(-1),
+	m_responsive(true),
+	m_nextFrame(0),
+	m_framesSent(0),
+	m_commandsReceived(0)
+{
+	QObject::connect(&m_server, &QTcpServer::newConnection,
+			this, &MockHidensServer::handleNewConnection);
+	QObject::connect(&m_fpgaServer, &QTcpServer::newConnection,
+			this, &MockHidensServer::handleNewFpgaConnection);
+	m_server.listen(QHostAddress::LocalHost);
+	m_fpgaServer.listen(QHostAddress::LocalHost);
+
+	m_clock.start();
+	m_dataTimer.setTimerType(Qt::PreciseTimer);
+	m_dataTimer.setInterval(1);
+	QObject::connect(&m_dataTimer, &QTimer::timeout,
+			this, &MockHidensServer::sendPendingData);
+}
+
+QString MockHidensServer::location() const
+{
+	return QString("127.0.0.1:%1").arg(m_server.serverPort());
+}
+
+QString MockHidensServer::fpgaLocation() const
+{
+	return QString("127.0.0.1:%1").arg(m_fpgaServer.serverPort());
+}
+
+void MockHidensServer::setPaced(bool paced)
+{
+	m_paced = paced;
+}
+
+void MockHidensServer::setPlug(int plug)
+{
+	m_plug = plug;
+}
+
+void MockHidensServer::setResponsive(bool responsive)
+{
+	m_responsive = responsive;
+}
+
+int MockHidensServer::electrodeForChannel(int channel)
+{
+	return ((channel % 3) == 2) ? -1 : 10 * channel + 1;
+}
+
+QByteArray MockHidensServer::receivedConfiguration() const
+{
+	return m_configuration;
+}
+
+quint64 MockHidensServer::framesSent() const
+{
+	return m_framesSent;
+}
+
+int MockHidensServer::commandsReceived() const
+{
+	return m_commandsReceived;
+}
+
+void MockHidensServer::handleNewConnection()
+{
+	auto* client = m_server.nextPendingConnection();
+	if (m_client) {
+		client->disconnectFromHost();
+		client->deleteLater();
+		return;
+	}
+	m_client = client;
+	QObject::connect(client, &QTcpSocket::readyRead,
+			this, &MockHidensServer::handleCommands);
+	QObject::connect(client, &QTcpSocket::disconnected, this, [this, client]() {
+				m_pendingRequests.clear();
+				m_dataTimer.stop();
+				client->deleteLater();
+			});
+}
+
+void MockHidensServer::handleCommands()
+{
+	while (m_client && m_client->bytesAvailable()) {
+
+		/* Pipelined commands are terminated by newlines. A single
+		 * command is written bare, and is taken to be all that arrived.
+		 */
+		auto command = (m_client->canReadLine() ?
+				m_client->readLine() : m_client->readAll()).trimmed();
+		if (!command.isEmpty()) {
+			m_commandsReceived++;
+			if (m_responsive) {
+				handleCommand(command);
+			}
+		}
+	}
+}
+
+void MockHidensServer::handleCommand(const QByteArray& command)
+{
+	auto parts = command.split(' ');
+	const auto& name = parts.first();
+	const auto arg = parts.value(1);
+
+	if ((name == "setbytes") || (name == "header_frameno") ||
+			(name == "client_name")) {
+		reply("ok");
+	} else if (name == "sr") {
+		reply(QByteArray::number(m_sampleRate));
+	} else if (name == "gain") {
+		reply("1000");
+	} else if (name == "adc_range") {
+		reply("2.5");
+	} else if (name == "select") {
+		m_selectedPlug = arg.toInt();
+		if (m_selectedPlug == m_plug) {
+			reply("ok");
+		} else {
+			reply("Error: no chip in plug " + arg);
+		}
+	} else if (name == "id") {
+		reply(QByteArray::number((m_selectedPlug == m_plug) ? ChipId : 65535));
+	} else if (name == "ch") {
+		QByteArray lines;
+		for (int i = 0; i < NumDataChannels; i++) {
+			auto electrode = electrodeForChannel(i);
+			if (electrode >= 0) {
+				lines += QByteArray::number(electrode);
+			}
+			lines += '\n';
+		}
+		m_client->write(lines);
+	} else if ((name == "live") || (name == "stream")) {
+		emit dataRequested();
+		if (name == "live") {
+			m_pendingRequests.clear();
+			m_nextFrame = 0;
+			m_clock.start();
+		}
+		m_pendingRequests.enqueue(static_cast<quint64>(
+					arg.toDouble() * m_sampleRate / 1000.));
+		sendPendingData();
+		if (!m_pendingRequests.isEmpty()) {
+			m_dataTimer.start();
+		}
+	} else {
+		reply("Error: unknown command " + name);
+	}
+}
+
+void MockHidensServer::handleNewFpgaConnection()
+{
+	auto* client = m_fpgaServer.nextPendingConnection();
+	auto buffer = QSharedPointer<QByteArray>::create();
+	QObject::connect(client, &QTcpSocket::readyRead, this, [this, client, buffer]() {
+				*buffer += client->readAll();
+				m_configuration = *buffer;
+			});
+	QObject::connect(client, &QTcpSocket::disconnected, this, [this, client]() {
+				client->deleteLater();
+				emit configurationReceived(m_configuration);
+			});
+}
+
+void MockHidensServer::sendPendingData()
+{
+	if (!m_client) {
+		return;
+	}
+	while (!m_pendingRequests.isEmpty()) {
+		const auto nframes = m_pendingRequests.head();
+		if (m_paced) {
+			auto acquired = static_cast<quint64>(
+					m_clock.nsecsElapsed() * 1e-9 * m_sampleRate);
+			if (acquired < m_nextFrame + nframes) {
+				return;
+			}
+		}
+		m_pendingRequests.dequeue();
+
+		QByteArray data(nframes * FrameSize, '\0');
+		for (quint64 f = 0; f < nframes; f++) {
+			auto* frame = data.data() + f * FrameSize;
+			const auto frameNumber = m_nextFrame + f;
+			for (int c = 0; c < NumDataChannels; c++) {
+				frame[c] = static_cast<char>((frameNumber + c) % 256);
+			}
+			frame[FrameSize - 1] = ((frameNumber / PhotodiodePeriod) % 2) ? 0x08 : 0x00;
+		}
+		m_client->write(data);
+		m_nextFrame += nframes;
+		m_framesSent += nframes;
+	}
+	m_dataTimer.stop();
+}
+
+void MockHidensServer::reply(const QByteArray& line)
+{
+	m_client->write(line + '\n');
+}
+
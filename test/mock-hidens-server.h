@@ -0,0 +1,146 @@
+/*! \file mock-hidens-server.h
+ *
+ * A local stand-in for the HiDens ThreadedServer and FPGA, used to
+ * test and benchmark the HidensSource without hardware.
+ *
+ * (C) 2017 Benjamin Naecker bnaecker@stanford.edu
+ */
+
+#ifndef MOCK_HIDENS_SERVER_H
+#define MOCK_HIDENS_SERVER_H
+
+#include <QtCore>
+#include <QtNetwork>
+
+/*! \class MockHidensServer
+ *
+ * The MockHidensServer implements the subset of the HiDens ThreadedServer's
+ * text protocol used by the HidensSource, on a loopback port. It answers
+ * the `setbytes`, `header_frameno`, `client_name`, `sr`, `gain`, `adc_range`,
+ * `select`, `id` and `ch` commands, and answers `live` and `stream` requests
+ * with 131-byte frames of synthetic data. Commands terminated by newlines
+ * are handled one line at a time, and unterminated data is handled as a
+ * single command, as the server does for a bare command.
+ *
+ * Frames are generated at the configured sample rate, so that each data
+ * request is answered once the requested interval of data would have been
+ * acquired. If pacing is disabled, requests are answered immediately, which
+ * is useful for measuring the throughput of the source itself.
+ *
+ * Byte `c` of frame `f`, counted from the most recent `live` request, holds
+ * `(f + c) % 256` for each data channel. The photodiode bit is set in
+ * every other block of PhotodiodePeriod frames.
+ *
+ * A second port stands in for the FPGA, and records any configuration
+ * sent to it.
+ */
+class MockHidensServer : public QObject {
+	Q_OBJECT
+
+	public:
+
+		/*! Number of bytes in each frame. */
+		static constexpr int FrameSize = 131;
+
+		/*! Number of data channels, for which `ch` returns electrodes. */
+		static constexpr int NumDataChannels = 126;
+
+		/*! Number of frames in each half-period of the photodiode signal. */
+		static constexpr int PhotodiodePeriod = 100;
+
+		/*! Chip ID returned for plugs containing a chip. */
+		static constexpr quint32 ChipId = 1234;
+
+		/*! Construct a server, listening on ephemeral loopback ports.
+		 * \param sampleRate The rate at which frames are generated.
+		 * \param parent Parent for this object.
+		 */
+		explicit MockHidensServer(float sampleRate = 20000.,
+				QObject* parent = nullptr);
+
+		/*! Return the location of the ThreadedServer stand-in, as "host:port". */
+		QString location() const;
+
+		/*! Return the location of the FPGA stand-in, as "host:port". */
+		QString fpgaLocation() const;
+
+		/*! Set whether data requests are answered at the sample rate (the
+		 * default), or as fast as possible.
+		 */
+		void setPaced(bool paced);
+
+		/*! Set the plug which contains a chip. Other plugs are empty. */
+		void setPlug(int plug);
+
+		/*! Set whether commands are answered (the default), or silently
+		 * ignored, as by a server which has hung.
+		 */
+		void setResponsive(bool responsive);
+
+		/*! Return the electrode connected to the given data channel, or -1
+		 * if the channel is not routed. Every third channel is unrouted.
+		 */
+		static int electrodeForChannel(int channel);
+
+		/*! Return the configuration last sent to the FPGA stand-in. */
+		QByteArray receivedConfiguration() const;
+
+		/*! Return the total number of frames sent. */
+		quint64 framesSent() const;
+
+		/*! Return the number of commands received, including data requests. */
+		int commandsReceived() const;
+
+	signals:
+		/*! Emitted when a `live` or `stream` request is received, before
+		 * it is answered.
+		 */
+		void dataRequested();
+
+		/*! Emitted when a configuration has been received by the FPGA. */
+		void configurationReceived(QByteArray config);
+
+	private:
+		void handleNewConnection();
+		void handleCommands();
+		void handleCommand(const QByteArray& command);
+		void handleNewFpgaConnection();
+		void sendPendingData();
+		void reply(const QByteArray& line);
+
+		/* Server and current client for the text protocol. */
+		QTcpServer m_server;
+		QPointer<QTcpSocket> m_client;
+
+		/* Server accepting configurations for the FPGA. */
+		QTcpServer m_fpgaServer;
+		QByteArray m_configuration;
+
+		/* Rate at which frames are generated. */
+		float m_sampleRate;
+		bool m_paced;
+
+		/* Plug containing a chip, and the currently selected plug. */
+		int m_plug;
+		int m_selectedPlug;
+
+		/* Whether commands are answered. */
+		bool m_responsive;
+
+		/* Number of frames requested by data requests not yet answered. */
+		QQueue<quint64> m_pendingRequests;
+
+		/* Time of the most recent `live` request. */
+		QElapsedTimer m_clock;
+
+		/* Number of frames sent since the most recent `live` request. */
+		quint64 m_nextFrame;
+		quint64 m_framesSent;
+		int m_commandsReceived;
+
+		/* Timer polling for data which has become available. */
+		QTimer m_dataTimer;
+};
+
+#endif
+
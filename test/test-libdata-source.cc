@@ -7,8 +7,41 @@
 
 #include "test-libdata-source.h"
 
+#include <algorithm> // std::any_of, std::nth_element
+#include <atomic>
+#include <cmath> // std::abs, std::acos, std::ceil, std::lround, std::sin
+#include <cstdlib> // std::malloc, std::free
+#include <limits> // std::numeric_limits
+#include <new> // std::bad_alloc
+#include <stdexcept> // std::runtime_error
+#include <utility> // std::pair
+
 using namespace datasource;
 
+/* Count every allocation made through the global operator new,
+ * so that tests may verify that a code path does not allocate.
+ */
+static std::atomic<quint64> allocationCount { 0 };
+
+void* operator new(std::size_t size)
+{
+	allocationCount++;
+	if (auto* p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
 void TestLibDataSource::initTestCase()
 {
 	sources.insert("base", new BaseSource);
@@ -127,6 +160,69 @@ void TestLibDataSource::createParameterList()
 			"\x01\x00\x00\x00"
 	};
 
+	parameters << Parameter {
+			"pipeline-depth",
+			{ "hidens" },
+			{ "hidens" },
+			4,
+			100,
+			"\x04\x00\x00\x00"
+	};
+
+	parameters << Parameter {
+			"prefetch-depth",
+			{ "file" },
+			{ "file" },
+			2,
+			0,
+			"\x02\x00\x00\x00"
+	};
+
+	parameters << Parameter {
+			"playback-rate",
+			{ "file" },
+			{ "file" },
+			2.0f,
+			-1.0f,
+			"\x00\x00\x00@"
+	};
+
+	parameters << Parameter {
+			"position",
+			{ "file" },
+			{ "file" },
+			0,
+			-1,
+			"\x00\x00\x00\x00\x00\x00\x00\x00"
+	};
+
+	parameters << Parameter {
+			"channels",
+			{ "file" },
+			{ "file" },
+			QVariantList { },
+			QVariantList { -1 },
+			"\x00\x00\x00\x00"
+	};
+
+	parameters << Parameter {
+			"chunk-cache-capacity",
+			{ "file" },
+			{ "file" },
+			static_cast<quint64>(ChunkCache::DefaultCapacity),
+			-1,
+			QByteArray("\x00\x00\x00\x10\x00\x00\x00\x00", 8)
+	};
+
+	parameters << Parameter {
+			"loop-range",
+			{ "file" },
+			{ "file" },
+			QVariantList { 0, 100 },
+			QVariantList { 100, 0 },
+			"\x00\x00\x00\x00\x00\x00\x00\x00d\x00\x00\x00\x00\x00\x00\x00"
+	};
+
 	parameters << Parameter {
 			"chip-id",
 			{ },
@@ -341,6 +437,2018 @@ void TestLibDataSource::testSignals()
 	}
 }
 
+void TestLibDataSource::testSerialize()
+{
+	/* Positions and loop ranges must keep whether they are sample
+	 * indices or times in seconds.
+	 */
+	auto position = deserialize("position", serialize("position", 1.5));
+	QCOMPARE(static_cast<QMetaType::Type>(position.type()), QMetaType::Double);
+	QCOMPARE(position.toDouble(), 1.5);
+	position = deserialize("position", serialize("position", 100));
+	QCOMPARE(static_cast<QMetaType::Type>(position.type()), QMetaType::ULongLong);
+	QCOMPARE(position.toULongLong(), quint64(100));
+
+	auto range = deserialize("loop-range",
+			serialize("loop-range", QVariantList{ 100, 2.5 })).toList();
+	QCOMPARE(range.size(), 2);
+	QCOMPARE(static_cast<QMetaType::Type>(range.at(0).type()), QMetaType::ULongLong);
+	QCOMPARE(range.at(0).toULongLong(), quint64(100));
+	QCOMPARE(static_cast<QMetaType::Type>(range.at(1).type()), QMetaType::Double);
+	QCOMPARE(range.at(1).toDouble(), 2.5);
+	QVERIFY(deserialize("loop-range",
+			serialize("loop-range", QVariantList{})).toList().isEmpty());
+
+	/* Channel strings, and lists holding ranges, must reach the source
+	 * as written rather than as an empty list selecting every channel.
+	 */
+	QCOMPARE(deserialize("channels", serialize("channels", "0-3,7")).toString(),
+			QString("0-3,7"));
+	QCOMPARE(deserialize("channels",
+			serialize("channels", QVariantList{ "0-3", 7 })).toString(),
+			QString("0-3,7"));
+	auto channels = deserialize("channels",
+			serialize("channels", QVariantList{ 3, 1, 2 })).toList();
+	QCOMPARE(channels, (QVariantList{ 3u, 1u, 2u }));
+}
+
+void TestLibDataSource::testSampleBlock()
+{
+	/* Copies of a block must share, not duplicate, the underlying data. */
+	Samples s(100, 64, arma::fill::ones);
+	SampleBlock block(std::move(s));
+	QVERIFY(block.useCount() == 1);
+	QVERIFY(block.nsamples() == 100);
+	QVERIFY(block.nchannels() == 64);
+	{
+		auto copy = block;
+		QVERIFY(copy.memptr() == block.memptr());
+		QVERIFY(block.useCount() == 2);
+
+		/* Copies made through a QVariant, as is done for queued
+		 * connections, must also share the data.
+		 */
+		auto variant = QVariant::fromValue(block);
+		QVERIFY(variant.value<SampleBlock>().memptr() == block.memptr());
+	}
+	QVERIFY(block.useCount() == 1);
+
+	/* Views must alias the block's data. */
+	QVERIFY(block.channel(1).colmem == block.memptr() + block.nsamples());
+	QVERIFY(arma::accu(block.range(10, 19)) == 10 * 64);
+
+	/* Default-constructed blocks are empty. */
+	QVERIFY(SampleBlock{}.isEmpty());
+}
+
+void TestLibDataSource::testFrameRing()
+{
+	/* Frames are delivered in order, and dropped when the ring is full. */
+	FrameRing ring(2);
+	ring.reserve(10, 4);
+	QVERIFY(ring.front() == nullptr);
+	QVERIFY(ring.push(Samples(10, 4, arma::fill::zeros)));
+	QVERIFY(ring.push(Samples(10, 4, arma::fill::ones)));
+	QVERIFY(!ring.push(Samples(10, 4, arma::fill::ones)));
+	QVERIFY(ring.overruns() == 1);
+	QVERIFY(ring.size() == 2);
+	QVERIFY(ring.front()->at(0) == 0);
+	ring.pop();
+	QVERIFY(ring.front()->at(0) == 1);
+	ring.pop();
+	QVERIFY(ring.front() == nullptr);
+	QVERIFY(!ring.wait(10));
+
+	/* Pull data from a streaming source without the event loop. */
+	auto source = sources["file"];
+	auto handle = source->attachRing(16);
+	QMetaObject::invokeMethod(source, "startStream", Qt::QueuedConnection);
+	for (int i = 0; i < 3; i++) {
+		QVERIFY(handle->wait(1000));
+		QVERIFY(handle->front()->n_cols > 0);
+		QVERIFY(handle->front()->n_rows > 0);
+		handle->pop();
+	}
+	QSignalSpy stopSpy(source.data(), &BaseSource::streamStopped);
+	QMetaObject::invokeMethod(source, "stopStream", Qt::QueuedConnection);
+	QVERIFY(stopSpy.wait(1000));
+}
+
+void TestLibDataSource::testFramePool()
+{
+	FramePool pool(4);
+	pool.reserve(200, 127);
+	QVERIFY(pool.size() == 4);
+
+	/* Warm up, then verify the steady-state path never allocates: neither
+	 * through operator new (e.g., shared pointer control blocks) nor
+	 * through the pool's own slab allocations.
+	 */
+	pool.acquire(200, 127);
+	auto poolAllocations = pool.allocations();
+	const int nframes = 1000;
+	std::vector<const qint16*> slabs;
+	slabs.reserve(nframes);
+	bool valid = true;
+	auto allocations = allocationCount.load();
+	for (int i = 0; i < nframes; i++) {
+		auto frame = pool.acquire(200, 127);
+		frame->fill(static_cast<qint16>(i));
+		SampleBlock block(frame);
+		frame.reset();
+
+		/* Fan out to several consumers. */
+		auto display = block, writer = block, detector = block;
+		valid &= (writer.samples().at(0, 0) == static_cast<qint16>(i));
+		slabs.push_back(block.memptr());
+	}
+	QCOMPARE(allocationCount.load(), allocations);
+	QCOMPARE(pool.allocations(), poolAllocations);
+	QVERIFY(valid);
+	QSet<const qint16*> unique;
+	for (auto* slab : slabs) {
+		unique.insert(slab);
+	}
+	QVERIFY(unique.size() <= pool.size());
+
+	/* Blocks held by consumers are not recycled; the pool grows instead. */
+	QVector<SampleBlock> held;
+	for (int i = 0; i < 6; i++) {
+		held << SampleBlock(pool.acquire(200, 127));
+	}
+	QVERIFY(pool.size() == 6);
+	QVERIFY(pool.inUse() == 6);
+	held.clear();
+	QVERIFY(pool.inUse() == 0);
+}
+
+/* Reference conversion of raw HiDens frames, as originally implemented
+ * with Armadillo in HidensSource::recvDataFrame().
+ */
+static Samples convertHidensReference(arma::Mat<uchar> raw)
+{
+	raw.row(HidensFrameBytes - 1).for_each(
+			[](uchar& x) { x = ( x & HidensPhotodiodeMask ) ? 255 : 0; });
+	Samples out(raw.n_cols, HidensEmittedChannels);
+	const auto flip = static_cast<qint16>(-1);
+	out.cols(0, HidensDataChannels - 1) = 
+			arma::conv_to<Samples>::from(
+			raw.rows(0, HidensDataChannels - 1).t()) * flip;
+	out.col(HidensEmittedChannels - 1) = 
+			arma::conv_to<Samples>::from(
+			raw.row(HidensFrameBytes - 1).t()) * flip;
+	return out;
+}
+
+void TestLibDataSource::testHidensConversion()
+{
+	/* Include sizes which are not a multiple of the kernels' block size. */
+	arma::arma_rng::set_seed(4);
+	for (arma::uword nframes : { 1, 15, 16, 17, 200, 237 }) {
+		arma::Mat<uchar> raw = arma::randi<arma::Mat<uchar>>(
+				HidensFrameBytes, nframes, arma::distr_param(0, 255));
+		auto expected = convertHidensReference(raw);
+		for (auto isa : { KernelIsa::Scalar, KernelIsa::Sse2, 
+				KernelIsa::Avx2, KernelIsa::Best }) {
+			if (!kernelSupported(isa)) {
+				continue;
+			}
+			Samples out(nframes, HidensEmittedChannels, arma::fill::zeros);
+			convertHidensFrames(raw.memptr(), nframes, out.memptr(), isa);
+			QVERIFY(arma::all(arma::vectorise(out == expected)));
+		}
+
+		/* Gather a sparse subset of the channels. */
+		std::vector<int> columns(HidensDataChannels, -1);
+		std::vector<arma::uword> gathered;
+		for (int c = 0; c < HidensDataChannels; c += 5) {
+			columns[c] = gathered.size();
+			gathered.push_back(c);
+		}
+		gathered.push_back(HidensDataChannels);
+		Samples sparse = expected.cols(arma::uvec(gathered));
+		for (auto isa : { KernelIsa::Scalar, KernelIsa::Sse2, KernelIsa::Avx2 }) {
+			if (!kernelSupported(isa)) {
+				continue;
+			}
+			Samples out(nframes, gathered.size(), arma::fill::zeros);
+			convertHidensFrames(raw.memptr(), nframes, columns.data(), 
+					gathered.size(), out.memptr(), isa);
+			QVERIFY(arma::all(arma::vectorise(out == sparse)));
+		}
+	}
+}
+
+void TestLibDataSource::benchmarkHidensConversion_data()
+{
+	QTest::addColumn<int>("isa");
+	QTest::newRow("armadillo") << -1;
+	QTest::newRow("scalar") << static_cast<int>(KernelIsa::Scalar);
+	if (kernelSupported(KernelIsa::Sse2)) {
+		QTest::newRow("sse2") << static_cast<int>(KernelIsa::Sse2);
+	}
+	if (kernelSupported(KernelIsa::Avx2)) {
+		QTest::newRow("avx2") << static_cast<int>(KernelIsa::Avx2);
+	}
+}
+
+void TestLibDataSource::benchmarkHidensConversion()
+{
+	QFETCH(int, isa);
+
+	/* One 10ms chunk at 20kHz. */
+	const arma::uword nframes = 200;
+	arma::arma_rng::set_seed(4);
+	arma::Mat<uchar> raw = arma::randi<arma::Mat<uchar>>(
+			HidensFrameBytes, nframes, arma::distr_param(0, 255));
+	Samples out(nframes, HidensEmittedChannels);
+	if (isa < 0) {
+		QBENCHMARK {
+			out = convertHidensReference(raw);
+		}
+	} else {
+		QBENCHMARK {
+			convertHidensFrames(raw.memptr(), nframes, out.memptr(),
+					static_cast<KernelIsa>(isa));
+		}
+	}
+}
+
+void TestLibDataSource::testElectrodeTable()
+{
+	QCOMPARE(electrodeCount(), 11016);
+
+	/* First and last lines of the electrode list, and one in row -1. */
+	auto first = electrodeAt(0);
+	QCOMPARE(first.xpos, 191700u);
+	QCOMPARE(first.ypos, 117711u);
+	QCOMPARE(first.x, static_cast<quint16>(1));
+	QCOMPARE(first.y, static_cast<quint16>(1));
+	QCOMPARE(first.label, static_cast<quint8>('A'));
+	auto last = electrodeAt(11015);
+	QCOMPARE(last.index, 11015u);
+	QCOMPARE(last.xpos, 1892700u);
+	QCOMPARE(last.ypos, 2086328u);
+	QCOMPARE(last.x, static_cast<quint16>(106));
+	QCOMPARE(last.y, static_cast<quint16>(202));
+	QCOMPARE(last.label, static_cast<quint8>('E'));
+	QCOMPARE(electrodeRecord(8)->y, static_cast<qint16>(-1));
+	QCOMPARE(electrodeIndex(9, -1), 8);
+
+	/* The reverse lookup is the inverse of the table. */
+	for (int i = 0; i < electrodeCount(); i++) {
+		auto* record = electrodeRecord(i);
+		QVERIFY(record);
+		QCOMPARE(electrodeIndex(record->x, record->y), i);
+	}
+
+	/* Invalid indices and positions. */
+	QVERIFY(!electrodeRecord(-1));
+	QVERIFY(!electrodeRecord(electrodeCount()));
+	QCOMPARE(electrodeAt(-1).xpos, 0u);
+	QCOMPARE(electrodeIndex(-1, 0), -1);
+	QCOMPARE(electrodeIndex(0, 1000), -1);
+}
+
+/* Set a parameter on a source living in this thread, and wait for
+ * the response to it.
+ */
+static bool setAndWait(BaseSource& source, const QString& param, 
+		const QVariant& value, const QString& responseParam = QString())
+{
+	QSignalSpy spy(&source, &BaseSource::setResponse);
+	source.set(param, value);
+	const auto expected = responseParam.isNull() ? param : responseParam;
+	while (spy.isEmpty() || (spy.last().at(0).toString() != expected)) {
+		if (!spy.wait(1000)) {
+			return false;
+		}
+	}
+	return spy.last().at(1).toBool();
+}
+
+/* Get the configuration of a source living in this thread. */
+static QConfiguration configurationOf(BaseSource& source)
+{
+	QConfiguration config;
+	auto conn = QObject::connect(&source, &BaseSource::getResponse,
+			[&config](QString, bool, QVariant data) {
+				config = data.value<QConfiguration>();
+			});
+	source.get("configuration");
+	QObject::disconnect(conn);
+	return config;
+}
+
+/* Initialize a HiDens source connected to the mock server, and select
+ * the plug containing its chip.
+ */
+static void initializeHidensSource(HidensSource& source)
+{
+	QSignalSpy spy(&source, &BaseSource::initialized);
+	source.initialize();
+	QVERIFY(spy.wait(1000));
+	QVERIFY(spy.first().at(0).toBool());
+	QVERIFY(setAndWait(source, "plug", 1));
+	QTRY_COMPARE(configurationOf(source).size(), 127);
+}
+
+void TestLibDataSource::testHidensSource()
+{
+	MockHidensServer server;
+	HidensSource source(server.location());
+	initializeHidensSource(source);
+	if (QTest::currentTestFailed()) {
+		return;
+	}
+
+	/* The handshake is timed. */
+	QSignalSpy statusSpy(&source, &BaseSource::status);
+	source.requestStatus();
+	QCOMPARE(statusSpy.size(), 1);
+	auto status = statusSpy.first().at(0).toMap();
+	QVERIFY(status["initialization-time"].toFloat() > 0.);
+
+	/* Only plug 1 of the mock contains a chip. */
+	QVERIFY(!setAndWait(source, "plug", 2));
+	QVERIFY(setAndWait(source, "plug", 1));
+
+	/* Configuration is built from the channels reported by the server. */
+	QTRY_COMPARE(configurationOf(source).size(), 127);
+	auto config = configurationOf(source);
+	for (int i = 0; i < MockHidensServer::NumDataChannels; i++) {
+		auto electrode = MockHidensServer::electrodeForChannel(i);
+		if (electrode < 0) {
+			QCOMPARE(config.at(i).index, 0u);
+			QCOMPARE(config.at(i).xpos, 0u);
+		} else {
+			QCOMPARE(config.at(i).index, static_cast<quint32>(electrode));
+			QCOMPARE(config.at(i).xpos, electrodeRecord(electrode)->xpos);
+		}
+	}
+
+	/* Configurations are sent to the FPGA. */
+	QTemporaryDir dir;
+	QFile configFile(dir.filePath("test.cmdraw.nrk2"));
+	QVERIFY(configFile.open(QIODevice::WriteOnly));
+	const QByteArray configData { "not-really-a-configuration" };
+	configFile.write(configData);
+	configFile.close();
+	QVERIFY(setAndWait(source, "fpga-location", server.fpgaLocation()));
+	QVERIFY(!setAndWait(source, "fpga-location", "host:port"));
+	QVERIFY(setAndWait(source, "configuration-file", configFile.fileName(), 
+			"configuration"));
+	QTRY_COMPARE(server.receivedConfiguration(), configData);
+
+	/* Stream data, and verify each block against the mock's pattern. */
+	QVERIFY(setAndWait(source, "pipeline-depth", 4));
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	QSignalSpy startSpy(&source, &BaseSource::streamStarted);
+	source.startStream();
+	QCOMPARE(startSpy.size(), 1);
+	QVERIFY(startSpy.first().at(0).toBool());
+	QTRY_VERIFY(dataSpy.size() >= 5);
+
+	QSignalSpy stopSpy(&source, &BaseSource::streamStopped);
+	source.stopStream();
+	QCOMPARE(stopSpy.size(), 1);
+	QVERIFY(stopSpy.first().at(0).toBool());
+
+	quint64 frame = 0;
+	for (auto& args : dataSpy) {
+		auto block = args.at(0).value<SampleBlock>();
+		QCOMPARE(block.nchannels(), static_cast<arma::uword>(HidensEmittedChannels));
+		for (arma::uword f = 0; f < block.nsamples(); f++, frame++) {
+			for (int c = 0; c < HidensDataChannels; c++) {
+				QCOMPARE(block.samples()(f, c), 
+						static_cast<qint16>(-static_cast<int>((frame + c) % 256)));
+			}
+			auto photodiode = ((frame / MockHidensServer::PhotodiodePeriod) % 2) ? -255 : 0;
+			QCOMPARE(block.samples()(f, HidensDataChannels), 
+					static_cast<qint16>(photodiode));
+		}
+	}
+
+	/* Commands are answered again once the stream has been flushed. */
+	QVERIFY(setAndWait(source, "plug", 1));
+
+	/* Selecting a plug is answered even if the server stops replying. */
+	server.setResponsive(false);
+	QSignalSpy setSpy(&source, &BaseSource::setResponse);
+	source.set("plug", 1);
+	QTRY_COMPARE(setSpy.size(), 1);
+	QCOMPARE(setSpy.first().at(0).toString(), QString("plug"));
+	QVERIFY(!setSpy.first().at(1).toBool());
+}
+
+void TestLibDataSource::testHidensConnectedMode()
+{
+	MockHidensServer server;
+	HidensSource source(server.location());
+	initializeHidensSource(source);
+	if (QTest::currentTestFailed()) {
+		return;
+	}
+
+	QVERIFY(!setAndWait(source, "emit-mode", "some"));
+	QVERIFY(setAndWait(source, "emit-mode", "connected"));
+
+	/* The configuration lists only the routed channels and photodiode. */
+	std::vector<int> routed;
+	for (int i = 0; i < MockHidensServer::NumDataChannels; i++) {
+		if (MockHidensServer::electrodeForChannel(i) >= 0) {
+			routed.push_back(i);
+		}
+	}
+	auto config = configurationOf(source);
+	QCOMPARE(config.size(), static_cast<int>(routed.size() + 1));
+	for (size_t i = 0; i < routed.size(); i++) {
+		QCOMPARE(config.at(i).index, static_cast<quint32>(
+				MockHidensServer::electrodeForChannel(routed[i])));
+	}
+	QCOMPARE(config.last().index, 0u);
+
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	source.startStream();
+	QTRY_VERIFY(dataSpy.size() >= 1);
+	source.stopStream();
+
+	auto block = dataSpy.first().at(0).value<SampleBlock>();
+	QCOMPARE(block.nchannels(), static_cast<arma::uword>(routed.size() + 1));
+	for (arma::uword f = 0; f < block.nsamples(); f++) {
+		for (size_t i = 0; i < routed.size(); i++) {
+			QCOMPARE(block.samples()(f, i), 
+					static_cast<qint16>(-static_cast<int>((f + routed[i]) % 256)));
+		}
+	}
+
+	/* Switching back emits all channels again. */
+	QVERIFY(setAndWait(source, "emit-mode", "full"));
+	QCOMPARE(configurationOf(source).size(), HidensEmittedChannels);
+}
+
+void TestLibDataSource::benchmarkHidensStream_data()
+{
+	QTest::addColumn<int>("depth");
+	QTest::newRow("depth-1") << 1;
+	QTest::newRow("depth-4") << 4;
+}
+
+void TestLibDataSource::benchmarkHidensStream()
+{
+	QFETCH(int, depth);
+
+	/* Answer requests as fast as possible, measuring the throughput
+	 * of the source over loopback.
+	 */
+	MockHidensServer server;
+	server.setPaced(false);
+	HidensSource source(server.location());
+	initializeHidensSource(source);
+	if (QTest::currentTestFailed()) {
+		return;
+	}
+	QVERIFY(setAndWait(source, "pipeline-depth", depth));
+
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	source.startStream();
+	const int nblocks = 100;
+	QBENCHMARK {
+		dataSpy.clear();
+		while (dataSpy.size() < nblocks) {
+			QVERIFY(dataSpy.wait(1000));
+		}
+	}
+	source.stopStream();
+}
+
+void TestLibDataSource::benchmarkHidensLatency_data()
+{
+	benchmarkHidensStream_data();
+}
+
+void TestLibDataSource::benchmarkHidensLatency()
+{
+	QFETCH(int, depth);
+
+	/* Answer each request as soon as it arrives, and measure the median
+	 * time from the server receiving a request to the source emitting the
+	 * chunk answering it, i.e., the delay the source adds to a chunk once
+	 * it has been acquired. Requests are answered in order.
+	 */
+	MockHidensServer server;
+	server.setPaced(false);
+	HidensSource source(server.location());
+	initializeHidensSource(source);
+	if (QTest::currentTestFailed()) {
+		return;
+	}
+	QVERIFY(setAndWait(source, "pipeline-depth", depth));
+
+	const int nblocks = 200;
+	QElapsedTimer clock;
+	clock.start();
+	QQueue<qint64> requests;
+	std::vector<qint64> latencies;
+	QObject::connect(&server, &MockHidensServer::dataRequested, &source,
+			[&clock, &requests]() { requests.enqueue(clock.nsecsElapsed()); });
+	QObject::connect(&source, &BaseSource::dataAvailable, &server,
+			[&clock, &requests, &latencies](SampleBlock) {
+				if (!requests.isEmpty()) {
+					latencies.push_back(clock.nsecsElapsed() - requests.dequeue());
+				}
+			});
+	source.startStream();
+	QTRY_VERIFY(latencies.size() >= nblocks);
+	source.stopStream();
+
+	std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2,
+			latencies.end());
+	QTest::setBenchmarkResult(latencies[latencies.size() / 2] / 1e6,
+			QTest::WalltimeMilliseconds);
+}
+
+void TestLibDataSource::testFilePrefetcher()
+{
+	FileSource source("test-file.h5");
+	source.initialize();
+	QVERIFY(setAndWait(source, "prefetch-depth", 3));
+	QVERIFY(!setAndWait(source, "prefetch-depth", FilePrefetcher::MaxDepth + 1));
+
+	/* Chunks are emitted in order from the start of the file. */
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	source.startStream();
+	QTRY_VERIFY(dataSpy.size() >= 5);
+	source.stopStream();
+
+	QMutexLocker hdf5(hdf5Mutex());
+	datafile::DataFile file("test-file.h5");
+	quint64 start = 0;
+	for (auto& args : dataSpy) {
+		auto block = args.at(0).value<SampleBlock>();
+		Samples expected;
+		file.data(0, block.nchannels(), start, start + block.nsamples(), expected);
+		QVERIFY(arma::all(arma::vectorise(block.samples() == expected)));
+		start += block.nsamples();
+	}
+
+	QSignalSpy statusSpy(&source, &BaseSource::status);
+	source.requestStatus();
+	auto status = statusSpy.first().at(0).toMap();
+	QVERIFY(status["prefetch-hits"].toULongLong() >= 5);
+	QVERIFY(status.contains("prefetch-misses"));
+
+	/* A file which can't be read stops prefetching, and is reported
+	 * rather than terminating the program.
+	 */
+	struct UnreadableFile : public RecordingFile {
+		QString array() const Q_DECL_OVERRIDE { return "hexagonal"; }
+		quint64 nsamples() const Q_DECL_OVERRIDE { return 1000; }
+		int nchannels() const Q_DECL_OVERRIDE { return 4; }
+		float sampleRate() const Q_DECL_OVERRIDE { return 10000; }
+		float gain() const Q_DECL_OVERRIDE { return 1; }
+		float offset() const Q_DECL_OVERRIDE { return 0; }
+		void data(int, int, quint64, quint64, Samples&) Q_DECL_OVERRIDE {
+			throw std::runtime_error("unreadable");
+		}
+	} unreadable;
+	FilePrefetcher prefetcher(&unreadable);
+	prefetcher.setChunkSize(100);
+	QSignalSpy failedSpy(&prefetcher, &FilePrefetcher::readFailed);
+	prefetcher.startReading(0);
+	QTRY_COMPARE(failedSpy.size(), 1);
+	QVERIFY(failedSpy.first().at(0).toString().contains("unreadable"));
+	QVERIFY(prefetcher.wait(1000));
+	QVERIFY(prefetcher.take() == nullptr);
+}
+
+void TestLibDataSource::testFilePlaybackRate()
+{
+	FileSource source("test-file.h5");
+	source.initialize();
+	QVERIFY(!setAndWait(source, "playback-rate", 0.));
+	QVERIFY(!setAndWait(source, "playback-rate", FileSource::MaxPlaybackRate * 2));
+
+	/* Paced playback never runs ahead of the samples due at the playback
+	 * rate, timed from before the stream starts, and keeps emitting. At
+	 * a quarter of real time, playback at any faster rate would overtake
+	 * the samples due within the first few blocks.
+	 */
+	QSignalSpy statusSpy(&source, &BaseSource::status);
+	source.requestStatus();
+	const auto sampleRate = statusSpy.first().at(0).toMap()["sample-rate"].toDouble();
+	for (double rate : { 4., 0.25 }) {
+		QVERIFY(setAndWait(source, "playback-rate", rate));
+		QElapsedTimer timer;
+		quint64 nsamples = 0;
+		int nblocks = 0;
+		bool ahead = false;
+		auto conn = QObject::connect(&source, &BaseSource::dataAvailable, 
+				[&](SampleBlock block) {
+					nsamples += block.nsamples();
+					nblocks++;
+					auto due = timer.nsecsElapsed() * 1e-9 * sampleRate * rate;
+					ahead = ahead || (nsamples > due + 1);
+				});
+		timer.start();
+		source.startStream();
+		QTRY_VERIFY(nblocks >= 5);
+		source.stopStream();
+		QObject::disconnect(conn);
+		QVERIFY(!ahead);
+	}
+
+	/* Unthrottled playback ignores the clock, emitting in moments what
+	 * would take minutes at the slowest rate.
+	 */
+	int count = 0;
+	QObject::connect(&source, &BaseSource::dataAvailable, 
+			[&count](SampleBlock) { count++; });
+	QVERIFY(setAndWait(source, "playback-rate", 0.01));
+	QVERIFY(setAndWait(source, "unthrottled", true));
+	source.startStream();
+	QTRY_VERIFY(count >= 100);
+	source.stopStream();
+
+	/* Consumers holding on to blocks stall unthrottled playback. */
+	std::vector<SampleBlock> held;
+	QObject::connect(&source, &BaseSource::dataAvailable, 
+			[&held](SampleBlock block) { held.push_back(block); });
+	source.startStream();
+	QTRY_COMPARE(static_cast<int>(held.size()), BaseSource::MaxBlocksInFlight);
+	QTest::qWait(50);
+	QCOMPARE(static_cast<int>(held.size()), BaseSource::MaxBlocksInFlight);
+
+	/* And releasing them resumes it. */
+	held.clear();
+	QTRY_COMPARE(static_cast<int>(held.size()), BaseSource::MaxBlocksInFlight);
+	source.stopStream();
+}
+
+void TestLibDataSource::testFileSeek()
+{
+	FileSource source("test-file.h5");
+	source.initialize();
+	QSignalSpy statusSpy(&source, &BaseSource::status);
+	source.requestStatus();
+	auto status = statusSpy.first().at(0).toMap();
+	const auto sampleRate = status["sample-rate"].toDouble();
+	const auto frameSize = static_cast<quint64>(sampleRate * 10 / 1000.);
+	QCOMPARE(status["loop-range"].toList().at(0).toULongLong(), 0ull);
+	quint64 nsamples = status["loop-range"].toList().at(1).toULongLong();
+	QVERIFY(nsamples > 10 * frameSize);
+
+	/* Positions are given in samples or seconds, and must lie in the file. */
+	QVERIFY(!setAndWait(source, "position", nsamples));
+	QVERIFY(!setAndWait(source, "position", -0.5));
+	QVERIFY(!setAndWait(source, "position", "start"));
+	QVERIFY(setAndWait(source, "position", 2 * frameSize / sampleRate));
+	statusSpy.clear();
+	source.requestStatus();
+	QCOMPARE(statusSpy.first().at(0).toMap()["position"].toULongLong(), 2 * frameSize);
+
+	/* Loop ranges must be non-empty and lie in the file. */
+	QVERIFY(!setAndWait(source, "loop-range", QVariantList { 10, 10 }));
+	QVERIFY(!setAndWait(source, "loop-range", QVariantList { 0, nsamples + 1 }));
+	QVERIFY(!setAndWait(source, "loop-range", QVariantList { 0 }));
+
+	/* Record the start of each block, as the position before it is emitted. */
+	QList<SampleBlock> blocks;
+	QList<quint64> starts;
+	quint64 expectedStart = 2 * frameSize;
+	QObject::connect(&source, &BaseSource::dataAvailable,
+			[&](SampleBlock block) { 
+				blocks << block;
+				starts << expectedStart;
+			});
+	QVERIFY(setAndWait(source, "playback-rate", 10.));
+	source.startStream();
+	QTRY_VERIFY(blocks.size() >= 3);
+
+	/* Jump while streaming. The next block comes from the new position. */
+	auto before = blocks.size();
+	expectedStart = nsamples / 2;
+	QVERIFY(setAndWait(source, "position", static_cast<quint64>(nsamples / 2)));
+	QTRY_VERIFY(blocks.size() >= before + 3);
+
+	/* Loop over two and a half chunks, outside the current position,
+	 * which jumps to the start of the range.
+	 */
+	before = blocks.size();
+	const quint64 loopStart = frameSize;
+	const quint64 loopEnd = loopStart + 5 * frameSize / 2;
+	expectedStart = loopStart;
+	QVERIFY(setAndWait(source, "loop-range", QVariantList { loopStart, loopEnd }));
+	QTRY_VERIFY(blocks.size() >= before + 7);
+	source.stopStream();
+
+	/* Blocks before each jump continue on from the first of them, and
+	 * those in the loop range wrap around within it.
+	 */
+	QList<quint64> expected;
+	for (int i = 0; i < blocks.size(); i++) {
+		if ((i == 0) || (starts[i] != starts[i - 1])) {
+			expected << starts[i];
+		} else {
+			auto next = expected.last() + blocks[i - 1].nsamples();
+			if ((starts[i] == loopStart) && (next >= loopEnd)) {
+				next = loopStart;
+			}
+			expected << next;
+		}
+	}
+	QVERIFY(std::any_of(blocks.begin(), blocks.end(), [&](const SampleBlock& block) {
+				return block.nsamples() == loopEnd - loopStart - 2 * frameSize;
+			}));
+
+	QMutexLocker hdf5(hdf5Mutex());
+	datafile::DataFile file("test-file.h5");
+	for (int i = 0; i < blocks.size(); i++) {
+		const auto& block = blocks[i];
+		Samples data;
+		file.data(0, block.nchannels(), expected[i], expected[i] + block.nsamples(), data);
+		QVERIFY(arma::all(arma::vectorise(block.samples() == data)));
+	}
+
+	/* Stopping rewinds to the start of the loop range. */
+	hdf5.unlock();
+	statusSpy.clear();
+	source.requestStatus();
+	QCOMPARE(statusSpy.first().at(0).toMap()["position"].toULongLong(), loopStart);
+}
+
+void TestLibDataSource::testFileChannels()
+{
+	FileSource source("test-file.h5");
+	source.initialize();
+	QSignalSpy statusSpy(&source, &BaseSource::status);
+	source.requestStatus();
+	const auto nchannels = statusSpy.first().at(0).toMap()["nchannels"].toInt();
+	QVERIFY(nchannels >= 8);
+
+	/* Selections must be distinct channels within the file. */
+	QVERIFY(!setAndWait(source, "channels", QVariantList { 0, nchannels }));
+	QVERIFY(!setAndWait(source, "channels", QVariantList { 1, 1 }));
+	QVERIFY(!setAndWait(source, "channels", "0-2,2"));
+	QVERIFY(!setAndWait(source, "channels", "3-1"));
+
+	/* Ranges and single channels may be mixed, in any order. */
+	const std::vector<int> selected { nchannels - 1, 0, 1, 2, 5 };
+	QVERIFY(setAndWait(source, "channels", 
+				QString("%1,0-2,5").arg(nchannels - 1)));
+	statusSpy.clear();
+	source.requestStatus();
+	auto status = statusSpy.first().at(0).toMap();
+	QCOMPARE(status["nchannels"].toInt(), 5);
+	QCOMPARE(status["channels"].toList().size(), 5);
+	QCOMPARE(status["channels"].toList().first().toInt(), nchannels - 1);
+
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	source.startStream();
+	QTRY_VERIFY(dataSpy.size() >= 3);
+
+	/* The selection can't change under a running stream. */
+	QVERIFY(!setAndWait(source, "channels", QVariantList { 0 }));
+	source.stopStream();
+
+	QMutexLocker hdf5(hdf5Mutex());
+	datafile::DataFile file("test-file.h5");
+	quint64 start = 0;
+	for (auto& args : dataSpy) {
+		auto block = args.at(0).value<SampleBlock>();
+		QCOMPARE(static_cast<size_t>(block.nchannels()), selected.size());
+		Samples all;
+		file.data(0, nchannels, start, start + block.nsamples(), all);
+		for (size_t i = 0; i < selected.size(); i++) {
+			QVERIFY(arma::all(block.samples().col(i) == all.col(selected[i])));
+		}
+		start += block.nsamples();
+	}
+	hdf5.unlock();
+
+	/* An empty selection restores every channel. */
+	QVERIFY(setAndWait(source, "channels", QVariantList { }));
+	statusSpy.clear();
+	source.requestStatus();
+	QCOMPARE(statusSpy.first().at(0).toMap()["nchannels"].toInt(), nchannels);
+}
+
+void TestLibDataSource::testFileChunks()
+{
+	/* Ranges do not need the source to be initialized. */
+	FileSource source("test-file.h5");
+	QVERIFY_EXCEPTION_THROWN(source.chunks(0, 100, 0), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(source.chunks(0, 100, 10, "3-1"), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(source.chunks(0, 100, 10, QVariantList { 100000 }),
+			std::invalid_argument);
+
+	auto whole = source.chunks(0, std::numeric_limits<quint64>::max(), 
+			std::numeric_limits<quint64>::max());
+	QCOMPARE(whole.size(), static_cast<quint64>(1));
+	const Samples all = *whole.begin();
+	const auto nsamples = whole.stop();
+	QCOMPARE(static_cast<quint64>(all.n_rows), nsamples);
+	QCOMPARE(static_cast<int>(all.n_cols), whole.nchannels());
+
+	/* Chunks tile the range, the last holding the remainder. */
+	const quint64 chunkSize = 999, start = 17;
+	auto range = source.chunks(start, nsamples, chunkSize, "5,0-2");
+	QCOMPARE(range.size(), (nsamples - start + chunkSize - 1) / chunkSize);
+	const arma::uvec selected { 5, 0, 1, 2 };
+	quint64 expectedStart = start, count = 0;
+	for (auto it = range.begin(); it != range.end(); ++it, count++) {
+		QCOMPARE(it.start(), expectedStart);
+		const auto end = std::min(nsamples, expectedStart + chunkSize);
+		QCOMPARE(static_cast<quint64>(it->n_rows), end - expectedStart);
+		Samples rows = all.rows(expectedStart, end - 1);
+		Samples expected = rows.cols(selected);
+		QVERIFY(arma::all(arma::vectorise(*it == expected)));
+		expectedStart = end;
+	}
+	QCOMPARE(count, range.size());
+	QCOMPARE(expectedStart, nsamples);
+
+	/* Workers may read disjoint ranges of one file in parallel. */
+	const quint64 nworkers = 4, length = nsamples / nworkers;
+	QVector<QFuture<arma::Row<qint64>>> sums;
+	for (quint64 i = 0; i < nworkers; i++) {
+		sums << QtConcurrent::run([&source, i, length]() {
+					auto range = source.chunks(i * length, (i + 1) * length, 256);
+					arma::Row<qint64> sum(range.nchannels(), arma::fill::zeros);
+					for (const auto& chunk : range) {
+						sum += arma::sum(arma::conv_to<arma::Mat<qint64>>::from(chunk), 0);
+					}
+					return sum;
+				});
+	}
+	arma::Row<qint64> total(all.n_cols, arma::fill::zeros);
+	for (auto& sum : sums) {
+		total += sum.result();
+	}
+	arma::Row<qint64> expected = arma::sum(arma::conv_to<arma::Mat<qint64>>::from(
+				all.rows(0, nworkers * length - 1)), 0);
+	QVERIFY(arma::all(total == expected));
+}
+
+void TestLibDataSource::testRawFile()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	const arma::uword nsamples = 10000, nchannels = 6;
+	Samples expected(nsamples, nchannels);
+	for (arma::uword c = 0; c < nchannels; c++) {
+		for (arma::uword i = 0; i < nsamples; i++) {
+			expected(i, c) = static_cast<qint16>((i * 7 + c * 1000) % 65536);
+		}
+	}
+
+	/* Files without a sidecar, which aren't HDF5, can't be played back. */
+	const auto filename = dir.filePath("raw.bin");
+	QFile data(filename);
+	QVERIFY(data.open(QIODevice::WriteOnly));
+	data.close();
+	QVERIFY_EXCEPTION_THROWN(FileSource source(filename), std::invalid_argument);
+
+	for (auto layout : { "interleaved", "channel-major" }) {
+
+		/* Write the samples after a short header, in the given layout. */
+		const int headerBytes = 16;
+		QVERIFY(data.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		data.write(QByteArray(headerBytes, 'x'));
+		Samples stored = (QString(layout) == "interleaved") ? 
+			Samples(expected.t()) : expected;
+		data.write(reinterpret_cast<const char*>(stored.memptr()), 
+				stored.n_elem * sizeof(qint16));
+		data.close();
+
+		QFile sidecar(RawRecordingFile::sidecarName(filename));
+		QVERIFY(sidecar.open(QIODevice::WriteOnly | QIODevice::Truncate));
+		sidecar.write(QJsonDocument(QJsonObject {
+					{ "sample-rate", 10000 },
+					{ "nchannels", static_cast<int>(nchannels) },
+					{ "layout", layout },
+					{ "header-bytes", headerBytes },
+					{ "device-type", "mcs" },
+					{ "gain", 2.0 }
+				}).toJson());
+		sidecar.close();
+
+		FileSource source(filename);
+		source.initialize();
+		QSignalSpy statusSpy(&source, &BaseSource::status);
+		source.requestStatus();
+		auto status = statusSpy.first().at(0).toMap();
+		QCOMPARE(status["device-type"].toString(), QString("mcs"));
+		QCOMPARE(status["sample-rate"].toDouble(), 10000.);
+		QCOMPARE(status["gain"].toDouble(), 2.);
+		QCOMPARE(status["nchannels"].toInt(), static_cast<int>(nchannels));
+		QCOMPARE(status["loop-range"].toList().at(1).toULongLong(), 
+				static_cast<quint64>(nsamples));
+
+		/* Play back a selection of channels, skipping the blocks
+		 * emitted before consumers first hold up the stream.
+		 */
+		QVERIFY(setAndWait(source, "channels", "4,0-1"));
+		QVERIFY(setAndWait(source, "unthrottled", true));
+		QList<SampleBlock> blocks;
+		QObject::connect(&source, &BaseSource::dataAvailable,
+				[&blocks](SampleBlock block) { blocks << block; });
+		source.startStream();
+		QTRY_VERIFY(blocks.size() >= BaseSource::MaxBlocksInFlight);
+		blocks.clear();
+		QTRY_VERIFY(blocks.size() >= BaseSource::MaxBlocksInFlight);
+		source.stopStream();
+
+		const std::vector<arma::uword> selected { 4, 0, 1 };
+		quint64 start = blocks.first().nsamples() * BaseSource::MaxBlocksInFlight;
+		for (const auto& block : blocks) {
+			QCOMPARE(block.nchannels(), static_cast<arma::uword>(selected.size()));
+			for (size_t i = 0; i < selected.size(); i++) {
+				QVERIFY(arma::all(block.samples().col(i) == 
+							expected.col(selected[i]).rows(start, start + block.nsamples() - 1)));
+			}
+			start = (start + block.nsamples()) % nsamples;
+		}
+	}
+
+	/* An odd header would misalign the samples. */
+	QFile sidecar(RawRecordingFile::sidecarName(filename));
+	QVERIFY(sidecar.open(QIODevice::WriteOnly | QIODevice::Truncate));
+	sidecar.write(QJsonDocument(QJsonObject {
+				{ "sample-rate", 10000 },
+				{ "nchannels", static_cast<int>(nchannels) },
+				{ "header-bytes", 15 }
+			}).toJson());
+	sidecar.close();
+	QVERIFY_EXCEPTION_THROWN(FileSource source(filename), std::invalid_argument);
+}
+
+/* Copy one attribute of an HDF5 object to another. */
+static herr_t copyAttribute(hid_t source, const char* name, const H5A_info_t*, void* target)
+{
+	auto attr = H5Aopen(source, name, H5P_DEFAULT);
+	auto type = H5Aget_type(attr);
+	auto space = H5Aget_space(attr);
+	QByteArray value(static_cast<int>(H5Tget_size(type) * 
+				H5Sget_simple_extent_npoints(space)), '\0');
+	H5Aread(attr, type, value.data());
+	auto copy = H5Acreate2(*static_cast<hid_t*>(target), name, type, space,
+			H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(copy, type, value.constData());
+	H5Aclose(copy);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Aclose(attr);
+	return 0;
+}
+
+/* Write a copy of a recording, with its data shuffled and compressed
+ * in chunks of the given shape. If a number of channels is given, the
+ * recorded channels are repeated to make that many, each shifted in time
+ * so that no two chunks are the same.
+ */
+static bool writeCompressedCopy(const QString& source, const QString& target,
+		hsize_t chunkChannels, hsize_t chunkSamples, hsize_t nchannels = 0)
+{
+	QMutexLocker hdf5(hdf5Mutex());
+	auto in = H5Fopen(QFile::encodeName(source).constData(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	auto data = H5Dopen2(in, "data", H5P_DEFAULT);
+	auto space = H5Dget_space(data);
+	std::vector<qint16> samples(H5Sget_simple_extent_npoints(space));
+	H5Dread(data, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, samples.data());
+	if (nchannels) {
+		hsize_t dims[2] = { 0, 0 };
+		H5Sget_simple_extent_dims(space, dims, nullptr);
+		std::vector<qint16> repeated(nchannels * dims[1]);
+		for (hsize_t c = 0; c < nchannels; c++) {
+			for (hsize_t s = 0; s < dims[1]; s++) {
+				repeated[c * dims[1] + s] = 
+						samples[(c % dims[0]) * dims[1] + (s + 137 * c) % dims[1]];
+			}
+		}
+		samples.swap(repeated);
+		H5Sclose(space);
+		dims[0] = nchannels;
+		space = H5Screate_simple(2, dims, nullptr);
+	}
+
+	auto out = H5Fcreate(QFile::encodeName(target).constData(), H5F_ACC_TRUNC,
+			H5P_DEFAULT, H5P_DEFAULT);
+	auto plist = H5Pcreate(H5P_DATASET_CREATE);
+	hsize_t chunk[2] = { chunkChannels, chunkSamples };
+	H5Pset_chunk(plist, 2, chunk);
+	H5Pset_shuffle(plist);
+	H5Pset_deflate(plist, 4);
+	auto copy = H5Dcreate2(out, "data", H5T_STD_I16LE, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+	auto ok = (H5Dwrite(copy, H5T_NATIVE_SHORT, H5S_ALL, H5S_ALL, H5P_DEFAULT, samples.data()) >= 0);
+	H5Aiterate2(data, H5_INDEX_NAME, H5_ITER_NATIVE, nullptr, copyAttribute, &copy);
+
+	H5Dclose(copy);
+	H5Pclose(plist);
+	H5Fclose(out);
+	H5Sclose(space);
+	H5Dclose(data);
+	H5Fclose(in);
+	return ok;
+}
+
+void TestLibDataSource::testCompressedFile()
+{
+	QTemporaryDir dir;
+	const auto filename = dir.filePath("compressed.h5");
+	QVERIFY(writeCompressedCopy("test-file.h5", filename, 16, 1000));
+
+	/* Only the compressed file is read in chunks. */
+	Hdf5RecordingFile original("test-file.h5");
+	QVERIFY(!original.isReadingChunks());
+	Hdf5RecordingFile compressed(filename);
+	QVERIFY(compressed.isReadingChunks());
+	QCOMPARE(compressed.nsamples(), original.nsamples());
+	QCOMPARE(compressed.sampleRate(), original.sampleRate());
+
+	/* Reads within, across and at the edges of chunks, in and out
+	 * of order, match those of the uncompressed file.
+	 */
+	const int nchannels = original.nchannels();
+	const auto nsamples = original.nsamples();
+	const QList<QList<quint64>> reads {
+		{ 0, static_cast<quint64>(nchannels), 0, 200 },
+		{ 0, static_cast<quint64>(nchannels), 200, 1400 },
+		{ 3, 20, 900, 2100 },
+		{ 17, 18, 5000, 5001 },
+		{ 0, static_cast<quint64>(nchannels), nsamples - 300, nsamples },
+		{ 40, static_cast<quint64>(nchannels), 0, nsamples }
+	};
+	for (const auto& read : reads) {
+		Samples expected, actual;
+		original.data(read[0], read[1], read[2], read[3], expected);
+		compressed.data(read[0], read[1], read[2], read[3], actual);
+		QCOMPARE(actual.n_rows, expected.n_rows);
+		QCOMPARE(actual.n_cols, expected.n_cols);
+		QVERIFY(arma::all(arma::vectorise(actual == expected)));
+	}
+
+	/* And so does playback. */
+	FileSource source(filename);
+	source.initialize();
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	source.startStream();
+	QTRY_VERIFY(dataSpy.size() >= 3);
+	source.stopStream();
+	quint64 start = 0;
+	for (auto& args : dataSpy) {
+		auto block = args.at(0).value<SampleBlock>();
+		Samples expected;
+		original.data(0, nchannels, start, start + block.nsamples(), expected);
+		QVERIFY(arma::all(arma::vectorise(block.samples() == expected)));
+		start += block.nsamples();
+	}
+}
+
+void TestLibDataSource::testChunkCache()
+{
+	/* The least recently used chunks are evicted beyond the capacity. */
+	ChunkCache cache(300);
+	const QByteArray chunk(100, 'x');
+	for (quint64 i = 0; i < 3; i++) {
+		cache.insert({ "file.h5", "data", i }, chunk);
+	}
+	QCOMPARE(cache.size(), static_cast<quint64>(300));
+	QVERIFY(!cache.find({ "file.h5", "data", 0 }).isNull());
+	cache.insert({ "file.h5", "data", 3 }, chunk);
+	QCOMPARE(cache.count(), 3);
+	QVERIFY(cache.find({ "file.h5", "data", 1 }).isNull());
+	QVERIFY(!cache.find({ "file.h5", "data", 0 }).isNull());
+	QVERIFY(cache.find({ "other.h5", "data", 0 }).isNull());
+	QVERIFY(cache.find({ "file.h5", "other", 0 }).isNull());
+	QCOMPARE(cache.hits(), static_cast<quint64>(2));
+	QCOMPARE(cache.misses(), static_cast<quint64>(3));
+	QCOMPARE(cache.hitRate(), 0.4f);
+
+	/* Chunks found remain valid after they are evicted. */
+	auto found = cache.find({ "file.h5", "data", 3 });
+	cache.setCapacity(100);
+	QCOMPARE(cache.count(), 1);
+	QCOMPARE(cache.size(), static_cast<quint64>(100));
+	cache.insert({ "file.h5", "data", 4 }, QByteArray(101, 'y'));
+	QVERIFY(cache.find({ "file.h5", "data", 4 }).isNull());
+	QCOMPARE(found, chunk);
+	cache.clear();
+	QCOMPARE(cache.size(), static_cast<quint64>(0));
+
+	/* Readers of the same file decode each chunk once, between them. */
+	QTemporaryDir dir;
+	const auto filename = dir.filePath("compressed.h5");
+	QVERIFY(writeCompressedCopy("test-file.h5", filename, 16, 1000));
+	ChunkCache::instance().clear();
+	Hdf5ChunkReader first(filename), second(filename);
+	QVERIFY(first.isValid() && second.isValid());
+	first.setReadAhead(0);
+	second.setReadAhead(0);
+	Samples a, b;
+	QVERIFY(first.read(0, 64, 500, 2500, a));
+	const auto hits = ChunkCache::instance().hits();
+	const auto misses = ChunkCache::instance().misses();
+	QVERIFY(second.read(0, 64, 500, 2500, b));
+	QCOMPARE(ChunkCache::instance().misses(), misses);
+	QCOMPARE(ChunkCache::instance().hits(), hits + 3 * 4);
+	QVERIFY(arma::all(arma::vectorise(a == b)));
+
+	/* Sources report the shared cache in their status. */
+	FileSource source(filename);
+	source.initialize();
+	QSignalSpy statusSpy(&source, &BaseSource::status);
+	source.requestStatus();
+	auto status = statusSpy.first().at(0).toMap();
+	QCOMPARE(status["chunk-cache-size"].toULongLong(), ChunkCache::instance().size());
+	QVERIFY(status["chunk-cache-size"].toULongLong() >= 12 * 16 * 1000 * sizeof(qint16));
+	QVERIFY(status["chunk-cache-hit-rate"].toFloat() > 0.);
+	QCOMPARE(status["chunk-cache-capacity"].toULongLong(), ChunkCache::DefaultCapacity);
+
+	/* A file rewritten in place is decoded afresh, not served from the
+	 * cache. Wait a little, so that its modification time differs.
+	 */
+	const auto rewritten = dir.filePath("rewritten.h5");
+	QVERIFY(writeCompressedCopy("test-file.h5", rewritten, 16, 1000));
+	{
+		Hdf5ChunkReader reader(rewritten);
+		QVERIFY(reader.read(0, 64, 0, 1000, a));
+	}
+	QTest::qWait(20);
+	QVERIFY(writeCompressedCopy("test-file.h5", rewritten, 16, 1000, 64));
+	Hdf5ChunkReader reader(rewritten);
+	QVERIFY(reader.read(0, 64, 0, 1000, b));
+	QVERIFY(arma::any(arma::vectorise(a != b)));
+	Samples expected;
+	{
+		QMutexLocker hdf5(hdf5Mutex());
+		datafile::DataFile file(rewritten.toStdString());
+		file.data(0, 64, 0, 1000, expected);
+	}
+	QVERIFY(arma::all(arma::vectorise(b == expected)));
+}
+
+void TestLibDataSource::benchmarkCompressedFileRead_data()
+{
+	QTest::addColumn<int>("readAhead");
+	QTest::addColumn<bool>("cached");
+	QTest::newRow("libdatafile") << -1 << false;
+	QTest::newRow("chunks") << 0 << false;
+	QTest::newRow("chunks-read-ahead") << QThread::idealThreadCount() << false;
+	QTest::newRow("chunks-cached") << QThread::idealThreadCount() << true;
+}
+
+void TestLibDataSource::benchmarkCompressedFileRead()
+{
+	QFETCH(int, readAhead);
+	QFETCH(bool, cached);
+	QTemporaryDir dir;
+	const auto filename = dir.filePath("compressed.h5");
+	QVERIFY(writeCompressedCopy("test-file.h5", filename, 64, 1000,
+				HidensEmittedChannels));
+
+	/* The whole file fits in the shared cache, so every iteration after
+	 * the first would only find chunks in it, unless it is disabled.
+	 */
+	auto& cache = ChunkCache::instance();
+	const auto capacity = cache.capacity();
+	cache.clear();
+	cache.setCapacity(cached ? capacity : 0);
+
+	/* Read the whole file, as many channels as a HiDens recording, in
+	 * 10ms chunks at 20kHz.
+	 */
+	const quint64 chunkSize = 200;
+	Hdf5RecordingFile compressed(filename);
+	const auto nsamples = compressed.nsamples();
+	const auto nchannels = compressed.nchannels();
+	QCOMPARE(nchannels, HidensEmittedChannels);
+	Samples out;
+	if (readAhead < 0) {
+		QMutexLocker hdf5(hdf5Mutex());
+		datafile::DataFile file(filename.toStdString());
+		QBENCHMARK {
+			for (quint64 start = 0; start < nsamples; start += chunkSize) {
+				file.data(0, nchannels, start, start + chunkSize, out);
+			}
+		}
+	} else {
+		Hdf5ChunkReader reader(filename);
+		QVERIFY(reader.isValid());
+		reader.setReadAhead(readAhead);
+		QBENCHMARK {
+			for (quint64 start = 0; start < nsamples; start += chunkSize) {
+				reader.read(0, nchannels, start, start + chunkSize, out);
+			}
+		}
+	}
+	cache.setCapacity(capacity);
+}
+
+void TestLibDataSource::testSyntheticSource()
+{
+	QVERIFY_EXCEPTION_THROWN(create("synthetic", "nchannels=0"), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(create("synthetic", "nchannels=100000"), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(create("synthetic", "sample-rate=fast"), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(create("synthetic", "spike-rate=10000"), std::invalid_argument);
+
+	std::unique_ptr<BaseSource> base(create("synthetic", 
+				"nchannels=1024,sample-rate=10000,seed=7"));
+	auto* source = qobject_cast<SyntheticSource*>(base.get());
+	QVERIFY(source);
+	source->initialize();
+	QSignalSpy statusSpy(source, &BaseSource::status);
+	source->requestStatus();
+	auto status = statusSpy.first().at(0).toMap();
+	QCOMPARE(status["nchannels"].toInt(), 1024);
+	QCOMPARE(status["sample-rate"].toDouble(), 10000.);
+
+	/* Data depends only on the sample index, not on how it is chunked. */
+	Samples whole(1000, 1024), first(300, 1024), second(700, 1024);
+	source->generate(5000, whole);
+	source->generate(5000, first);
+	source->generate(5300, second);
+	QVERIFY(arma::all(arma::vectorise(whole == arma::join_cols(first, second))));
+
+	/* Each channel has about 5 spikes per second, which stand out from
+	 * the noise and sinusoid.
+	 */
+	Samples second10(10000, 4);
+	source->generate(0, second10);
+	for (arma::uword c = 0; c < second10.n_cols; c++) {
+		arma::uvec below = arma::find(second10.col(c) < -250);
+		arma::uword spikes = below.is_empty() ? 0 : 1;
+		for (arma::uword i = 1; i < below.n_elem; i++) {
+			spikes += (below(i) > below(i - 1) + 50);
+		}
+		QVERIFY(spikes >= 4 && spikes <= 6);
+	}
+
+	/* Streamed blocks are the generated data, in order. */
+	QSignalSpy dataSpy(source, &BaseSource::dataAvailable);
+	source->startStream();
+	QTRY_VERIFY(dataSpy.size() >= 3);
+	source->stopStream();
+	quint64 start = 0;
+	for (auto& args : dataSpy) {
+		auto block = args.at(0).value<SampleBlock>();
+		QCOMPARE(block.nsamples(), static_cast<arma::uword>(100));
+		Samples expected(block.nsamples(), block.nchannels());
+		source->generate(start, expected);
+		QVERIFY(arma::all(arma::vectorise(block.samples() == expected)));
+		start += block.nsamples();
+	}
+
+	/* Unthrottled generation is limited only by consumers. Paced, these
+	 * blocks would take 10 seconds.
+	 */
+	int count = 0;
+	QObject::connect(source, &BaseSource::dataAvailable, 
+			[&count](SampleBlock) { count++; });
+	QVERIFY(setAndWait(*source, "unthrottled", true));
+	source->startStream();
+	QTRY_VERIFY(count >= 1000);
+	source->stopStream();
+
+	/* Consumers holding on to blocks stall it, and releasing them
+	 * resumes it.
+	 */
+	std::vector<SampleBlock> held;
+	QObject::connect(source, &BaseSource::dataAvailable, 
+			[&held](SampleBlock block) { held.push_back(block); });
+	source->startStream();
+	QTRY_COMPARE(static_cast<int>(held.size()), BaseSource::MaxBlocksInFlight);
+	held.clear();
+	QTRY_COMPARE(static_cast<int>(held.size()), BaseSource::MaxBlocksInFlight);
+	source->stopStream();
+}
+
+void TestLibDataSource::benchmarkSyntheticSource_data()
+{
+	QTest::addColumn<int>("nchannels");
+	QTest::newRow("64") << 64;
+	QTest::newRow("127") << 127;
+	QTest::newRow("1024") << 1024;
+	QTest::newRow("4096") << 4096;
+}
+
+void TestLibDataSource::benchmarkSyntheticSource()
+{
+	QFETCH(int, nchannels);
+
+	/* One 10ms chunk at 20kHz. */
+	SyntheticSource source(QString("nchannels=%1").arg(nchannels));
+	Samples out(200, nchannels);
+	quint64 start = 0;
+	QBENCHMARK {
+		source.generate(start, out);
+		start += out.n_rows;
+	}
+}
+
+void TestLibDataSource::testStreamAllocations()
+{
+	/* Stream an unthrottled source to a consumer connected directly, which
+	 * releases each block at once. Each pass of the source's timer emits a
+	 * batch of blocks back to back, up to its limit of blocks in flight.
+	 * The pass each block belongs to is recorded by counting the timer's
+	 * timeouts after the source has handled them.
+	 */
+	std::vector<quint64> counts, ticks;
+	counts.reserve(2048);
+	ticks.reserve(2048);
+	quint64 tick = 0;
+	SyntheticSource source("nchannels=64");
+	source.initialize();
+	QVERIFY(setAndWait(source, "unthrottled", true));
+	auto timer = source.findChild<QTimer*>();
+	QVERIFY(timer);
+	QObject::connect(timer, &QTimer::timeout, &source,
+			[&tick]() { tick++; }, Qt::DirectConnection);
+	QObject::connect(&source, &BaseSource::dataAvailable, &source,
+			[&counts, &ticks, &tick](SampleBlock) {
+				if (counts.size() < counts.capacity()) {
+					counts.push_back(allocationCount.load());
+					ticks.push_back(tick);
+				}
+			}, Qt::DirectConnection);
+	source.startStream();
+	QTRY_VERIFY(counts.size() == counts.capacity());
+	source.stopStream();
+
+	/* After warming up, the read and publish path allocates nothing. Only
+	 * the intervals between batches, which span the event loop, may.
+	 */
+	int intervals = 0;
+	for (size_t i = counts.size() / 2; i < counts.size(); i++) {
+		if (ticks[i] != ticks[i - 1]) {
+			continue;
+		}
+		intervals++;
+		QCOMPARE(counts[i], counts[i - 1]);
+	}
+	QVERIFY(intervals >= static_cast<int>(counts.size() / 4));
+}
+
+void TestLibDataSource::testRecordingSink_data()
+{
+	QTest::addColumn<int>("compression");
+	QTest::newRow("uncompressed") << 0;
+	QTest::newRow("compressed") << 4;
+}
+
+void TestLibDataSource::testRecordingSink()
+{
+	QFETCH(int, compression);
+	QTemporaryDir dir;
+	QVERIFY_EXCEPTION_THROWN(RecordingSink(dir.filePath("missing/recording.h5")),
+			std::invalid_argument);
+
+	/* Record a deterministic source. Chunks of the file span several
+	 * blocks, and are not a whole number of them.
+	 */
+	const int nchannels = 32;
+	SyntheticSource source(QString("nchannels=%1,sample-rate=10000").arg(nchannels));
+	source.initialize();
+	const auto filename = dir.filePath("recording.h5");
+	RecordingSink sink(filename);
+	sink.setChunkSamples(257);
+	sink.setCompression(compression);
+	sink.attach(&source);
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	source.startStream();
+	QTRY_VERIFY(dataSpy.size() >= 7);
+	source.stopStream();
+	sink.detach();
+
+	quint64 nsamples = 0;
+	for (auto& args : dataSpy) {
+		nsamples += args.at(0).value<SampleBlock>().nsamples();
+	}
+	QCOMPARE(sink.samplesWritten(), nsamples);
+	QCOMPARE(sink.blocksDropped(), static_cast<quint64>(0));
+	QSignalSpy statusSpy(&sink, &RecordingSink::status);
+	sink.requestStatus();
+	auto status = statusSpy.first().at(0).toMap();
+	QCOMPARE(status["queue-depth"].toInt(), 0);
+	QCOMPARE(status["samples-written"].toULongLong(), nsamples);
+	QVERIFY(status["write-throughput"].toDouble() > 0.);
+
+	/* The file is read back as it was recorded. */
+	Hdf5RecordingFile file(filename);
+	QCOMPARE(file.isReadingChunks(), compression > 0);
+	QCOMPARE(file.nsamples(), nsamples);
+	QCOMPARE(file.nchannels(), nchannels);
+	QCOMPARE(file.sampleRate(), 10000.f);
+	QCOMPARE(file.array(), QString("synthetic"));
+	Samples recorded, expected(nsamples, nchannels);
+	file.data(0, nchannels, 0, nsamples, recorded);
+	source.generate(0, expected);
+	QVERIFY(arma::all(arma::vectorise(recorded == expected)));
+}
+
+void TestLibDataSource::testRecordingSinkConfiguration()
+{
+	/* Record a HiDens source, which reports its configuration. */
+	MockHidensServer server;
+	HidensSource source(server.location());
+	initializeHidensSource(source);
+	if (QTest::currentTestFailed()) {
+		return;
+	}
+	const auto configuration = configurationOf(source);
+	QTemporaryDir dir;
+	const auto filename = dir.filePath("recording.h5");
+	{
+		RecordingSink sink(filename);
+		sink.attach(&source);
+		QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+		source.startStream();
+		QTRY_VERIFY(dataSpy.size() >= 3);
+		source.stopStream();
+		sink.detach();
+	}
+
+	/* The configuration is read back as it was reported. */
+	Hdf5RecordingFile file(filename);
+	QCOMPARE(file.array(), QString("hidens"));
+	QCOMPARE(file.configuration().size(), configuration.size());
+	QVERIFY(file.configuration() == configuration);
+}
+
+void TestLibDataSource::testHistoryBuffer()
+{
+	QVERIFY_EXCEPTION_THROWN(HistoryBuffer(0.), std::invalid_argument);
+
+	/* Retain 50ms, i.e., 5 blocks, of a deterministic source, and stream
+	 * until the buffer has wrapped several times.
+	 */
+	const int nchannels = 16;
+	SyntheticSource source(QString("nchannels=%1,sample-rate=10000").arg(nchannels));
+	source.initialize();
+	HistoryBuffer history(0.05);
+	history.attach(&source);
+	QCOMPARE(history.capacity(), 0ull);
+	source.startStream();
+	QTRY_VERIFY(history.end() >= 1500);
+	source.stopStream();
+	QCOMPARE(history.capacity(), 500ull);
+	QCOMPARE(history.nchannels(), nchannels);
+	QCOMPARE(history.sampleRate(), 10000.f);
+	const auto end = history.end();
+	QCOMPARE(history.begin(), end - 500);
+
+	/* Snapshots are the generated data, including those spanning the
+	 * end of the buffer, and refer to the buffer without copying. Copies
+	 * are the same data.
+	 */
+	for (auto from : { history.begin(), end - 250, end - 499, end - 1, end }) {
+		auto view = history.snapshot(from, end);
+		Samples expected(end - from, nchannels);
+		source.generate(from, expected);
+		QCOMPARE(view.n_rows, static_cast<arma::uword>(end - from));
+		QVERIFY(arma::all(arma::vectorise(Samples(view) == expected)));
+		QVERIFY(arma::all(arma::vectorise(history.copy(from, end) == expected)));
+		QVERIFY(history.isIntact(from));
+	}
+	QCOMPARE(&history.snapshot(end - 300, end).at(0, 1),
+			&history.snapshot(end - 300, end).at(0, 1));
+	QVERIFY_EXCEPTION_THROWN(history.snapshot(end - 501, end), std::out_of_range);
+	QVERIFY_EXCEPTION_THROWN(history.snapshot(end - 10, end + 1), std::out_of_range);
+	QVERIFY_EXCEPTION_THROWN(history.snapshot(end, end - 1), std::out_of_range);
+	QVERIFY_EXCEPTION_THROWN(history.copy(end - 501, end), std::out_of_range);
+	QVERIFY(!history.isIntact(0));
+
+	/* Dumps are written while acquisition continues. The data from the
+	 * restarted stream only reaches the range requested after several
+	 * blocks.
+	 */
+	QTemporaryDir dir;
+	QSignalSpy dumpSpy(&history, &HistoryBuffer::dumpFinished);
+	const auto filename = dir.filePath("dump.h5");
+	const auto from = end - 250, to = end - 50;
+	source.startStream();
+	history.requestDump(from, to, filename);
+	history.requestDump(0, 100, dir.filePath("expired.h5"));
+	QTRY_COMPARE(dumpSpy.size(), 2);
+	source.stopStream();
+	history.detach();
+	for (auto& args : dumpSpy) {
+		QCOMPARE(args.at(1).toBool(), args.at(0).toString() == filename);
+	}
+
+	Hdf5RecordingFile file(filename);
+	QCOMPARE(file.nsamples(), to - from);
+	QCOMPARE(file.nchannels(), nchannels);
+	QCOMPARE(file.sampleRate(), 10000.f);
+	Samples dumped, expected(to - from, nchannels);
+	file.data(0, nchannels, 0, to - from, dumped);
+	source.generate(from, expected);
+	QVERIFY(arma::all(arma::vectorise(dumped == expected)));
+
+	/* Attaching to a source whose thread is not running does not wait
+	 * for the source to report its status.
+	 */
+	QThread idle;
+	SyntheticSource remote(QString("nchannels=%1").arg(nchannels));
+	remote.moveToThread(&idle);
+	history.attach(&remote);
+	QVERIFY(qIsNaN(history.sampleRate()));
+	QCOMPARE(history.end(), 0ull);
+	history.detach();
+}
+
+/* Return samples drawn uniformly from [low, high], the same on every run. */
+static Samples randomSamples(arma::uword nsamples, arma::uword nchannels,
+		int low = std::numeric_limits<qint16>::min(),
+		int high = std::numeric_limits<qint16>::max())
+{
+	arma::arma_rng::set_seed(4);
+	return arma::randi<Samples>(nsamples, nchannels, arma::distr_param(low, high));
+}
+
+/* Return the instruction sets supported by the running CPU, including
+ * KernelIsa::Best, so that every variant of a kernel can be checked.
+ */
+static std::vector<KernelIsa> supportedKernelIsas()
+{
+	std::vector<KernelIsa> isas;
+	for (auto isa : { KernelIsa::Scalar, KernelIsa::Sse2, 
+			KernelIsa::Avx2, KernelIsa::Best }) {
+		if (kernelSupported(isa)) {
+			isas.push_back(isa);
+		}
+	}
+	return isas;
+}
+
+/* Add a row to the "isa" column of a benchmark for each instruction
+ * set supported by the running CPU. Benchmarks which also vary the
+ * number of channels pass it, to fill their "nchannels" column.
+ */
+static void addKernelIsaRows(int nchannels = 0)
+{
+	const std::vector<std::pair<KernelIsa, QString>> isas {
+		{ KernelIsa::Scalar, "scalar" },
+		{ KernelIsa::Sse2, "sse2" },
+		{ KernelIsa::Avx2, "avx2" }
+	};
+	for (const auto& isa : isas) {
+		if (!kernelSupported(isa.first)) {
+			continue;
+		}
+		if (nchannels > 0) {
+			QTest::newRow(qPrintable(QString("%1-%2").arg(nchannels).arg(isa.second)))
+					<< nchannels << static_cast<int>(isa.first);
+		} else {
+			QTest::newRow(qPrintable(isa.second)) << static_cast<int>(isa.first);
+		}
+	}
+}
+
+/* Attach a stage to an initialized source, and stream the source until
+ * it has emitted at least the given number of blocks. The samples the
+ * source emitted are returned in \p data.
+ */
+static void streamThroughStage(BaseSource& source, SourceStage& stage,
+		int nblocks, Samples& data)
+{
+	stage.attach(&source);
+	QSignalSpy dataSpy(&source, &BaseSource::dataAvailable);
+	source.startStream();
+	QTRY_VERIFY(dataSpy.size() >= nblocks);
+	source.stopStream();
+	stage.detach();
+	data.reset();
+	for (auto& args : dataSpy) {
+		data = arma::join_cols(data, args.at(0).value<SampleBlock>().samples());
+	}
+}
+
+/* Reference envelope of consecutive bins of every channel. */
+static void envelopeReference(const Samples& samples, 
+		const std::vector<arma::uword>& edges, Samples& minima, Samples& maxima)
+{
+	minima.set_size(edges.size() - 1, samples.n_cols);
+	maxima.set_size(edges.size() - 1, samples.n_cols);
+	for (arma::uword b = 0; b < minima.n_rows; b++) {
+		const auto bin = samples.rows(edges[b], edges[b + 1] - 1);
+		minima.row(b) = arma::min(bin, 0);
+		maxima.row(b) = arma::max(bin, 0);
+	}
+}
+
+void TestLibDataSource::testPreviewStage()
+{
+	QVERIFY_EXCEPTION_THROWN(PreviewStage(0.), std::invalid_argument);
+
+	/* Include bins which are empty, or not a multiple of the vector width. */
+	const auto samples = randomSamples(300, 4);
+	std::vector<arma::uword> edges { 0, 0, 1, 8, 9, 24, 41, 41, 100, 263, 300 };
+	for (auto isa : supportedKernelIsas()) {
+		for (arma::uword c = 0; c < samples.n_cols; c++) {
+			std::vector<qint16> minima(edges.size() - 1), maxima(edges.size() - 1);
+			minMaxEnvelope(samples.colptr(c), edges.data(), edges.size() - 1,
+					minima.data(), maxima.data(), isa);
+			for (arma::uword b = 0; b < minima.size(); b++) {
+				if (edges[b] == edges[b + 1]) {
+					QCOMPARE(minima[b], std::numeric_limits<qint16>::max());
+					QCOMPARE(maxima[b], std::numeric_limits<qint16>::min());
+				} else {
+					const auto bin = samples(arma::span(edges[b], edges[b + 1] - 1), c);
+					QCOMPARE(minima[b], bin.min());
+					QCOMPARE(maxima[b], bin.max());
+				}
+			}
+		}
+	}
+
+	/* Stream a deterministic source into bins of 33.3 samples, which
+	 * span the source's blocks of 100 samples.
+	 */
+	const int nchannels = 16;
+	SyntheticSource source(QString("nchannels=%1,sample-rate=10000").arg(nchannels));
+	source.initialize();
+	PreviewStage preview(300.);
+	QSignalSpy previewSpy(&preview, &PreviewStage::previewAvailable);
+	Samples data;
+	streamThroughStage(source, preview, 5, data);
+	QCOMPARE(preview.sampleRate(), 10000.f);
+	QVERIFY(previewSpy.size() >= 10);
+
+	/* Every bin is emitted once, in order, and is the envelope of the
+	 * generated data.
+	 */
+	quint64 nbins = 0;
+	Samples minima, maxima;
+	for (auto& args : previewSpy) {
+		QCOMPARE(args.at(0).toULongLong(), nbins);
+		auto blockMin = args.at(1).value<SampleBlock>();
+		auto blockMax = args.at(2).value<SampleBlock>();
+		QCOMPARE(blockMin.nchannels(), static_cast<arma::uword>(nchannels));
+		QCOMPARE(blockMax.nsamples(), blockMin.nsamples());
+		minima = arma::join_cols(minima, blockMin.samples());
+		maxima = arma::join_cols(maxima, blockMax.samples());
+		nbins += blockMin.nsamples();
+	}
+	edges.clear();
+	for (quint64 b = 0; b <= nbins; b++) {
+		edges.push_back(static_cast<arma::uword>(b * (10000. / 300.)));
+	}
+	QVERIFY(edges.back() <= data.n_rows);
+	Samples expectedMin, expectedMax;
+	envelopeReference(data.rows(0, edges.back() - 1), edges, expectedMin, expectedMax);
+	QVERIFY(arma::all(arma::vectorise(minima == expectedMin)));
+	QVERIFY(arma::all(arma::vectorise(maxima == expectedMax)));
+}
+
+void TestLibDataSource::benchmarkPreviewStage_data()
+{
+	QTest::addColumn<int>("isa");
+	QTest::newRow("armadillo") << -1;
+	addKernelIsaRows();
+}
+
+void TestLibDataSource::benchmarkPreviewStage()
+{
+	QFETCH(int, isa);
+
+	/* One 10ms chunk at 20kHz from all HiDens channels, in bins of 40
+	 * samples, i.e., a preview at 500Hz.
+	 */
+	const arma::uword nsamples = 200, nbins = 5;
+	const auto samples = randomSamples(nsamples, HidensEmittedChannels);
+	std::vector<arma::uword> edges;
+	for (arma::uword b = 0; b <= nbins; b++) {
+		edges.push_back(b * nsamples / nbins);
+	}
+	Samples minima(nbins, samples.n_cols), maxima(nbins, samples.n_cols);
+	if (isa < 0) {
+		QBENCHMARK {
+			envelopeReference(samples, edges, minima, maxima);
+		}
+	} else {
+		QBENCHMARK {
+			for (arma::uword c = 0; c < samples.n_cols; c++) {
+				minMaxEnvelope(samples.colptr(c), edges.data(), nbins,
+						minima.colptr(c), maxima.colptr(c), 
+						static_cast<KernelIsa>(isa));
+			}
+		}
+	}
+}
+
+void TestLibDataSource::testSpikeDetector()
+{
+	QVERIFY_EXCEPTION_THROWN(SpikeDetector(0.), std::invalid_argument);
+
+	/* Include sizes which are not a multiple of the vector width. */
+	const auto samples = randomSamples(237, 3);
+	for (qint16 level : { -32768, -10000, 0, 32767 }) {
+		for (auto isa : supportedKernelIsas()) {
+			for (arma::uword c = 0; c < samples.n_cols; c++) {
+				std::vector<arma::uword> below;
+				samplesBelow(samples.colptr(c), samples.n_rows, level, below, isa);
+				arma::uvec expected = arma::find(samples.col(c) < level);
+				QCOMPARE(below, arma::conv_to<std::vector<arma::uword>>::from(expected));
+			}
+		}
+	}
+
+	/* Detect the spikes of a source with noise of peak 20 and no
+	 * sinusoid, for about half a second.
+	 */
+	const int nchannels = 16;
+	SyntheticSource source(QString("nchannels=%1,sample-rate=10000,"
+				"sine-amplitude=0").arg(nchannels));
+	source.initialize();
+	SpikeDetector detector;
+	QSignalSpy spikeSpy(&detector, &SpikeDetector::spikesAvailable);
+	Samples streamed;
+	streamThroughStage(source, detector, 50, streamed);
+	QCOMPARE(detector.sampleRate(), 10000.f);
+	const quint64 nsamples = streamed.n_rows;
+	auto noise = detector.noise();
+	QCOMPARE(noise.size(), nchannels);
+	for (auto sigma : noise) {
+		QVERIFY(sigma > 5. && sigma < 30.);
+	}
+
+	/* Spikes within each emission are ordered, and separated on each
+	 * channel by the refractory period of 10 samples. Each amplitude is
+	 * the trough of the refractory period.
+	 */
+	const quint64 refractory = 10, slack = 30;
+	Samples data(nsamples + slack, nchannels);
+	source.generate(0, data);
+	std::vector<std::vector<quint64>> detected(nchannels);
+	for (auto& args : spikeSpy) {
+		auto spikes = args.at(0).value<QVector<SpikeEvent>>();
+		QVERIFY(!spikes.isEmpty());
+		for (int i = 0; i < spikes.size(); i++) {
+			const auto& spike = spikes[i];
+			QVERIFY(i == 0 || spikes[i - 1].sample <= spike.sample);
+			QVERIFY(spike.channel >= 0 && spike.channel < nchannels);
+			QVERIFY(spike.sample + refractory <= nsamples);
+			QCOMPARE(spike.amplitude, data(arma::span(spike.sample, 
+					spike.sample + refractory - 1), spike.channel).min());
+			detected[spike.channel].push_back(spike.sample);
+		}
+	}
+
+	/* Every spike is detected once, shortly before its trough passes
+	 * well below the noise.
+	 */
+	int total = 0;
+	for (int c = 0; c < nchannels; c++) {
+		auto& times = detected[c];
+		std::sort(times.begin(), times.end());
+		for (size_t i = 1; i < times.size(); i++) {
+			QVERIFY(times[i] >= times[i - 1] + refractory);
+		}
+		std::vector<quint64> onsets;
+		for (arma::uword i = 1; i < data.n_rows; i++) {
+			if ((data(i, c) < -200) && (data(i - 1, c) >= -200) &&
+					(onsets.empty() || (i > onsets.back() + 50))) {
+				onsets.push_back(i);
+			}
+		}
+		for (auto time : times) {
+			QVERIFY(std::any_of(onsets.begin(), onsets.end(),
+						[&](quint64 onset) { 
+							return (onset >= time) && (onset <= time + slack);
+						}));
+		}
+		for (auto onset : onsets) {
+			if (onset + refractory > nsamples) {
+				continue;
+			}
+			QVERIFY(std::any_of(times.begin(), times.end(),
+						[&](quint64 time) { 
+							return (onset >= time) && (onset <= time + slack);
+						}));
+		}
+		total += times.size();
+	}
+	QVERIFY(total > nchannels);
+}
+
+void TestLibDataSource::benchmarkSpikeDetector_data()
+{
+	QTest::addColumn<int>("isa");
+	addKernelIsaRows();
+}
+
+void TestLibDataSource::benchmarkSpikeDetector()
+{
+	QFETCH(int, isa);
+
+	/* One 10ms chunk at 20kHz from all HiDens channels, with spikes. */
+	SyntheticSource source(QString("nchannels=%1").arg(HidensEmittedChannels));
+	Samples samples(200, HidensEmittedChannels);
+	source.generate(0, samples);
+	std::vector<arma::uword> below;
+	QBENCHMARK {
+		for (arma::uword c = 0; c < samples.n_cols; c++) {
+			below.clear();
+			samplesBelow(samples.colptr(c), samples.n_rows, -300, below,
+					static_cast<KernelIsa>(isa));
+		}
+	}
+}
+
+void TestLibDataSource::testFilterStage()
+{
+	QVERIFY_EXCEPTION_THROWN(FilterStage(0.), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(FilterStage(500., 300.), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(BiquadFilter::highpass(10000., 20000.), std::invalid_argument);
+
+	/* Filtering in blocks is the same as filtering at once. Include a
+	 * number of channels which is not a multiple of the vector width, and
+	 * blocks which are not a multiple of the tile.
+	 */
+	const auto samples = randomSamples(1000, 70, -2000, 1999);
+	Samples reference;
+	for (auto isa : supportedKernelIsas()) {
+		auto filter = BiquadFilter::bandpass(300., 5000., 20000.);
+		QCOMPARE(filter.sections().size(), static_cast<size_t>(4));
+		Samples whole = samples;
+		filter.apply(whole, isa);
+		filter.reset();
+		Samples blocks;
+		for (auto span : { arma::span(0, 0), arma::span(1, 63), arma::span(64, 999) }) {
+			Samples block = samples.rows(span);
+			filter.apply(block, isa);
+			blocks = arma::join_cols(blocks, block);
+		}
+		QVERIFY(arma::all(arma::vectorise(whole == blocks)));
+
+		/* Every instruction set gives exactly the same result. */
+		if (isa == KernelIsa::Scalar) {
+			reference = whole;
+		}
+		QVERIFY(arma::all(arma::vectorise(whole == reference)));
+	}
+
+	/* The band is passed, and an offset and low frequencies are removed. */
+	const double pi = std::acos(-1.);
+	Samples signal(4000, 2);
+	for (arma::uword t = 0; t < signal.n_rows; t++) {
+		signal(t, 0) = static_cast<qint16>(std::lround(1000 + 
+					300 * std::sin(2 * pi * 1000. * t / 20000.)));
+		signal(t, 1) = static_cast<qint16>(std::lround(1000 + 
+					300 * std::sin(2 * pi * 20. * t / 20000.)));
+	}
+	auto filter = BiquadFilter::bandpass(300., 5000., 20000.);
+	filter.apply(signal);
+	const auto settled = arma::span(2000, 3999);
+	const auto passed = arma::abs(arma::conv_to<arma::Col<int>>::from(
+				signal(settled, 0))).max();
+	const auto removed = arma::abs(arma::conv_to<arma::Col<int>>::from(
+				signal(settled, 1))).max();
+	QVERIFY(passed > 250 && passed < 350);
+	QVERIFY(removed < 5);
+
+	/* The stage emits filtered copies of a source's blocks, leaving
+	 * those of the source untouched.
+	 */
+	const int nchannels = 16;
+	SyntheticSource source(QString("nchannels=%1,sample-rate=20000").arg(nchannels));
+	source.initialize();
+	FilterStage stage;
+	QSignalSpy filteredSpy(&stage, &FilterStage::dataAvailable);
+	Samples raw;
+	streamThroughStage(source, stage, 5, raw);
+	QCOMPARE(stage.sampleRate(), 20000.f);
+
+	Samples filtered;
+	for (auto& args : filteredSpy) {
+		filtered = arma::join_cols(filtered, args.at(0).value<SampleBlock>().samples());
+	}
+	QCOMPARE(filtered.n_rows, raw.n_rows);
+	Samples expected(raw.n_rows, nchannels);
+	source.generate(0, expected);
+	QVERIFY(arma::all(arma::vectorise(raw == expected)));
+	auto streamFilter = BiquadFilter::bandpass(FilterStage::DefaultLowCutoff,
+			FilterStage::DefaultHighCutoff, 20000.);
+	streamFilter.apply(expected);
+	QVERIFY(arma::all(arma::vectorise(filtered == expected)));
+
+	/* Only the selected channels are filtered, and the others, such as
+	 * a photodiode, are passed through unchanged. Channels beyond those
+	 * of the source are ignored.
+	 */
+	FilterStage partial;
+	QVERIFY_EXCEPTION_THROWN(partial.setChannels({ 0, -1 }), std::invalid_argument);
+	QVERIFY_EXCEPTION_THROWN(partial.setChannels({ 2, 2 }), std::invalid_argument);
+	partial.setChannels({ 3, 0, 1, nchannels + 4 });
+	SyntheticSource other(QString("nchannels=%1,sample-rate=20000").arg(nchannels));
+	other.initialize();
+	QSignalSpy partialSpy(&partial, &FilterStage::dataAvailable);
+	streamThroughStage(other, partial, 5, raw);
+	filtered.reset();
+	for (auto& args : partialSpy) {
+		filtered = arma::join_cols(filtered, args.at(0).value<SampleBlock>().samples());
+	}
+	QCOMPARE(filtered.n_rows, raw.n_rows);
+	const arma::uvec selected { 3, 0, 1 };
+	Samples selection = raw.cols(selected);
+	auto partialFilter = BiquadFilter::bandpass(FilterStage::DefaultLowCutoff,
+			FilterStage::DefaultHighCutoff, 20000.);
+	partialFilter.apply(selection);
+	expected = raw;
+	expected.cols(selected) = selection;
+	QVERIFY(arma::all(arma::vectorise(filtered == expected)));
+}
+
+void TestLibDataSource::benchmarkFilterStage_data()
+{
+	QTest::addColumn<int>("nchannels");
+	QTest::addColumn<int>("isa");
+	for (int nchannels : { 64, HidensEmittedChannels }) {
+		addKernelIsaRows(nchannels);
+	}
+}
+
+void TestLibDataSource::benchmarkFilterStage()
+{
+	QFETCH(int, nchannels);
+	QFETCH(int, isa);
+
+	/* One 10ms chunk at 20kHz, through a fourth-order band-pass filter
+	 * (MCS systems record 64 channels, HiDens 127).
+	 */
+	SyntheticSource source(QString("nchannels=%1").arg(nchannels));
+	Samples samples(200, nchannels);
+	source.generate(0, samples);
+	auto filter = BiquadFilter::bandpass(300., 5000., 20000.);
+	QBENCHMARK {
+		filter.apply(samples, static_cast<KernelIsa>(isa));
+	}
+}
+
+/* A SampleClock whose time, in nanoseconds, is set by hand. */
+class ManualClock : public SampleClock {
+	public:
+		using SampleClock::SampleClock;
+		qint64 time = 0;
+	protected:
+		qint64 now() const Q_DECL_OVERRIDE { return time; }
+};
+
+void TestLibDataSource::testSampleClock()
+{
+	ManualClock clock(10000.);
+	QVERIFY(!clock.isValid());
+	QCOMPARE(clock.due(), 0ull);
+
+	/* Samples become due with elapsed time, counted from start. */
+	clock.time = 5000000;
+	clock.start();
+	QVERIFY(clock.isValid());
+	QCOMPARE(clock.due(), 0ull);
+	clock.time += 100050000;
+	QCOMPARE(clock.due(), 1000ull);
+	QCOMPARE(clock.pending(), 1000ull);
+	clock.advance(1000);
+	QCOMPARE(clock.pending(), 0ull);
+	QCOMPARE(clock.emitted(), 1000ull);
+
+	/* The next 100 samples are due in 99.5 samples, rounded up to 10 ms. */
+	QCOMPARE(clock.msecsUntil(100), 10);
+	QCOMPARE(clock.msecsUntil(0), 0);
+
+	/* The fractional sample due is kept across a change of rate, and
+	 * later samples become due at the new rate.
+	 */
+	clock.setRate(2.);
+	QCOMPARE(clock.due(), 1000ull);
+	clock.time += 5000000;
+	QCOMPARE(clock.due(), 1100ull);
+	QVERIFY(std::abs(clock.exactDue() - 1100.5) < 1e-6);
+	QCOMPARE(clock.msecsUntil(100), 0);
+	QCOMPARE(clock.msecsUntil(101), 1);
+
+	/* Stopping the clock keeps the samples due. */
+	clock.setRate(0.);
+	clock.time += 1000000000;
+	QCOMPARE(clock.due(), 1100ull);
+	QCOMPARE(clock.msecsUntil(100), 0);
+
+	/* As does a change of sample rate. */
+	clock.setRate(1.);
+	clock.setSampleRate(20000.);
+	clock.time += 1000000;
+	QCOMPARE(clock.due(), 1120ull);
+
+	/* Samples due never drift, however the time is divided. */
+	clock.start();
+	for (int i = 0; i < 1000; i++) {
+		clock.time += 7000001;
+	}
+	QCOMPARE(clock.due(), 140000ull);
+}
+
 void TestLibDataSource::cleanupTestCase()
 {
 	for (auto& source : sources)
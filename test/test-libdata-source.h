@@ -9,6 +9,7 @@
 #define TEST_LIBDATA_SOURCE_H
 
 #include "../include/data-source.h"
+#include "mock-hidens-server.h"
 
 #include <QtTest/QtTest>
 
@@ -29,6 +30,48 @@ class TestLibDataSource : public QObject {
 		void testGetParameters();
 		void testGetStatus();
 		void testSetParameters();
+		void testSerialize();
+		void testSampleBlock();
+		void testFrameRing();
+		void testFramePool();
+		void testHidensConversion();
+		void benchmarkHidensConversion_data();
+		void benchmarkHidensConversion();
+		void testElectrodeTable();
+		void testHidensSource();
+		void testHidensConnectedMode();
+		void benchmarkHidensStream_data();
+		void benchmarkHidensStream();
+		void benchmarkHidensLatency_data();
+		void benchmarkHidensLatency();
+		void testFilePrefetcher();
+		void testFilePlaybackRate();
+		void testFileSeek();
+		void testFileChannels();
+		void testFileChunks();
+		void testRawFile();
+		void testCompressedFile();
+		void testChunkCache();
+		void benchmarkCompressedFileRead_data();
+		void benchmarkCompressedFileRead();
+		void testSyntheticSource();
+		void benchmarkSyntheticSource_data();
+		void benchmarkSyntheticSource();
+		void testStreamAllocations();
+		void testRecordingSink_data();
+		void testRecordingSink();
+		void testRecordingSinkConfiguration();
+		void testHistoryBuffer();
+		void testPreviewStage();
+		void benchmarkPreviewStage_data();
+		void benchmarkPreviewStage();
+		void testSpikeDetector();
+		void benchmarkSpikeDetector_data();
+		void benchmarkSpikeDetector();
+		void testFilterStage();
+		void benchmarkFilterStage_data();
+		void benchmarkFilterStage();
+		void testSampleClock();
 		void cleanupTestCase();
 
 	private:
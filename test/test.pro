@@ -11,9 +11,10 @@ INCLUDEPATH += . \
 
 linux {
 	INCLUDEPATH += /usr/include/hdf5/serial
+	LIBS += -L/usr/lib/x86_64-linux-gnu/hdf5/serial
 }
 
-LIBS += -L../lib/
+LIBS += -L../lib/ -lhdf5
 
 win32 {
 	LIBS += -ldata-source0
@@ -28,5 +29,7 @@ CONFIG -= app_bundle
 QMAKE_RPATHDIR += $$(PWD)/../lib $$(PWD)/../../libdatafile/lib
 
 # Input
-HEADERS += test-libdata-source.h
-SOURCES += test-libdata-source.cc
+HEADERS += test-libdata-source.h \
+	mock-hidens-server.h
+SOURCES += test-libdata-source.cc \
+	mock-hidens-server.cc